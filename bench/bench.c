@@ -0,0 +1,442 @@
+// Headless benchmark for the physics step. Runs simulation_step on
+// generated initial conditions at several sizes, reports speed and how well
+// energy and momentum are conserved, and optionally checks the results
+// against a stored baseline so CTest can catch regressions. Drift and force
+// error are checked whenever there is a baseline; steps/s only with
+// --tolerance, since it only means something against a baseline recorded
+// on the same machine and build.
+#include "cluster.h"
+#include "sim.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define BENCH_SEED 20240607
+#define BENCH_DISK_RADIUS 1000.0  //for 1000 bodies, grows with sqrt(N) to keep the density fixed
+#define BENCH_BODY_MASS 1e10
+#define BENCH_BODY_RADIUS 0.1 //small, so few bodies merge within the horizon
+#define BENCH_EXACT_ENERGY_LIMIT 16384 //above this the potential comes from the tree
+#define BENCH_DRIFT_FACTOR 2.0         //drift may grow to this multiple of the baseline
+#define BENCH_DRIFT_FLOOR 1e-12        //below this drift is rounding noise
+#define BENCH_ERROR_SAMPLES 256        //bodies the force error is measured on
+
+typedef struct {
+    int n;
+    long steps;   //fixed horizon, shorter for the bigger systems
+} bench_size;
+
+static const bench_size DEFAULT_SIZES[] = {
+    {1000, 200},
+    {10000, 50},
+    {100000, 10},
+    {1000000, 3},
+};
+
+typedef struct {
+    int n;
+    char mode[32];
+    int threads;
+    long steps;
+    double seconds;
+    double stepsPerSecond;
+    double nsPerInteraction;
+    double energyDrift;
+    double momentumDrift;
+    int merged;
+    char precision[16];  //GRAVITY_PRECISION the bench was built with
+    double forceError;   //mean relative error of the first accelerations
+} bench_result;
+
+// splitmix64, so the initial conditions are the same on every platform
+static uint64_t bench_random(uint64_t *state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static double bench_uniform(uint64_t *state) {
+    return (bench_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Uniform disk on roughly circular orbits around its centre. When `exact` is
+// given it receives x, y and mass of every body as generated, before the
+// store rounds them to `real`.
+static int bench_generate(body_store *store, int n, uint64_t seed, double *exact) {
+    uint64_t state = seed;
+    double radius = BENCH_DISK_RADIUS * sqrt(n / 1000.0);
+    double total = BENCH_BODY_MASS * n;
+    // Speeds are in pixels per tick, and a tick applies GRAVITY_TIMESTEP of acceleration
+    double g = GRAVITATIONAL_CONSTANT * GRAVITY_TIMESTEP;
+    SDL_Color color = {255, 255, 255, 255};
+    if (body_store_reserve(store, n) != 0) {
+        return -1;
+    }
+    for (int i = 0; i < n; i++) {
+        double r = radius * sqrt(bench_uniform(&state));
+        double angle = 2 * M_PI * bench_uniform(&state);
+        double speed = sqrt(g * total * r) / radius; //circular speed for the mass inside r
+        // Part rotation, part random motion: a cold disk clumps and merges within a few hundred steps
+        double spin = 0.7 * speed;
+        double dispersion = 0.5 * speed;
+        double vx = -spin * sin(angle) + dispersion * (2 * bench_uniform(&state) - 1);
+        double vy = spin * cos(angle) + dispersion * (2 * bench_uniform(&state) - 1);
+        double x = r * cos(angle);
+        double y = r * sin(angle);
+        if (exact) {
+            exact[3 * i] = x;
+            exact[3 * i + 1] = y;
+            exact[3 * i + 2] = BENCH_BODY_MASS;
+        }
+        if (create_body(store, x, y, BENCH_BODY_RADIUS, vx, vy, BENCH_BODY_MASS, color) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Kinetic and potential energy in the units the integrator uses
+static void bench_energy(simulation *sim, double *kineticOut, double *potentialOut) {
+    body_store *store = &sim->bodies;
+    double kinetic = 0;
+    int alive = 0;
+    for (int i = 0; i < store->count; i++) {
+        if (store->isAlive[i]) {
+            kinetic += 0.5 * store->mass[i] * (store->vx[i] * store->vx[i] + store->vy[i] * store->vy[i]);
+            alive++;
+        }
+    }
+    const quadtree *tree = NULL;
+    if (alive > BENCH_EXACT_ENERGY_LIMIT && quadtree_build(&sim->tree, store) == 0) {
+        tree = &sim->tree;
+    }
+    *kineticOut = kinetic;
+    *potentialOut = GRAVITY_TIMESTEP * gravity_potential_energy(store, tree, sim->theta, sim->pool);
+}
+
+static void bench_momentum(const body_store *store, double *px, double *py, double *scale) {
+    *px = *py = *scale = 0;
+    for (int i = 0; i < store->count; i++) {
+        if (store->isAlive[i]) {
+            *px += store->mass[i] * store->vx[i];
+            *py += store->mass[i] * store->vy[i];
+            *scale += store->mass[i] * sqrt(store->vx[i] * store->vx[i] + store->vy[i] * store->vy[i]);
+        }
+    }
+}
+
+// Mean relative error of the engine's accelerations for the initial state,
+// against a double direct sum over the exact initial conditions, on evenly
+// spaced sample bodies. Covers both the engine and the storage precision.
+static double bench_force_error(simulation *sim, const double *exact, int n) {
+    simulation_gravity(sim);
+    const body_store *store = &sim->bodies;
+    int stride = (n > BENCH_ERROR_SAMPLES) ? n / BENCH_ERROR_SAMPLES : 1;
+    double sum = 0;
+    int count = 0;
+    for (int i = 0; i < n; i += stride) {
+        double ref_x = 0, ref_y = 0;
+        for (int j = 0; j < n; j++) {
+            double dx = exact[3 * j] - exact[3 * i];
+            double dy = exact[3 * j + 1] - exact[3 * i + 1];
+            double d2 = dx * dx + dy * dy;
+            if (d2 > 0) {
+                double w = exact[3 * j + 2] / (d2 * sqrt(d2));
+                ref_x += w * dx;
+                ref_y += w * dy;
+            }
+        }
+        ref_x *= GRAVITATIONAL_CONSTANT;
+        ref_y *= GRAVITATIONAL_CONSTANT;
+        double magnitude = hypot(ref_x, ref_y);
+        if (magnitude > 0) {
+            sum += hypot(store->ax[i] - ref_x, store->ay[i] - ref_y) / magnitude;
+            count++;
+        }
+    }
+    return (count > 0) ? sum / count : 0;
+}
+
+static int bench_run(bench_size size, gravity_mode mode, double theta, int threads, int workers,
+                     uint64_t seed, bench_result *result) {
+    // Workers are forked while this is still the only thread
+    cluster *workerCluster = NULL;
+    if (workers > 0 && !(workerCluster = cluster_start(workers, CLUSTER_DEFAULT_REBALANCE))) {
+        return -1;
+    }
+    simulation sim;
+    double *exact = malloc(3 * (size_t)size.n * sizeof(double));
+    if (!exact) {
+        perror("Error allocating memory");
+        cluster_stop(workerCluster);
+        return -1;
+    }
+    if (simulation_init(&sim, mode, theta, threads) != 0 || bench_generate(&sim.bodies, size.n, seed, exact) != 0) {
+        free(exact);
+        cluster_stop(workerCluster);
+        simulation_free(&sim);
+        return -1;
+    }
+    // The first step computes its forces again, so this is not timed twice.
+    // Workers are not involved: the cluster only takes over below.
+    double forceError = (workers > 0) ? NAN : bench_force_error(&sim, exact, size.n);
+    free(exact);
+    sim.cluster = workerCluster;
+
+    double kineticStart, potentialStart;
+    bench_energy(&sim, &kineticStart, &potentialStart);
+    double pxStart, pyStart, scale;
+    bench_momentum(&sim.bodies, &pxStart, &pyStart, &scale);
+
+    double start = simulation_clock();
+    for (long i = 0; i < size.steps; i++) {
+        simulation_step(&sim);
+    }
+    if (simulation_sync(&sim) != 0) {
+        simulation_free(&sim);
+        return -1;
+    }
+    double seconds = simulation_clock() - start;
+
+    double kineticEnd, potentialEnd;
+    bench_energy(&sim, &kineticEnd, &potentialEnd);
+    double pxEnd, pyEnd, unused;
+    bench_momentum(&sim.bodies, &pxEnd, &pyEnd, &unused);
+
+    memset(result, 0, sizeof(*result));
+    result->n = size.n;
+    if (workers > 0) {
+        // Workers run Barnes-Hut in one process each, threads counts the processes
+        snprintf(result->mode, sizeof(result->mode), "cluster");
+        result->threads = workers;
+    } else {
+        snprintf(result->mode, sizeof(result->mode), "%s", gravity_mode_name(mode));
+        result->threads = thread_pool_size(sim.pool);
+    }
+    result->steps = size.steps;
+    result->seconds = seconds;
+    result->stepsPerSecond = (seconds > 0) ? size.steps / seconds : 0;
+    // Per pair of the direct sum, so every engine is on the same scale
+    result->nsPerInteraction = seconds * 1e9 / ((double)size.steps * size.n * (size.n - 1));
+    // Relative to K + |W| rather than the total, which can be close to zero
+    result->energyDrift = fabs(kineticEnd + potentialEnd - kineticStart - potentialStart) /
+                          (kineticStart + fabs(potentialStart));
+    result->momentumDrift = (scale > 0) ? hypot(pxEnd - pxStart, pyEnd - pyStart) / scale : 0;
+    result->merged = size.n - sim.bodies.count;
+    snprintf(result->precision, sizeof(result->precision), "%s", GRAVITY_PRECISION_NAME);
+    result->forceError = forceError;
+
+    simulation_free(&sim);
+    return 0;
+}
+
+static const char *BENCH_HEADER = "n,mode,threads,steps,seconds,steps_per_sec,ns_per_interaction,energy_drift,momentum_drift,merged,precision,force_error";
+
+static void bench_write(FILE *file, const bench_result *r) {
+    fprintf(file, "%d,%s,%d,%ld,%.6g,%.6g,%.6g,%.6e,%.6e,%d,%s,%.6e\n",
+            r->n, r->mode, r->threads, r->steps, r->seconds, r->stepsPerSecond,
+            r->nsPerInteraction, r->energyDrift, r->momentumDrift, r->merged,
+            r->precision, r->forceError);
+}
+
+// Read a results file written by bench_write, returns the number of rows or -1.
+// Files from before the precision columns read as double with no force error.
+static int bench_read(const char *path, bench_result *rows, int maxRows) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        perror("Error opening baseline");
+        return -1;
+    }
+    char line[512];
+    int count = 0;
+    while (count < maxRows && fgets(line, sizeof(line), file) != NULL) {
+        bench_result *r = &rows[count];
+        snprintf(r->precision, sizeof(r->precision), "double");
+        r->forceError = NAN;
+        int fields = sscanf(line, "%d,%31[^,],%d,%ld,%lf,%lf,%lf,%lf,%lf,%d,%15[^,],%lf",
+                            &r->n, r->mode, &r->threads, &r->steps, &r->seconds, &r->stepsPerSecond,
+                            &r->nsPerInteraction, &r->energyDrift, &r->momentumDrift, &r->merged,
+                            r->precision, &r->forceError);
+        if (fields == 10 || fields == 12) {
+            count++; //the header and anything else malformed is skipped
+        }
+    }
+    fclose(file);
+    return count;
+}
+
+// Compare one result against the baseline row for the same size, engine and
+// precision. Steps/s is only compared when tolerance is not negative.
+static int bench_check(const bench_result *r, const bench_result *baseline, int numBaseline, double tolerance) {
+    for (int i = 0; i < numBaseline; i++) {
+        const bench_result *b = &baseline[i];
+        if (b->n != r->n || strcmp(b->mode, r->mode) != 0 || strcmp(b->precision, r->precision) != 0) {
+            continue;
+        }
+        int failed = 0;
+        if (tolerance >= 0 && r->steps == b->steps && r->stepsPerSecond < b->stepsPerSecond * (1 - tolerance)) {
+            printf("FAIL n=%d %s: %.3g steps/s, baseline %.3g\n", r->n, r->mode, r->stepsPerSecond, b->stepsPerSecond);
+            failed = 1;
+        }
+        if (r->energyDrift > fmax(b->energyDrift * BENCH_DRIFT_FACTOR, BENCH_DRIFT_FLOOR)) {
+            printf("FAIL n=%d %s: energy drift %.3e, baseline %.3e\n", r->n, r->mode, r->energyDrift, b->energyDrift);
+            failed = 1;
+        }
+        if (r->momentumDrift > fmax(b->momentumDrift * BENCH_DRIFT_FACTOR, BENCH_DRIFT_FLOOR)) {
+            printf("FAIL n=%d %s: momentum drift %.3e, baseline %.3e\n", r->n, r->mode, r->momentumDrift, b->momentumDrift);
+            failed = 1;
+        }
+        if (!isnan(b->forceError) && r->forceError > fmax(b->forceError * BENCH_DRIFT_FACTOR, BENCH_DRIFT_FLOOR)) {
+            printf("FAIL n=%d %s: force error %.3e, baseline %.3e\n", r->n, r->mode, r->forceError, b->forceError);
+            failed = 1;
+        }
+        if (!failed) {
+            printf("PASS n=%d %s\n", r->n, r->mode);
+        }
+        return failed;
+    }
+    printf("n=%d %s %s has no baseline, not checked\n", r->n, r->mode, r->precision);
+    return 0;
+}
+
+// Speed and force error of one result relative to the row for the same size
+// and engine in a reference file, usually the same bench built in another
+// precision
+static void bench_compare(const bench_result *r, const bench_result *reference, int numReference) {
+    for (int i = 0; i < numReference; i++) {
+        const bench_result *b = &reference[i];
+        if (b->n != r->n || strcmp(b->mode, r->mode) != 0) {
+            continue;
+        }
+        printf("n=%d %s: %s is %.2fx the steps/s of %s, force error %.3e against %.3e\n",
+               r->n, r->mode, r->precision, (b->stepsPerSecond > 0) ? r->stepsPerSecond / b->stepsPerSecond : 0,
+               b->precision, r->forceError, b->forceError);
+        return;
+    }
+    printf("n=%d %s is not in the reference\n", r->n, r->mode);
+}
+
+int main(int argc, char *argv[]) {
+    bench_size sizes[16];
+    int numSizes = 0;
+    long steps = 0; //0 keeps each size's default horizon
+    gravity_mode mode = GRAVITY_BARNES_HUT;
+    double theta = 0.5;
+    int threads = thread_pool_cpu_count();
+    int workers = 0;
+    uint64_t seed = BENCH_SEED;
+    const char *output = NULL;
+    const char *baselinePath = NULL;
+    const char *referencePath = NULL;
+    double tolerance = -1; //fraction of baseline steps/s allowed to be lost, negative for no check
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--sizes") == 0 && i + 1 < argc) {
+            for (char *token = strtok(argv[++i], ","); token && numSizes < 16; token = strtok(NULL, ",")) {
+                int n = atoi(token);
+                long horizon = 10;
+                for (size_t k = 0; k < sizeof(DEFAULT_SIZES) / sizeof(DEFAULT_SIZES[0]); k++) {
+                    if (DEFAULT_SIZES[k].n == n) {
+                        horizon = DEFAULT_SIZES[k].steps;
+                    }
+                }
+                if (n > 1) {
+                    sizes[numSizes].n = n;
+                    sizes[numSizes].steps = horizon;
+                    numSizes++;
+                }
+            }
+        } else if (strcmp(argv[i], "--steps") == 0 && i + 1 < argc) {
+            steps = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--direct") == 0) {
+            mode = GRAVITY_DIRECT;
+        } else if (strcmp(argv[i], "--pm") == 0) {
+            mode = GRAVITY_PARTICLE_MESH;
+        } else if (strcmp(argv[i], "--p3m") == 0) {
+            mode = GRAVITY_P3M;
+        } else if (strcmp(argv[i], "--theta") == 0 && i + 1 < argc) {
+            theta = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            workers = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            output = argv[++i];
+        } else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+            baselinePath = argv[++i];
+        } else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc) {
+            tolerance = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--reference") == 0 && i + 1 < argc) {
+            referencePath = argv[++i];
+        } else {
+            printf("Usage: %s [--sizes <n,n,...>] [--steps <count>] [--direct | --pm | --p3m]\n"
+                   "       [--theta <opening angle>] [--threads <count>] [--workers <processes>]\n"
+                   "       [--seed <seed>] [--output <results.csv>]\n"
+                   "       [--baseline <results.csv>] [--tolerance <fraction of steps/s>]\n"
+                   "       [--reference <results.csv>]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (numSizes == 0) {
+        numSizes = sizeof(DEFAULT_SIZES) / sizeof(DEFAULT_SIZES[0]);
+        memcpy(sizes, DEFAULT_SIZES, sizeof(DEFAULT_SIZES));
+    }
+
+    bench_result baseline[64];
+    int numBaseline = 0;
+    if (baselinePath && (numBaseline = bench_read(baselinePath, baseline, 64)) < 0) {
+        return 2;
+    }
+    bench_result reference[64];
+    int numReference = 0;
+    if (referencePath && (numReference = bench_read(referencePath, reference, 64)) < 0) {
+        return 2;
+    }
+    FILE *file = NULL;
+    if (output && !(file = fopen(output, "w"))) {
+        perror("Error opening output");
+        return 2;
+    }
+    if (file) {
+        fprintf(file, "%s\n", BENCH_HEADER);
+    }
+
+    printf("precision: %s\n", GRAVITY_PRECISION_NAME);
+    printf("%9s %-11s %7s %6s %10s %12s %14s %12s %14s %6s %12s\n", "n", "mode", "threads", "steps",
+           "seconds", "steps/s", "ns/interaction", "energy drift", "momentum drift", "merged", "force error");
+    int failed = 0;
+    for (int i = 0; i < numSizes; i++) {
+        if (steps > 0) {
+            sizes[i].steps = steps;
+        }
+        bench_result r;
+        if (bench_run(sizes[i], mode, theta, threads, workers, seed, &r) != 0) {
+            failed = 1;
+            continue;
+        }
+        printf("%9d %-11s %7d %6ld %10.3f %12.3f %14.4g %12.3e %14.3e %6d %12.3e\n", r.n, r.mode, r.threads, r.steps,
+               r.seconds, r.stepsPerSecond, r.nsPerInteraction, r.energyDrift, r.momentumDrift, r.merged, r.forceError);
+        if (file) {
+            bench_write(file, &r);
+            fflush(file);
+        }
+        if (baselinePath) {
+            failed |= bench_check(&r, baseline, numBaseline, tolerance);
+        }
+        if (referencePath) {
+            bench_compare(&r, reference, numReference);
+        }
+    }
+
+    if (file) {
+        fclose(file);
+    }
+    return failed;
+}
@@ -0,0 +1,478 @@
+#define _POSIX_C_SOURCE 200112L //posix_memalign
+#include "body.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+void body_store_init(body_store *store) {
+    memset(store, 0, sizeof(*store));
+}
+
+void body_store_free(body_store *store) {
+    free(store->x);
+    free(store->y);
+    free(store->vx);
+    free(store->vy);
+    free(store->ax);
+    free(store->ay);
+    free(store->prevX);
+    free(store->prevY);
+    free(store->mass);
+    free(store->radius);
+    free(store->color);
+    free(store->isAlive);
+    free(store->id);
+    free(store->slotOf);
+    free(store->freeIds);
+    free(store->freeSlots);
+    free(store->retiredIds);
+    body_store_init(store);
+}
+
+// realloc() for cache-line aligned arrays, keeps the first `used` bytes
+static int grow_aligned(void **array, size_t used, size_t size) {
+    void *grown = NULL;
+    if (posix_memalign(&grown, BODY_STORE_ALIGNMENT, size) != 0) {
+        return -1;
+    }
+    if (*array) {
+        memcpy(grown, *array, used);
+        free(*array);
+    }
+    *array = grown;
+    return 0;
+}
+
+int body_store_reserve(body_store *store, int capacity) {
+    if (capacity <= store->capacity) {
+        return 0;
+    }
+    size_t used = store->count;
+    size_t size = capacity;
+    if (grow_aligned((void **)&store->x, used * sizeof(real), size * sizeof(real)) ||
+        grow_aligned((void **)&store->y, used * sizeof(real), size * sizeof(real)) ||
+        grow_aligned((void **)&store->vx, used * sizeof(real), size * sizeof(real)) ||
+        grow_aligned((void **)&store->vy, used * sizeof(real), size * sizeof(real)) ||
+        grow_aligned((void **)&store->ax, used * sizeof(real), size * sizeof(real)) ||
+        grow_aligned((void **)&store->ay, used * sizeof(real), size * sizeof(real)) ||
+        grow_aligned((void **)&store->prevX, used * sizeof(real), size * sizeof(real)) ||
+        grow_aligned((void **)&store->prevY, used * sizeof(real), size * sizeof(real)) ||
+        grow_aligned((void **)&store->mass, used * sizeof(real), size * sizeof(real)) ||
+        grow_aligned((void **)&store->radius, used * sizeof(real), size * sizeof(real)) ||
+        grow_aligned((void **)&store->color, used * sizeof(SDL_Color), size * sizeof(SDL_Color)) ||
+        grow_aligned((void **)&store->isAlive, used * sizeof(bool), size * sizeof(bool)) ||
+        grow_aligned((void **)&store->id, used * sizeof(int), size * sizeof(int)) ||
+        (capacity > store->idCapacity &&
+         grow_aligned((void **)&store->slotOf, store->nextId * sizeof(int), size * sizeof(int))) ||
+        grow_aligned((void **)&store->freeIds, store->numFreeIds * sizeof(int), size * sizeof(int)) ||
+        grow_aligned((void **)&store->freeSlots, store->numFreeSlots * sizeof(int), size * sizeof(int)) ||
+        grow_aligned((void **)&store->retiredIds, store->numRetiredIds * sizeof(int), size * sizeof(int))) {
+        perror("Error reallocating memory");
+        return -1;
+    }
+    store->capacity = capacity;
+    if (capacity > store->idCapacity) {
+        store->idCapacity = capacity;
+    }
+    return 0;
+}
+
+// Make slotOf hold `ids` entries without growing anything else
+static int body_store_reserve_ids(body_store *store, int ids) {
+    if (ids <= store->idCapacity) {
+        return 0;
+    }
+    int capacity = (ids > 2 * store->idCapacity) ? ids : 2 * store->idCapacity;
+    if (grow_aligned((void **)&store->slotOf, store->nextId * sizeof(int), capacity * sizeof(int)) != 0) {
+        perror("Error reallocating memory");
+        return -1;
+    }
+    store->idCapacity = capacity;
+    return 0;
+}
+
+// push and attach: a body with a fresh id, or with `id` when it is not -1
+static int body_store_insert(body_store *store, const body *b, int id) {
+    // Ids index slotOf, so a fresh id needs room just like a new slot does
+    bool reuse = store->numFreeSlots > 0;
+    int slots = reuse ? store->count : store->count + 1;
+    int ids = (id >= 0) ? 0 : (store->numFreeIds > 0) ? store->nextId : store->nextId + 1;
+    if (slots > store->capacity || ids > store->capacity) {
+        // Grow capacity by factor of two if initial capacity is 0 or double the existing capacity
+        if (body_store_reserve(store, (store->capacity == 0) ? 1 : store->capacity * 2) != 0) {
+            return -1;
+        }
+    }
+    if (id >= 0 && body_store_reserve_ids(store, id + 1) != 0) {
+        return -1;
+    }
+
+    int index;
+    if (reuse) {
+        // Reuse a tombstone. Its id must not resolve to the new body, and it
+        // is not handed out again before the compaction that would free it.
+        index = store->freeSlots[--store->numFreeSlots];
+        if (store->id[index] >= 0) {
+            store->slotOf[store->id[index]] = -1;
+            store->retiredIds[store->numRetiredIds++] = store->id[index];
+        }
+    } else {
+        index = store->count++;
+    }
+
+    if (id < 0) {
+        id = (store->numFreeIds > 0) ? store->freeIds[--store->numFreeIds] : store->nextId++;
+    }
+    while (store->nextId <= id) {
+        store->slotOf[store->nextId++] = -1; //skipped ids belong to another store
+    }
+    store->id[index] = id;
+    store->slotOf[id] = index;
+    store->ax[index] = 0;
+    store->ay[index] = 0;
+    body_store_set(store, index, b);
+    store->prevX[index] = b->x;
+    store->prevY[index] = b->y;
+    store->isAlive[index] = true;
+    store->changes++;
+    return index;
+}
+
+int body_store_push(body_store *store, const body *b) {
+    return body_store_insert(store, b, -1);
+}
+
+int body_store_attach(body_store *store, const body *b, int id) {
+    return body_store_insert(store, b, id);
+}
+
+int body_store_append(body_store *store, int n) {
+    // Ids index slotOf, which is as long as the store's capacity
+    int needed = ((store->count > store->nextId) ? store->count : store->nextId) + n;
+    if (body_store_reserve(store, needed) != 0) {
+        return -1;
+    }
+    int first = store->count;
+    for (int k = 0; k < n; k++) {
+        int index = first + k;
+        int id = store->nextId++;
+        store->id[index] = id;
+        store->slotOf[id] = index;
+        store->isAlive[index] = true;
+    }
+    store->count += n;
+    store->changes++;
+    return first;
+}
+
+body body_store_get(const body_store *store, int index) {
+    body b;
+    b.isAlive = store->isAlive[index];
+    b.x = store->x[index];
+    b.y = store->y[index];
+    b.radius = store->radius[index];
+    b.Xspeed = store->vx[index];
+    b.Yspeed = store->vy[index];
+    b.mass = store->mass[index];
+    b.color = store->color[index];
+    return b;
+}
+
+void body_store_set(body_store *store, int index, const body *b) {
+    // isAlive is left alone, only push and kill change it
+    store->x[index] = b->x;
+    store->y[index] = b->y;
+    store->radius[index] = b->radius;
+    store->vx[index] = b->Xspeed;
+    store->vy[index] = b->Yspeed;
+    store->mass[index] = b->mass;
+    store->color[index] = b->color;
+}
+
+void body_store_kill(body_store *store, int index) {
+    if (!store->isAlive[index]) {
+        return;
+    }
+    store->isAlive[index] = false;
+    store->freeSlots[store->numFreeSlots++] = index;
+    store->changes++;
+}
+
+int body_store_detach(body_store *store, int index) {
+    int id = store->id[index];
+    body_store_kill(store, index);
+    // Neither in use nor free: compaction and reuse of the slot skip it
+    store->slotOf[id] = -1;
+    store->id[index] = -1;
+    return id;
+}
+
+static void body_store_move(body_store *store, int to, int from) {
+    store->x[to] = store->x[from];
+    store->y[to] = store->y[from];
+    store->vx[to] = store->vx[from];
+    store->vy[to] = store->vy[from];
+    store->ax[to] = store->ax[from];
+    store->ay[to] = store->ay[from];
+    store->prevX[to] = store->prevX[from];
+    store->prevY[to] = store->prevY[from];
+    store->mass[to] = store->mass[from];
+    store->radius[to] = store->radius[from];
+    store->color[to] = store->color[from];
+    store->isAlive[to] = store->isAlive[from];
+    store->id[to] = store->id[from];
+    store->slotOf[store->id[to]] = to;
+}
+
+// Give the id of a dead slot back to the free list, unless it was detached
+static void body_store_release(body_store *store, int index) {
+    if (store->id[index] < 0) {
+        return;
+    }
+    store->slotOf[store->id[index]] = -1;
+    store->freeIds[store->numFreeIds++] = store->id[index];
+}
+
+int body_store_compact(body_store *store) {
+    int removed = store->numFreeSlots;
+    while (store->numFreeSlots > 0) {
+        int hole = store->freeSlots[--store->numFreeSlots];
+        // Dead bodies at the tail just fall off the end
+        while (store->count > 0 && !store->isAlive[store->count - 1]) {
+            body_store_release(store, --store->count);
+        }
+        if (hole >= store->count) {
+            continue; //already trimmed off the tail
+        }
+        body_store_release(store, hole);
+        body_store_move(store, hole, --store->count);
+    }
+    while (store->numRetiredIds > 0) {
+        store->freeIds[store->numFreeIds++] = store->retiredIds[--store->numRetiredIds];
+    }
+    return removed;
+}
+
+int body_store_find(const body_store *store, int id) {
+    if (id < 0 || id >= store->nextId) {
+        return -1;
+    }
+    return store->slotOf[id];
+}
+
+int loadBodiesFromFile(const char *filename, body_store *store) {
+    FILE *file = fopen(filename, "r");
+    if (!file) {
+        perror("Error opening file");
+        return -1; // Return -1 on failure
+    }
+
+    char line[256];        // Buffer to hold a line from the file
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+        double radius, Xspeed, Yspeed, x, y, mass;
+        Uint8 r, g, b, a;
+
+        // Parse each line
+        int itemsRead = sscanf(line, "%lf %lf %lf %lf %lf %lf  %hhu %hhu %hhu %hhu",
+                                    &x, &y, &radius, &Xspeed, &Yspeed, &mass, &r, &g, &b, &a);
+        if(itemsRead != 10) {
+            printf("Error parsing line: %s\n", line);
+            continue; // skip to the next line
+        }
+
+        // Create a new body
+        body newBody;
+        newBody.isAlive = true;
+        newBody.radius = radius;
+        newBody.Xspeed = Xspeed;
+        newBody.Yspeed = Yspeed;
+        newBody.x = x;
+        newBody.y = y;
+        newBody.mass = mass;
+        newBody.color.r = r;
+        newBody.color.g = g;
+        newBody.color.b = b;
+        newBody.color.a = a;
+
+        if (body_store_push(store, &newBody) == -1) { // add the newly created body to the store
+            fclose(file);
+            return -1;
+        }
+    }
+
+    fclose(file); // close the file after it is done being read
+    return 0;
+}
+
+int saveBodiesToFile(const char *filename, const body_store *store) {
+    FILE *file = fopen(filename, "w");
+    if (!file) {
+        perror("Error opening file");
+        return -1;
+    }
+
+    for (int i = 0; i < store->count; i++) {
+        if (!store->isAlive[i]) {
+            continue;
+        }
+        // %.17g keeps every double exact across a save/load round trip
+        fprintf(file, "%.17g %.17g %.17g %.17g %.17g %.17g %hhu %hhu %hhu %hhu\n",
+                store->x[i], store->y[i], store->radius[i], store->vx[i], store->vy[i], store->mass[i],
+                store->color[i].r, store->color[i].g, store->color[i].b, store->color[i].a);
+    }
+
+    if (fclose(file) != 0) {
+        perror("Error writing file");
+        return -1;
+    }
+    return 0;
+}
+
+int create_body(body_store *store, double x, double y, double radius, double Xspeed, double Yspeed, double mass, SDL_Color color) {
+    // Create a new body
+    body newBody;
+    newBody.isAlive = true;
+    newBody.x = x;
+    newBody.y = y;
+    newBody.radius = radius;
+    newBody.Xspeed = Xspeed;
+    newBody.Yspeed = Yspeed;
+    newBody.mass = mass;
+    newBody.color = color;
+
+    return body_store_push(store, &newBody); // Add the newly created body to the store
+}
+
+int absorb_body(body_store *store, int index1, int index2) {
+    double m1 = store->mass[index1];
+    double m2 = store->mass[index2];
+
+    double new_mass = m1 + m2;
+    SDL_Color new_color;
+    new_color.r = (store->color[index1].r + store->color[index2].r) / 2;
+    new_color.g = (store->color[index1].g + store->color[index2].g) / 2;
+    new_color.b = (store->color[index1].b + store->color[index2].b) / 2;
+    new_color.a = (store->color[index1].a + store->color[index2].a) / 2;
+    double new_radius = sqrt(pow(store->radius[index1], 2) + pow(store->radius[index2], 2));
+    double new_x = (store->x[index1] * m1 + store->x[index2] * m2) / new_mass;
+    double new_y = (store->y[index1] * m1 + store->y[index2] * m2) / new_mass;
+    double new_Xspeed = (store->vx[index1] * m1 + store->vx[index2] * m2) / new_mass;
+    double new_Yspeed = (store->vy[index1] * m1 + store->vy[index2] * m2) / new_mass;
+    // With straight drifts the centre of mass moves in a straight line, so
+    // merging at the end of the step lands where merging on contact would
+    double new_prevX = (store->prevX[index1] * m1 + store->prevX[index2] * m2) / new_mass;
+    double new_prevY = (store->prevY[index1] * m1 + store->prevY[index2] * m2) / new_mass;
+
+    // The heavier body survives, the other one is left as a tombstone
+    int survivor = (m1 > m2) ? index1 : index2;
+    int absorbedIndex = (m1 > m2) ? index2 : index1;
+    store->mass[survivor] = new_mass;
+    store->radius[survivor] = new_radius;
+    store->color[survivor] = new_color;
+    store->x[survivor] = new_x;
+    store->y[survivor] = new_y;
+    store->vx[survivor] = new_Xspeed;
+    store->vy[survivor] = new_Yspeed;
+    store->prevX[survivor] = new_prevX;
+    store->prevY[survivor] = new_prevY;
+    body_store_kill(store, absorbedIndex);
+
+    return survivor;
+}
+
+// Function to calculate collision and return overlap
+int body_collision(const body_store *store, int index1, int index2) {
+    double dx = store->x[index1] - store->x[index2];
+    double dy = store->y[index1] - store->y[index2];
+    double reach = store->radius[index1] + store->radius[index2];
+    return dx * dx + dy * dy < reach * reach;
+}
+
+double body_time_of_impact(const body_store *store, int index1, int index2) {
+    // Separation d(t) = d0 + t e, touching where |d(t)| = reach
+    double d0x = store->prevX[index1] - store->prevX[index2];
+    double d0y = store->prevY[index1] - store->prevY[index2];
+    double ex = (store->x[index1] - store->prevX[index1]) - (store->x[index2] - store->prevX[index2]);
+    double ey = (store->y[index1] - store->prevY[index1]) - (store->y[index2] - store->prevY[index2]);
+    double reach = store->radius[index1] + store->radius[index2];
+    double c = d0x * d0x + d0y * d0y - reach * reach;
+    if (c < 0) {
+        return 0; //already overlapping when the drift started
+    }
+    double a = ex * ex + ey * ey;
+    double b = d0x * ex + d0y * ey; //half the linear coefficient
+    if (a == 0 || b >= 0) {
+        return -1; //not closing in
+    }
+    double discriminant = b * b - a * c;
+    if (discriminant < 0) {
+        return -1; //closest approach stays outside reach
+    }
+    // Stable form of the smaller root (-b - sqrt(disc)) / a
+    double t = c / (-b + sqrt(discriminant));
+    return (t <= 1) ? t : -1;
+}
+
+// Exchange the components of (u1, u2) along the unit normal (nx, ny) as a
+// perfectly elastic collision of masses m1 and m2 would, the same formula
+// calculate_vector_collision applies, leaving the tangential parts alone
+static void elastic_exchange(double *u1x, double *u1y, double *u2x, double *u2y,
+                             double m1, double m2, double nx, double ny) {
+    double u1n = *u1x * nx + *u1y * ny;
+    double u2n = *u2x * nx + *u2y * ny;
+    double v1n = ((m1 - m2) * u1n + 2 * m2 * u2n) / (m1 + m2);
+    double v2n = (2 * m1 * u1n + (m2 - m1) * u2n) / (m1 + m2);
+    *u1x += (v1n - u1n) * nx;
+    *u1y += (v1n - u1n) * ny;
+    *u2x += (v2n - u2n) * nx;
+    *u2y += (v2n - u2n) * ny;
+}
+
+int bounce_bodies(body_store *store, int index1, int index2, double t) {
+    double m1 = store->mass[index1];
+    double m2 = store->mass[index2];
+    if (m1 <= 0 || m2 <= 0) {
+        return 0;
+    }
+    // Drift of each body over the step and where they touch
+    double d1x = store->x[index1] - store->prevX[index1];
+    double d1y = store->y[index1] - store->prevY[index1];
+    double d2x = store->x[index2] - store->prevX[index2];
+    double d2y = store->y[index2] - store->prevY[index2];
+    double p1x = store->prevX[index1] + t * d1x;
+    double p1y = store->prevY[index1] + t * d1y;
+    double p2x = store->prevX[index2] + t * d2x;
+    double p2y = store->prevY[index2] + t * d2y;
+
+    // Line of centres at contact
+    double nx = p1x - p2x;
+    double ny = p1y - p2y;
+    double length = sqrt(nx * nx + ny * ny);
+    if (length == 0) {
+        return 0;
+    }
+    nx /= length;
+    ny /= length;
+    if ((d1x - d2x) * nx + (d1y - d2y) * ny >= 0) {
+        return 0; //already separating, e.g. overlapping bodies moving apart
+    }
+
+    // The drift is velocity times time, so it bounces like one
+    elastic_exchange(&d1x, &d1y, &d2x, &d2y, m1, m2, nx, ny);
+    double v1x = store->vx[index1], v1y = store->vy[index1];
+    double v2x = store->vx[index2], v2y = store->vy[index2];
+    elastic_exchange(&v1x, &v1y, &v2x, &v2y, m1, m2, nx, ny);
+    store->vx[index1] = v1x;
+    store->vy[index1] = v1y;
+    store->vx[index2] = v2x;
+    store->vy[index2] = v2y;
+    // Rest of the step on the new course
+    store->x[index1] = p1x + (1 - t) * d1x;
+    store->y[index1] = p1y + (1 - t) * d1y;
+    store->x[index2] = p2x + (1 - t) * d2x;
+    store->y[index2] = p2y + (1 - t) * d2y;
+    store->changes++; //positions moved, cached forces are stale
+    return 1;
+}
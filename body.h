@@ -0,0 +1,137 @@
+#ifndef BODY_H
+#define BODY_H
+
+#include <SDL2/SDL.h>
+#include <stdbool.h>
+
+#define GRAVITATIONAL_CONSTANT 6.674e-11
+#define GRAVITY_TIMESTEP 0.01666667 //seconds of simulated time applied per frame
+
+// Structure to represent a 2D vector
+typedef struct  {
+    double x;
+    double y;
+} vector;
+
+
+//int *numbodies_ptr, double x, double y, int radius, double Xspeed, double Yspeed,double mass, SDL_Color color
+typedef struct { //body structure
+    bool isAlive;
+    double x,y; //position of the body
+    double radius; //radius of the body
+    double Xspeed, Yspeed; //speed of the body
+    double mass;   //mass of the body
+
+    SDL_Color color;
+
+}body;
+
+// Scalar type of the body store, picked at build time by GRAVITY_PRECISION
+// in CMakeLists.txt:
+//   double  everything in double (the default)
+//   float   the store and the direct-sum pair math in float, half the memory
+//           traffic and twice the SIMD lanes
+//   mixed   the store stays double, the direct sum runs in float on positions
+//           taken relative to the centre of each tile and adds the tiles up
+//           in double
+// Only the store changes type; body, vector and every intermediate result
+// stay double.
+#if defined(GRAVITY_PRECISION_FLOAT)
+typedef float real;
+#define GRAVITY_PRECISION_NAME "float"
+#elif defined(GRAVITY_PRECISION_MIXED)
+typedef double real;
+#define GRAVITY_PRECISION_NAME "mixed"
+#else
+typedef double real;
+#define GRAVITY_PRECISION_NAME "double"
+#endif
+
+#define BODY_STORE_ALIGNMENT 64 //one cache line, also enough for AVX-512 loads
+
+// Structure-of-arrays body storage. The force kernels only stream x, y and
+// mass, so each field gets its own cache-line aligned array.
+//
+// Slots [0, count) are packed except for bodies that died since the last
+// body_store_compact. Every body also has a stable id that survives
+// compaction; ids of dead bodies are recycled once their slot is compacted.
+// A body can also move to another store under the same id (detach, then
+// attach there); its id stays reserved in the store it left.
+typedef struct {
+    real *x, *y;        //positions
+    real *vx, *vy;      //velocities (body.Xspeed, body.Yspeed)
+    real *ax, *ay;      //accelerations written by the gravity engines
+    real *prevX, *prevY; //positions before the last drift, for interpolated drawing
+    real *mass;
+    real *radius;
+    SDL_Color *color;
+    bool *isAlive;
+    int *id;            //stable id of the body in each slot
+    int *slotOf;        //slot holding each id, -1 for ids not in use; idCapacity entries
+    int *freeIds;       //ids ready for reuse
+    int *freeSlots;     //slots tombstoned since the last compaction
+    int *retiredIds;    //ids of tombstones whose slot a push took over, freed by the next compaction
+    int numFreeIds;
+    int numFreeSlots;
+    int numRetiredIds;
+    int nextId;         //ids below this have been handed out at least once
+    unsigned changes;   //bumped by every push and kill, tells cached forces they are stale
+    int count;          //number of slots in use, dead or alive
+    int capacity;       //number of bodies the arrays can hold
+    int idCapacity;     //ids slotOf can hold, at least capacity
+} body_store;
+
+void body_store_init(body_store *store);
+void body_store_free(body_store *store);
+// Grow every array to hold `capacity` bodies. Only this allocates, so
+// reserving up front keeps spawns and merges free of reallocation.
+int body_store_reserve(body_store *store, int capacity);
+
+// Add a body, reusing a tombstoned slot when there is one and appending
+// (doubling the capacity if full) otherwise. Returns its slot or -1. The new
+// body always gets an id no body has had since the last compaction; a reused
+// tombstone's id stops resolving and is only recycled by that compaction.
+int body_store_push(body_store *store, const body *b);
+// Append n living bodies with fresh ids and nothing else set, for
+// generators that fill in every other array themselves (from any number of
+// threads, which also spreads the first touch of the memory). Returns the
+// first new slot or -1.
+int body_store_append(body_store *store, int n);
+body body_store_get(const body_store *store, int index);
+void body_store_set(body_store *store, int index, const body *b);
+// Tombstone the body in `index`, O(1). Its slot and id stay reserved until
+// the next compaction so indices do not move under a running loop.
+void body_store_kill(body_store *store, int index);
+// Tombstone the body in `index` for a move to another store and return its
+// id. The id stops resolving here but is never recycled, so the body can
+// come back under it with body_store_attach.
+int body_store_detach(body_store *store, int index);
+// body_store_push under a given id, one this store does not use: an id
+// detached from here earlier, or any id when this store never hands out
+// its own. Returns the slot or -1.
+int body_store_attach(body_store *store, const body *b, int id);
+// Fill every tombstoned slot with a body moved from the tail, O(dead bodies).
+// Returns how many were removed. Moved bodies keep their ids.
+int body_store_compact(body_store *store);
+// Slot of a stable id, -1 if that body is gone
+int body_store_find(const body_store *store, int id);
+
+int loadBodiesFromFile(const char *filename, body_store *store);
+// Write the living bodies in the format loadBodiesFromFile reads
+int saveBodiesToFile(const char *filename, const body_store *store);
+int create_body(body_store *store, double x, double y, double radius, double Xspeed, double Yspeed, double mass, SDL_Color color);
+// Fold the lighter body into the heavier one and mark the lighter one dead.
+// Returns the survivor's index; the store is not compacted.
+int absorb_body(body_store *store, int index1, int index2);
+int body_collision(const body_store *store, int index1, int index2);
+// Earliest fraction of the last drift (prevX/prevY to x/y, a straight line
+// for each body) at which two bodies touch: 0 if they already overlapped at
+// its start, -1 if they never touch during it
+double body_time_of_impact(const body_store *store, int index1, int index2);
+// Perfectly elastic bounce of two bodies that touch at fraction t of their
+// last drift: both the velocities and the drifts are reflected along the
+// line of centres at contact, and the bodies finish the drift from the
+// contact point on their new course. Returns 0 if they were not approaching.
+int bounce_bodies(body_store *store, int index1, int index2, double t);
+
+#endif
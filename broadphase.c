@@ -0,0 +1,298 @@
+#include "broadphase.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define BROADPHASE_CELL_LIMIT 1e15 //cell coordinates are clamped here so far-away bodies stay representable
+
+void broadphase_init(broadphase *bp) {
+    memset(bp, 0, sizeof(*bp));
+}
+
+void broadphase_free(broadphase *bp) {
+    free(bp->reach);
+    free(bp->large);
+    free(bp->times);
+    free(bp->cellX);
+    free(bp->cellY);
+    free(bp->bucket);
+    free(bp->order);
+    free(bp->bucketStart);
+    free(bp->parent);
+    free(bp->pairs);
+    broadphase_init(bp);
+}
+
+static int broadphase_reserve(broadphase *bp, int numBodies) {
+    if (numBodies <= bp->capacity) {
+        return 0;
+    }
+    int capacity = (bp->capacity == 0) ? 64 : bp->capacity;
+    while (capacity < numBodies) {
+        capacity *= 2;
+    }
+    // At least two buckets per body keeps the chains short
+    int numBuckets = 1;
+    while (numBuckets < 2 * capacity) {
+        numBuckets *= 2;
+    }
+
+    double *reach = realloc(bp->reach, capacity * sizeof(double));
+    if (reach) bp->reach = reach;
+    int *large = realloc(bp->large, capacity * sizeof(int));
+    if (large) bp->large = large;
+    int64_t *cellX = realloc(bp->cellX, capacity * sizeof(int64_t));
+    if (cellX) bp->cellX = cellX;
+    int64_t *cellY = realloc(bp->cellY, capacity * sizeof(int64_t));
+    if (cellY) bp->cellY = cellY;
+    int *bucket = realloc(bp->bucket, capacity * sizeof(int));
+    if (bucket) bp->bucket = bucket;
+    int *order = realloc(bp->order, capacity * sizeof(int));
+    if (order) bp->order = order;
+    int *parent = realloc(bp->parent, capacity * sizeof(int));
+    if (parent) bp->parent = parent;
+    int *bucketStart = realloc(bp->bucketStart, (numBuckets + 1) * sizeof(int));
+    if (bucketStart) bp->bucketStart = bucketStart;
+    if (!reach || !large || !cellX || !cellY || !bucket || !order || !parent || !bucketStart) {
+        perror("Error reallocating memory");
+        return -1;
+    }
+
+    bp->capacity = capacity;
+    bp->numBuckets = numBuckets;
+    return 0;
+}
+
+// Record (i, j) if their sweeps touch
+static int broadphase_test_pair(broadphase *bp, const body_store *store, int i, int j) {
+    double t = body_time_of_impact(store, i, j);
+    if (t < 0) {
+        return 0;
+    }
+    if (bp->numPairs == bp->pairCapacity) {
+        int capacity = (bp->pairCapacity == 0) ? 64 : bp->pairCapacity * 2;
+        int *pairs = realloc(bp->pairs, 2 * capacity * sizeof(int));
+        if (pairs) bp->pairs = pairs;
+        double *times = realloc(bp->times, capacity * sizeof(double));
+        if (times) bp->times = times;
+        if (!pairs || !times) {
+            perror("Error reallocating memory");
+            return -1;
+        }
+        bp->pairCapacity = capacity;
+    }
+    bp->pairs[2 * bp->numPairs] = (i < j) ? i : j;
+    bp->pairs[2 * bp->numPairs + 1] = (i < j) ? j : i;
+    bp->times[bp->numPairs] = t;
+    bp->numPairs++;
+    return 0;
+}
+
+static int64_t cell_of(double position, double cellSize) {
+    double cell = floor(position / cellSize);
+    if (cell > BROADPHASE_CELL_LIMIT) cell = BROADPHASE_CELL_LIMIT;
+    if (cell < -BROADPHASE_CELL_LIMIT) cell = -BROADPHASE_CELL_LIMIT;
+    return (int64_t)cell;
+}
+
+static int hash_cell(const broadphase *bp, int64_t cx, int64_t cy) {
+    uint64_t h = (uint64_t)cx * 0x9E3779B97F4A7C15ull ^ (uint64_t)cy * 0xC2B2AE3D27D4EB4Full;
+    h ^= h >> 29;
+    return (int)(h & (uint64_t)(bp->numBuckets - 1));
+}
+
+int broadphase_find_pairs(broadphase *bp, const body_store *store) {
+    int n = store->count;
+    bp->numPairs = 0;
+    if (broadphase_reserve(bp, n) != 0) {
+        return -1;
+    }
+
+    double maxReach = 0;
+    double sumReach = 0;
+    int alive = 0;
+    for (int i = 0; i < n; i++) {
+        if (!store->isAlive[i]) {
+            continue;
+        }
+        double dx = store->x[i] - store->prevX[i];
+        double dy = store->y[i] - store->prevY[i];
+        bp->reach[i] = store->radius[i] + 0.5 * sqrt(dx * dx + dy * dy);
+        maxReach = (bp->reach[i] > maxReach) ? bp->reach[i] : maxReach;
+        sumReach += bp->reach[i];
+        alive++;
+    }
+    // Contact needs the midpoints within reach1 + reach2 <= 2 * maxReach, one cell either way
+    double cellReach = (alive > 0) ? fmin(maxReach, BROADPHASE_LARGE_FACTOR * sumReach / alive) : 0;
+    bp->cellSize = (cellReach > 0) ? 2 * cellReach : 1;
+
+    // Counting sort of the bodies by bucket
+    memset(bp->bucketStart, 0, (bp->numBuckets + 1) * sizeof(int));
+    bp->numLarge = 0;
+    for (int i = 0; i < n; i++) {
+        if (!store->isAlive[i] || bp->reach[i] > cellReach) {
+            if (store->isAlive[i]) {
+                bp->large[bp->numLarge++] = i;
+            }
+            bp->bucket[i] = -1;
+            continue;
+        }
+        bp->cellX[i] = cell_of(0.5 * (store->x[i] + store->prevX[i]), bp->cellSize);
+        bp->cellY[i] = cell_of(0.5 * (store->y[i] + store->prevY[i]), bp->cellSize);
+        bp->bucket[i] = hash_cell(bp, bp->cellX[i], bp->cellY[i]);
+        bp->bucketStart[bp->bucket[i] + 1]++;
+    }
+    for (int b = 0; b < bp->numBuckets; b++) {
+        bp->bucketStart[b + 1] += bp->bucketStart[b];
+    }
+    for (int i = 0; i < n; i++) {
+        if (bp->bucket[i] != -1) {
+            bp->order[bp->bucketStart[bp->bucket[i]]++] = i;
+        }
+    }
+    // The fill loop advanced every start to the next bucket's, shift them back
+    for (int b = bp->numBuckets; b > 0; b--) {
+        bp->bucketStart[b] = bp->bucketStart[b - 1];
+    }
+    bp->bucketStart[0] = 0;
+
+    for (int i = 0; i < n; i++) {
+        if (bp->bucket[i] == -1) {
+            continue;
+        }
+        for (int64_t cy = bp->cellY[i] - 1; cy <= bp->cellY[i] + 1; cy++) {
+            for (int64_t cx = bp->cellX[i] - 1; cx <= bp->cellX[i] + 1; cx++) {
+                int b = hash_cell(bp, cx, cy);
+                for (int k = bp->bucketStart[b]; k < bp->bucketStart[b + 1]; k++) {
+                    int j = bp->order[k];
+                    // Each pair once, and skip other cells that hash to this bucket
+                    if (j <= i || bp->cellX[j] != cx || bp->cellY[j] != cy) {
+                        continue;
+                    }
+                    if (broadphase_test_pair(bp, store, i, j) != 0) {
+                        return -1;
+                    }
+                }
+            }
+        }
+    }
+
+    // Bodies outside the grid against every body, each pair once
+    for (int k = 0; k < bp->numLarge; k++) {
+        int i = bp->large[k];
+        for (int j = 0; j < n; j++) {
+            if (j == i || !store->isAlive[j] || (bp->bucket[j] == -1 && j < i)) {
+                continue;
+            }
+            if (broadphase_test_pair(bp, store, i, j) != 0) {
+                return -1;
+            }
+        }
+    }
+
+    return bp->numPairs;
+}
+
+static int find_root(int *parent, int i) {
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]]; //path halving
+        i = parent[i];
+    }
+    return i;
+}
+
+int broadphase_merge(broadphase *bp, body_store *store) {
+    if (broadphase_find_pairs(bp, store) < 0) {
+        return -1;
+    }
+    if (bp->numPairs == 0) {
+        return 0;
+    }
+
+    int n = store->count;
+    for (int i = 0; i < n; i++) {
+        bp->parent[i] = i;
+    }
+    for (int p = 0; p < bp->numPairs; p++) {
+        int a = find_root(bp->parent, bp->pairs[2 * p]);
+        int b = find_root(bp->parent, bp->pairs[2 * p + 1]);
+        if (a != b) {
+            // Lower index as root keeps the result independent of pair order
+            if (a < b) bp->parent[b] = a; else bp->parent[a] = b;
+        }
+    }
+
+    // Every root is its group's lowest index, so walking upwards meets the
+    // root before any other member. order[] is reused to hold each group's
+    // current survivor.
+    int absorbed = 0;
+    for (int i = 0; i < n; i++) {
+        if (!store->isAlive[i]) {
+            continue; //dead before the merge, nothing here dies before the loop reaches it
+        }
+        int root = find_root(bp->parent, i);
+        if (root == i) {
+            bp->order[i] = i;
+            continue;
+        }
+        bp->order[root] = absorb_body(store, bp->order[root], i);
+        absorbed++;
+    }
+    return absorbed;
+}
+
+// A pair with its time of impact, so sorting needs nothing but the records
+typedef struct {
+    double time;
+    int pair;
+} broadphase_contact;
+
+// Earliest first, ties by pair index so the order does not depend on qsort
+static int compare_contact(const void *a, const void *b) {
+    const broadphase_contact *ca = a;
+    const broadphase_contact *cb = b;
+    if (ca->time != cb->time) {
+        return (ca->time > cb->time) - (ca->time < cb->time);
+    }
+    return (ca->pair > cb->pair) - (ca->pair < cb->pair);
+}
+
+int broadphase_bounce(broadphase *bp, body_store *store) {
+    if (broadphase_find_pairs(bp, store) < 0) {
+        return -1;
+    }
+    if (bp->numPairs == 0) {
+        return 0;
+    }
+    broadphase_contact *byTime = malloc(bp->numPairs * sizeof(broadphase_contact));
+    if (!byTime) {
+        perror("Error allocating memory");
+        return -1;
+    }
+    for (int p = 0; p < bp->numPairs; p++) {
+        byTime[p].time = bp->times[p];
+        byTime[p].pair = p;
+    }
+    qsort(byTime, bp->numPairs, sizeof(broadphase_contact), compare_contact);
+
+    // parent[] marks the bodies that already bounced this step
+    for (int i = 0; i < store->count; i++) {
+        bp->parent[i] = 0;
+    }
+    int bounces = 0;
+    for (int k = 0; k < bp->numPairs; k++) {
+        int p = byTime[k].pair;
+        int i = bp->pairs[2 * p];
+        int j = bp->pairs[2 * p + 1];
+        if (bp->parent[i] || bp->parent[j]) {
+            continue;
+        }
+        if (bounce_bodies(store, i, j, bp->times[p])) {
+            bp->parent[i] = bp->parent[j] = 1;
+            bounces++;
+        }
+    }
+    free(byTime);
+    return bounces;
+}
@@ -0,0 +1,60 @@
+#ifndef BROADPHASE_H
+#define BROADPHASE_H
+
+#include "body.h"
+#include <stdint.h>
+
+#define BROADPHASE_LARGE_FACTOR 8 //cells are at most this many times the mean sweep wide
+
+typedef enum {
+    COLLISION_MERGE,   //touching bodies become one through absorb_body
+    COLLISION_BOUNCE,  //touching bodies bounce off each other elastically
+} collision_mode;
+
+// Swept collision search. Each body sweeps a capsule over its last drift,
+// from prevX/prevY to x/y, which fits in a circle around the midpoint with
+// the body's radius plus half the drift (its reach). The midpoints go into
+// a uniform grid hashed into buckets, with cells as wide as the largest
+// reach, so two capsules can only meet if their midpoints sit in the same
+// or neighbouring cells. A few fast or huge bodies must not blow the cells
+// up for everyone, so cells are capped at BROADPHASE_LARGE_FACTOR times the
+// mean reach and bodies that reach further are checked against every body
+// instead. Candidates are then tested with body_time_of_impact, so fast
+// bodies no longer pass through each other between steps.
+typedef struct {
+    double cellSize;
+    double *reach;           //radius of the circle around each body's sweep
+    int *large;              //bodies too large for the grid, checked against all
+    int numLarge;
+    double *times;           //time of impact of each pair, as a fraction of the drift
+    int64_t *cellX, *cellY;  //grid cell of each body
+    int *bucket;             //hash bucket of each body
+    int *order;              //body indices sorted by bucket
+    int *bucketStart;        //first slot of each bucket in order, numBuckets + 1 entries
+    int *parent;             //union-find over bodies, links overlapping ones into groups
+    int *pairs;              //touching pairs found by the last search, (i, j) with i < j
+    int numPairs;
+    int pairCapacity;
+    int numBuckets;
+    int capacity;            //bodies the per-body arrays can hold
+} broadphase;
+
+void broadphase_init(broadphase *bp);
+void broadphase_free(broadphase *bp);
+
+// Find every pair of living bodies that touch at some point of their last
+// drift. Returns the number of pairs (stored in bp->pairs, with their times
+// in bp->times) or -1 if memory runs out.
+int broadphase_find_pairs(broadphase *bp, const body_store *store);
+
+// Merge every group of bodies connected by contacts into one, folding them
+// together with absorb_body in index order so a chain A-B-C ends up as a
+// single body. Absorbed bodies are tombstoned, not removed.
+// Returns the number of bodies absorbed or -1 on failure.
+int broadphase_merge(broadphase *bp, body_store *store);
+// Bounce every touching pair with bounce_bodies in order of contact. A body
+// bounces at most once per step, later contacts of its old course are
+// void. Returns the number of bounces or -1 on failure.
+int broadphase_bounce(broadphase *bp, body_store *store);
+
+#endif
@@ -0,0 +1,931 @@
+#define _GNU_SOURCE //MSG_NOSIGNAL
+#include "cluster.h"
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+enum {
+    CLUSTER_SCATTER,  //coordinator -> worker: a new domain, `count` bodies follow
+    CLUSTER_STEP,     //coordinator -> worker: take one step of dt
+    CLUSTER_BOX,      //worker -> coordinator: bounding box before a force pass
+    CLUSTER_BOXES,    //coordinator -> worker: every worker's box follows
+    CLUSTER_DONE,     //worker -> coordinator: step finished
+    CLUSTER_GATHER,   //coordinator -> worker: send the bodies back
+    CLUSTER_BODIES,   //worker -> coordinator: `count` bodies follow
+    CLUSTER_QUIT
+};
+
+// Every control message has the same fixed layout, unused fields are zero
+typedef struct {
+    int32_t type;
+    int32_t count;
+    int32_t flag;      //SCATTER, BOXES: forces are stale; BOX: forces are stale here
+    int32_t collisions; //STEP: collision_mode
+    double dt;
+    double theta;
+    double box[4];     //min x, min y, max x, max y of the worker's bodies
+    double busy;       //DONE: seconds spent computing rather than waiting
+    double exported;   //DONE: point masses sent to other workers
+} cluster_message;
+
+// A body moving between the coordinator and a worker. Both sides run the
+// same binary on the same machine, so it travels as raw bytes.
+typedef struct {
+    double x, y, vx, vy, ax, ay, prevX, prevY, mass, radius;
+    int32_t id;        //stable id in the coordinator's store
+    SDL_Color color;
+} cluster_body;
+
+// A body or a whole quadtree cell as seen from another domain
+typedef struct {
+    double x, y, mass;
+} cluster_point;
+
+struct cluster {
+    int numWorkers;
+    int rebalanceEvery;
+    pid_t *pids;
+    int *fds;                //coordinator end of each worker's socket
+    bool distributed;        //an epoch is running, the workers hold the bodies
+    bool gathered;           //at least one epoch ended, so ax/ay came from the workers
+    unsigned changesAtGather; //bodies.changes after the last gather, anything since makes forces stale
+    int epochSteps;
+    long scatteredAt;        //sim->steps when the running epoch handed the bodies out
+    int *sentIds;            //ids handed out this epoch
+    int numSent;
+    int *partOf;             //domain of each slot, from the bisection
+    int *items;              //slots being bisected
+    struct { double key; int slot; } *keys;
+    double *slotWeight;
+    int slotCapacity;
+    double *weight;          //cost of each id last epoch, 0 when unknown
+    int weightCapacity;
+    cluster_body *buffer;
+    int bufferCapacity;
+    double (*boxes)[4];
+    int *count;              //bodies each worker holds
+    double *epochBusy;       //seconds each worker computed this epoch
+    double *busyTotal;
+    double exportedTotal;
+    long steps;
+    int epochs;
+};
+
+struct cluster_worker {
+    int rank;
+    int numWorkers;
+    int coordinator;         //socket to the coordinator
+    int *peers;              //socket to every other worker, -1 for itself
+    double (*boxes)[4];
+    bool stale;              //the last scatter said the forces are stale
+    bool anyStale;           //some worker's forces are stale, from the last box exchange
+    bool failed;
+    int *globalOf;           //coordinator id of each local id
+    int globalCapacity;
+    cluster_point *exports;
+    int exportCapacity;
+    cluster_point *imports;
+    int numImports;
+    int importCapacity;
+    quadtree localTree;      //local bodies only, what the exports are cut from
+    body_store work;         //local bodies then imports, only x, y, mass and isAlive are filled
+    cluster_body *buffer;
+    int bufferCapacity;
+    double waited;           //seconds blocked on other processes this step
+    double exported;
+};
+
+static int cluster_send(int fd, const void *data, size_t size) {
+    const char *p = data;
+    while (size > 0) {
+        ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        size -= n;
+    }
+    return 0;
+}
+
+static int cluster_recv(int fd, void *data, size_t size) {
+    char *p = data;
+    while (size > 0) {
+        ssize_t n = recv(fd, p, size, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1; //error or the other process is gone
+        }
+        p += n;
+        size -= n;
+    }
+    return 0;
+}
+
+static int grow(void **array, int *capacity, int needed, size_t size) {
+    if (needed <= *capacity) {
+        return 0;
+    }
+    int newCapacity = (*capacity == 0) ? 64 : *capacity;
+    while (newCapacity < needed) {
+        newCapacity *= 2;
+    }
+    void *grown = realloc(*array, (size_t)newCapacity * size);
+    if (!grown) {
+        perror("Error reallocating memory");
+        return -1;
+    }
+    *array = grown;
+    *capacity = newCapacity;
+    return 0;
+}
+
+// Partner of `rank` in a round of the circle method (the pairing
+// gravity_direct_parallel uses for tiles), numWorkers or more for a bye
+static int cluster_partner(int rank, int numWorkers, int round) {
+    int ring = numWorkers + (numWorkers & 1) - 1;
+    if (rank == ring) {
+        return round;
+    }
+    if (rank == round) {
+        return ring;
+    }
+    return (2 * round - rank + 2 * ring) % ring;
+}
+
+static void cluster_bounds(const body_store *store, double box[4]) {
+    box[0] = box[1] = INFINITY;
+    box[2] = box[3] = -INFINITY;
+    for (int i = 0; i < store->count; i++) {
+        if (store->isAlive[i]) {
+            box[0] = fmin(box[0], store->x[i]);
+            box[1] = fmin(box[1], store->y[i]);
+            box[2] = fmax(box[2], store->x[i]);
+            box[3] = fmax(box[3], store->y[i]);
+        }
+    }
+}
+
+// ---- worker side ----
+
+// Send the bounding box and get everyone's back
+static int cluster_worker_boxes(cluster_worker *w, const body_store *store, bool stale) {
+    cluster_message m;
+    memset(&m, 0, sizeof(m));
+    m.type = CLUSTER_BOX;
+    m.flag = stale;
+    cluster_bounds(store, m.box);
+    if (cluster_send(w->coordinator, &m, sizeof(m)) != 0) {
+        return -1;
+    }
+    double start = simulation_clock();
+    if (cluster_recv(w->coordinator, &m, sizeof(m)) != 0 || m.type != CLUSTER_BOXES ||
+        cluster_recv(w->coordinator, w->boxes, w->numWorkers * sizeof(w->boxes[0])) != 0) {
+        return -1;
+    }
+    w->waited += simulation_clock() - start;
+    w->anyStale = m.flag;
+    return 0;
+}
+
+// Cells of the local tree that every point of `box` would accept whole,
+// plus the single bodies of the cells it would have to open
+static int cluster_worker_export(cluster_worker *w, const double box[4], double theta) {
+    const quadtree *tree = &w->localTree;
+    int count = 0;
+    if (tree->numNodes == 0 || box[0] > box[2]) {
+        return 0; //nothing here, or nobody there
+    }
+    int stack[4 * (QUADTREE_MAX_DEPTH + 2)];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        const quadtree_node *n = &tree->nodes[stack[--top]];
+        if (n->mass == 0) {
+            continue;
+        }
+        // Nearest point of the box, the same opening rule as quadtree_acceleration
+        double dx = fmax(fmax(box[0] - n->com_x, n->com_x - box[2]), 0);
+        double dy = fmax(fmax(box[1] - n->com_y, n->com_y - box[3]), 0);
+        double open = 2 * n->half_size / theta + n->com_offset;
+        bool isLeaf = n->children[0] == -1 && n->children[1] == -1 &&
+                      n->children[2] == -1 && n->children[3] == -1;
+        if (isLeaf || open * open < dx * dx + dy * dy) {
+            if (grow((void **)&w->exports, &w->exportCapacity, count + 1, sizeof(cluster_point)) != 0) {
+                return -1;
+            }
+            w->exports[count].x = n->com_x;
+            w->exports[count].y = n->com_y;
+            w->exports[count].mass = n->mass;
+            count++;
+            continue;
+        }
+        for (int q = 0; q < 4; q++) {
+            if (n->children[q] != -1) {
+                stack[top++] = n->children[q];
+            }
+        }
+    }
+    return count;
+}
+
+static int cluster_worker_send_points(cluster_worker *w, int fd, int count) {
+    int32_t n = count;
+    w->exported += count;
+    return (cluster_send(fd, &n, sizeof(n)) != 0 ||
+            cluster_send(fd, w->exports, count * sizeof(cluster_point)) != 0) ? -1 : 0;
+}
+
+static int cluster_worker_recv_points(cluster_worker *w, int fd) {
+    double start = simulation_clock();
+    int32_t n;
+    if (cluster_recv(fd, &n, sizeof(n)) != 0 || n < 0 ||
+        grow((void **)&w->imports, &w->importCapacity, w->numImports + n, sizeof(cluster_point)) != 0 ||
+        cluster_recv(fd, w->imports + w->numImports, n * sizeof(cluster_point)) != 0) {
+        return -1;
+    }
+    w->numImports += n;
+    w->waited += simulation_clock() - start;
+    return 0;
+}
+
+// Trade point masses with every other worker, then run Barnes-Hut for the
+// local bodies over a tree of the local bodies and everything imported
+static int cluster_worker_forces(cluster_worker *w, simulation *sim) {
+    body_store *store = &sim->bodies;
+    if (quadtree_build(&w->localTree, store) != 0) {
+        return -1;
+    }
+    w->numImports = 0;
+    int rounds = w->numWorkers + (w->numWorkers & 1) - 1;
+    for (int round = 0; round < rounds; round++) {
+        int partner = cluster_partner(w->rank, w->numWorkers, round);
+        if (partner >= w->numWorkers) {
+            continue;
+        }
+        int count = cluster_worker_export(w, w->boxes[partner], sim->theta);
+        if (count < 0) {
+            return -1;
+        }
+        // The lower rank talks first, so the two never both block on a send
+        int fd = w->peers[partner];
+        if (w->rank < partner) {
+            if (cluster_worker_send_points(w, fd, count) != 0 || cluster_worker_recv_points(w, fd) != 0) {
+                return -1;
+            }
+        } else if (cluster_worker_recv_points(w, fd) != 0 || cluster_worker_send_points(w, fd, count) != 0) {
+            return -1;
+        }
+    }
+
+    // Local slots keep their index in the work store, so `self` still matches
+    int total = store->count + w->numImports;
+    w->work.count = 0; //nothing worth copying when it grows
+    if (body_store_reserve(&w->work, total) != 0) {
+        return -1;
+    }
+    for (int i = 0; i < store->count; i++) {
+        w->work.x[i] = store->x[i];
+        w->work.y[i] = store->y[i];
+        w->work.mass[i] = store->mass[i];
+        w->work.isAlive[i] = store->isAlive[i];
+    }
+    for (int k = 0; k < w->numImports; k++) {
+        int i = store->count + k;
+        w->work.x[i] = w->imports[k].x;
+        w->work.y[i] = w->imports[k].y;
+        w->work.mass[i] = w->imports[k].mass;
+        w->work.isAlive[i] = true;
+    }
+    w->work.count = total;
+    if (quadtree_build(&sim->tree, &w->work) != 0) {
+        return -1;
+    }
+    for (int i = 0; i < store->count; i++) {
+        if (store->isAlive[i]) {
+            vector a = quadtree_acceleration(&sim->tree, store->x[i], store->y[i], i, sim->theta);
+            store->ax[i] = a.x;
+            store->ay[i] = a.y;
+        }
+    }
+    return 0;
+}
+
+void cluster_worker_gravity(cluster_worker *w, simulation *sim) {
+    if (w->failed) {
+        return;
+    }
+    if (cluster_worker_boxes(w, &sim->bodies, false) != 0 || cluster_worker_forces(w, sim) != 0) {
+        w->failed = true;
+    }
+}
+
+static int cluster_worker_scatter(cluster_worker *w, simulation *sim, const cluster_message *m) {
+    body_store *store = &sim->bodies;
+    body_store_free(store);
+    body_store_init(store);
+    if (body_store_reserve(store, m->count) != 0 ||
+        grow((void **)&w->globalOf, &w->globalCapacity, m->count, sizeof(int)) != 0 ||
+        grow((void **)&w->buffer, &w->bufferCapacity, m->count, sizeof(cluster_body)) != 0 ||
+        cluster_recv(w->coordinator, w->buffer, m->count * sizeof(cluster_body)) != 0) {
+        return -1;
+    }
+    for (int k = 0; k < m->count; k++) {
+        const cluster_body r = w->buffer[k];
+        body b;
+        b.isAlive = true;
+        b.x = r.x;
+        b.y = r.y;
+        b.radius = r.radius;
+        b.Xspeed = r.vx;
+        b.Yspeed = r.vy;
+        b.mass = r.mass;
+        b.color = r.color;
+        int i = body_store_push(store, &b);
+        store->ax[i] = r.ax;
+        store->ay[i] = r.ay;
+        store->prevX[i] = r.prevX;
+        store->prevY[i] = r.prevY;
+        w->globalOf[store->id[i]] = r.id;
+    }
+    w->stale = m->flag;
+    sim->forcesChanges = store->changes;
+    return 0;
+}
+
+static int cluster_worker_step(cluster_worker *w, simulation *sim, const cluster_message *m) {
+    double start = simulation_clock();
+    w->waited = 0;
+    w->exported = 0;
+    sim->dt = m->dt;
+    sim->theta = m->theta;
+    sim->collisions = m->collisions;
+
+    simulation_merge(sim);
+    // Every worker has to take part in every force pass, so whether forces
+    // are recomputed before the first kick is decided for all of them
+    bool stale = w->stale || sim->forcesChanges != sim->bodies.changes;
+    w->stale = false;
+    if (cluster_worker_boxes(w, &sim->bodies, stale) != 0) {
+        return -1;
+    }
+    if (w->anyStale && cluster_worker_forces(w, sim) != 0) {
+        return -1;
+    }
+    sim->forcesChanges = sim->bodies.changes;
+    simulation_integrate(sim); //gravity through cluster_worker_gravity
+    if (w->failed) {
+        return -1;
+    }
+
+    cluster_message done;
+    memset(&done, 0, sizeof(done));
+    done.type = CLUSTER_DONE;
+    done.count = sim->bodies.count;
+    done.busy = simulation_clock() - start - w->waited;
+    done.exported = w->exported;
+    return cluster_send(w->coordinator, &done, sizeof(done));
+}
+
+static int cluster_worker_gather(cluster_worker *w, simulation *sim) {
+    body_store *store = &sim->bodies;
+    cluster_message m;
+    memset(&m, 0, sizeof(m));
+    m.type = CLUSTER_BODIES;
+    for (int i = 0; i < store->count; i++) {
+        m.count += store->isAlive[i];
+    }
+    if (grow((void **)&w->buffer, &w->bufferCapacity, m.count, sizeof(cluster_body)) != 0) {
+        return -1;
+    }
+    int k = 0;
+    for (int i = 0; i < store->count; i++) {
+        if (!store->isAlive[i]) {
+            continue;
+        }
+        cluster_body *r = &w->buffer[k++];
+        memset(r, 0, sizeof(*r));
+        r->x = store->x[i];
+        r->y = store->y[i];
+        r->vx = store->vx[i];
+        r->vy = store->vy[i];
+        r->ax = store->ax[i];
+        r->ay = store->ay[i];
+        r->prevX = store->prevX[i];
+        r->prevY = store->prevY[i];
+        r->mass = store->mass[i];
+        r->radius = store->radius[i];
+        r->id = w->globalOf[store->id[i]];
+        r->color = store->color[i];
+    }
+    if (cluster_send(w->coordinator, &m, sizeof(m)) != 0 ||
+        cluster_send(w->coordinator, w->buffer, m.count * sizeof(cluster_body)) != 0) {
+        return -1;
+    }
+    body_store_free(store);
+    body_store_init(store);
+    return 0;
+}
+
+static void cluster_worker_main(cluster_worker *w) {
+    simulation sim;
+    int status = 1;
+    if (simulation_init(&sim, GRAVITY_BARNES_HUT, 0.5, 1) == 0) {
+        sim.worker = w;
+        quadtree_init(&w->localTree);
+        body_store_init(&w->work);
+        for (;;) {
+            cluster_message m;
+            int result = -1;
+            if (cluster_recv(w->coordinator, &m, sizeof(m)) != 0) {
+                break; //the coordinator is gone
+            }
+            if (m.type == CLUSTER_QUIT) {
+                status = 0;
+                break;
+            } else if (m.type == CLUSTER_SCATTER) {
+                result = cluster_worker_scatter(w, &sim, &m);
+            } else if (m.type == CLUSTER_STEP) {
+                result = cluster_worker_step(w, &sim, &m);
+            } else if (m.type == CLUSTER_GATHER) {
+                result = cluster_worker_gather(w, &sim);
+            }
+            if (result != 0) {
+                printf("cluster worker %d failed\n", w->rank);
+                break;
+            }
+        }
+        quadtree_free(&w->localTree);
+        body_store_free(&w->work);
+        simulation_free(&sim);
+    }
+    fflush(stdout);
+    _exit(status); //skip the coordinator's atexit handlers
+}
+
+// ---- coordinator side ----
+
+int cluster_size(const cluster *c) {
+    return c->numWorkers;
+}
+
+static int compare_keys(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Orthogonal recursive bisection: cut the slots across the longer side of
+// their bounding box where the weight splits in proportion to the workers
+// each half gets, until every domain has one worker
+static void cluster_bisect(cluster *c, const body_store *store, int *items, int n, int parts, int first) {
+    if (parts == 1 || n == 0) {
+        for (int k = 0; k < n; k++) {
+            c->partOf[items[k]] = first;
+        }
+        return;
+    }
+    double min_x = INFINITY, min_y = INFINITY, max_x = -INFINITY, max_y = -INFINITY;
+    for (int k = 0; k < n; k++) {
+        min_x = fmin(min_x, store->x[items[k]]);
+        max_x = fmax(max_x, store->x[items[k]]);
+        min_y = fmin(min_y, store->y[items[k]]);
+        max_y = fmax(max_y, store->y[items[k]]);
+    }
+    const real *axis = (max_x - min_x >= max_y - min_y) ? store->x : store->y;
+    double total = 0;
+    for (int k = 0; k < n; k++) {
+        c->keys[k].key = axis[items[k]];
+        c->keys[k].slot = items[k];
+        total += c->slotWeight[items[k]];
+    }
+    qsort(c->keys, n, sizeof(c->keys[0]), compare_keys);
+
+    int lower = parts / 2;
+    double target = total * lower / parts;
+    double sum = 0;
+    int cut = 0;
+    while (cut < n && sum + c->slotWeight[c->keys[cut].slot] / 2 < target) {
+        sum += c->slotWeight[c->keys[cut].slot];
+        cut++;
+    }
+    for (int k = 0; k < n; k++) {
+        items[k] = c->keys[k].slot;
+    }
+    cluster_bisect(c, store, items, cut, lower, first);
+    cluster_bisect(c, store, items + cut, n - cut, parts - lower, first + lower);
+}
+
+static int cluster_fail(const char *what) {
+    printf("cluster: %s failed\n", what);
+    return -1;
+}
+
+// Start an epoch: merge, bisect and hand every worker its bodies
+static int cluster_scatter(cluster *c, simulation *sim) {
+    body_store *store = &sim->bodies;
+    simulation_merge(sim); //pairs that straddled a boundary last epoch
+    bool stale = !c->gathered || store->changes != c->changesAtGather;
+
+    int n = store->count;
+    if (grow((void **)&c->partOf, &c->slotCapacity, n, sizeof(int)) != 0) {
+        return -1;
+    }
+    int capacity = c->slotCapacity;
+    int *items = realloc(c->items, capacity * sizeof(int));
+    if (items) c->items = items;
+    double *slotWeight = realloc(c->slotWeight, capacity * sizeof(double));
+    if (slotWeight) c->slotWeight = slotWeight;
+    void *keys = realloc(c->keys, capacity * sizeof(c->keys[0]));
+    if (keys) c->keys = keys;
+    int *sentIds = realloc(c->sentIds, capacity * sizeof(int));
+    if (sentIds) c->sentIds = sentIds;
+    if (!items || !slotWeight || !keys || !sentIds) {
+        perror("Error reallocating memory");
+        return -1;
+    }
+
+    // Bodies nobody has timed yet (the first epoch, spawns) cost the average
+    double known = 0;
+    int numKnown = 0;
+    for (int i = 0; i < n; i++) {
+        int id = store->id[i];
+        if (store->isAlive[i] && id < c->weightCapacity && c->weight[id] > 0) {
+            known += c->weight[id];
+            numKnown++;
+        }
+    }
+    double average = (numKnown > 0) ? known / numKnown : 1;
+    int numItems = 0;
+    for (int i = 0; i < n; i++) {
+        if (store->isAlive[i]) {
+            int id = store->id[i];
+            c->slotWeight[i] = (id < c->weightCapacity && c->weight[id] > 0) ? c->weight[id] : average;
+            c->items[numItems++] = i;
+        }
+    }
+    cluster_bisect(c, store, c->items, numItems, c->numWorkers, 0);
+
+    // items is now ordered domain by domain
+    c->numSent = 0;
+    int next = 0;
+    for (int w = 0; w < c->numWorkers; w++) {
+        int end = next;
+        while (end < numItems && c->partOf[c->items[end]] == w) {
+            end++;
+        }
+        cluster_message m;
+        memset(&m, 0, sizeof(m));
+        m.type = CLUSTER_SCATTER;
+        m.count = end - next;
+        m.flag = stale;
+        if (cluster_send(c->fds[w], &m, sizeof(m)) != 0) {
+            return cluster_fail("scatter");
+        }
+        if (grow((void **)&c->buffer, &c->bufferCapacity, m.count, sizeof(cluster_body)) != 0) {
+            return -1;
+        }
+        for (int k = next; k < end; k++) {
+            int i = c->items[k];
+            cluster_body *r = &c->buffer[k - next];
+            memset(r, 0, sizeof(*r));
+            r->x = store->x[i];
+            r->y = store->y[i];
+            r->vx = store->vx[i];
+            r->vy = store->vy[i];
+            r->ax = store->ax[i];
+            r->ay = store->ay[i];
+            r->prevX = store->prevX[i];
+            r->prevY = store->prevY[i];
+            r->mass = store->mass[i];
+            r->radius = store->radius[i];
+            r->id = store->id[i];
+            r->color = store->color[i];
+            c->sentIds[c->numSent++] = r->id;
+        }
+        if (cluster_send(c->fds[w], c->buffer, m.count * sizeof(cluster_body)) != 0) {
+            return cluster_fail("scatter");
+        }
+        c->count[w] = m.count;
+        c->epochBusy[w] = 0;
+        next = end;
+    }
+    c->distributed = true;
+    c->scatteredAt = sim->steps;
+    c->epochSteps = 0;
+    c->epochs++;
+    return 0;
+}
+
+int cluster_gather(cluster *c, simulation *sim) {
+    if (!c->distributed) {
+        return 0;
+    }
+    body_store *store = &sim->bodies;
+    cluster_message m;
+    memset(&m, 0, sizeof(m));
+    m.type = CLUSTER_GATHER;
+    for (int w = 0; w < c->numWorkers; w++) {
+        if (cluster_send(c->fds[w], &m, sizeof(m)) != 0) {
+            return cluster_fail("gather");
+        }
+    }
+    // Every id handed out gets a new weight, the ones that do not come back
+    // were merged away on a worker
+    int known = c->weightCapacity;
+    if (grow((void **)&c->weight, &c->weightCapacity, store->nextId, sizeof(double)) != 0) {
+        return -1;
+    }
+    memset(c->weight + known, 0, (c->weightCapacity - known) * sizeof(double));
+    for (int k = 0; k < c->numSent; k++) {
+        c->weight[c->sentIds[k]] = -1;
+    }
+    // Everything is received before anything is written, so a worker lost
+    // halfway leaves the store as it was handed out
+    int total = 0;
+    for (int w = 0; w < c->numWorkers; w++) {
+        if (cluster_recv(c->fds[w], &m, sizeof(m)) != 0 || m.type != CLUSTER_BODIES ||
+            grow((void **)&c->buffer, &c->bufferCapacity, total + m.count, sizeof(cluster_body)) != 0 ||
+            cluster_recv(c->fds[w], c->buffer + total, m.count * sizeof(cluster_body)) != 0) {
+            return cluster_fail("gather");
+        }
+        c->count[w] = m.count;
+        total += m.count;
+    }
+    int first = 0;
+    for (int w = 0; w < c->numWorkers; w++) {
+        double cost = (c->count[w] > 0) ? c->epochBusy[w] / c->count[w] : 0;
+        for (int k = first; k < first + c->count[w]; k++) {
+            const cluster_body *r = &c->buffer[k];
+            int i = body_store_find(store, r->id);
+            if (i < 0) {
+                continue;
+            }
+            store->x[i] = r->x;
+            store->y[i] = r->y;
+            store->vx[i] = r->vx;
+            store->vy[i] = r->vy;
+            store->ax[i] = r->ax;
+            store->ay[i] = r->ay;
+            store->prevX[i] = r->prevX;
+            store->prevY[i] = r->prevY;
+            store->mass[i] = r->mass;
+            store->radius[i] = r->radius;
+            store->color[i] = r->color;
+            c->weight[r->id] = cost;
+        }
+        first += c->count[w];
+    }
+    for (int k = 0; k < c->numSent; k++) {
+        int id = c->sentIds[k];
+        if (c->weight[id] < 0) {
+            int i = body_store_find(store, id);
+            if (i >= 0) {
+                body_store_kill(store, i);
+            }
+            c->weight[id] = 0;
+        }
+    }
+    body_store_compact(store);
+    c->distributed = false;
+    c->gathered = true;
+    c->changesAtGather = store->changes;
+    sim->forcesChanges = store->changes; //ax/ay are the workers', already current
+    return 0;
+}
+
+long cluster_synced_step(const cluster *c, long steps) {
+    return c->distributed ? c->scatteredAt : steps;
+}
+
+int cluster_step(cluster *c, simulation *sim) {
+    if (!c->distributed && cluster_scatter(c, sim) != 0) {
+        return -1;
+    }
+    cluster_message m;
+    memset(&m, 0, sizeof(m));
+    m.type = CLUSTER_STEP;
+    m.dt = sim->dt;
+    m.theta = sim->theta;
+    m.collisions = sim->collisions;
+    for (int w = 0; w < c->numWorkers; w++) {
+        if (cluster_send(c->fds[w], &m, sizeof(m)) != 0) {
+            return cluster_fail("step");
+        }
+    }
+
+    // Workers run in lockstep, so each round they all send the same message
+    for (;;) {
+        bool anyStale = false;
+        bool done = false;
+        for (int w = 0; w < c->numWorkers; w++) {
+            if (cluster_recv(c->fds[w], &m, sizeof(m)) != 0 || (m.type != CLUSTER_BOX && m.type != CLUSTER_DONE)) {
+                return cluster_fail("step");
+            }
+            if (m.type == CLUSTER_BOX) {
+                memcpy(c->boxes[w], m.box, sizeof(m.box));
+                anyStale = anyStale || m.flag;
+            } else {
+                done = true;
+                c->count[w] = m.count;
+                c->epochBusy[w] += m.busy;
+                c->busyTotal[w] += m.busy;
+                c->exportedTotal += m.exported;
+            }
+        }
+        if (done) {
+            break;
+        }
+        memset(&m, 0, sizeof(m));
+        m.type = CLUSTER_BOXES;
+        m.flag = anyStale;
+        for (int w = 0; w < c->numWorkers; w++) {
+            if (cluster_send(c->fds[w], &m, sizeof(m)) != 0 ||
+                cluster_send(c->fds[w], c->boxes, c->numWorkers * sizeof(c->boxes[0])) != 0) {
+                return cluster_fail("step");
+            }
+        }
+    }
+    c->steps++;
+    c->epochSteps++;
+
+    // Bodies drift out of their domains and clump, so the split is redone
+    // regularly, and early when one worker has fallen well behind the rest
+    double slowest = 0, busy = 0;
+    for (int w = 0; w < c->numWorkers; w++) {
+        slowest = fmax(slowest, c->epochBusy[w]);
+        busy += c->epochBusy[w];
+    }
+    bool imbalanced = busy > 0 && slowest * c->numWorkers / busy > CLUSTER_MAX_IMBALANCE &&
+                      c->epochSteps * 4 >= c->rebalanceEvery;
+    if (c->epochSteps >= c->rebalanceEvery || imbalanced) {
+        return cluster_gather(c, sim);
+    }
+    return 0;
+}
+
+cluster *cluster_start(int numWorkers, int rebalanceEvery) {
+    if (numWorkers < 1 || numWorkers > CLUSTER_MAX_WORKERS) {
+        printf("cluster: %d workers, must be from 1 to %d\n", numWorkers, CLUSTER_MAX_WORKERS);
+        return NULL;
+    }
+    cluster *c = calloc(1, sizeof(cluster));
+    int *pending = malloc(numWorkers * numWorkers * sizeof(int));
+    int *mine = malloc(numWorkers * sizeof(int));
+    if (!c || !pending || !mine ||
+        !(c->pids = calloc(numWorkers, sizeof(pid_t))) ||
+        !(c->fds = malloc(numWorkers * sizeof(int))) ||
+        !(c->boxes = calloc(numWorkers, sizeof(c->boxes[0]))) ||
+        !(c->count = calloc(numWorkers, sizeof(int))) ||
+        !(c->epochBusy = calloc(numWorkers, sizeof(double))) ||
+        !(c->busyTotal = calloc(numWorkers, sizeof(double)))) {
+        perror("Error allocating memory");
+        free(pending);
+        free(mine);
+        if (c) {
+            c->numWorkers = 0;
+            cluster_stop(c);
+        }
+        return NULL;
+    }
+    c->rebalanceEvery = (rebalanceEvery < 1) ? 1 : rebalanceEvery;
+    for (int k = 0; k < numWorkers * numWorkers; k++) {
+        pending[k] = -1;
+    }
+
+    // Worker i gets a socket to the coordinator and one to every other
+    // worker. The pair between i and j > i is made just before i is forked;
+    // i keeps one end and the other waits in pending[j][i] for j.
+    int started = 0;
+    for (int i = 0; i < numWorkers; i++) {
+        int sv[2];
+        bool connected = socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0;
+        bool ok = connected;
+        int child = sv[1];
+        c->fds[i] = sv[0];
+        for (int j = i + 1; j < numWorkers && ok; j++) {
+            ok = socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0;
+            mine[j] = ok ? sv[0] : -1;
+            pending[j * numWorkers + i] = ok ? sv[1] : -1;
+        }
+        fflush(stdout); //or the children print it again
+        pid_t pid = ok ? fork() : -1;
+        if (pid == 0) {
+            // Close every inherited socket that belongs to someone else
+            for (int k = 0; k <= i; k++) {
+                close(c->fds[k]);
+            }
+            for (int j = i + 1; j < numWorkers; j++) {
+                for (int a = 0; a <= i; a++) {
+                    close(pending[j * numWorkers + a]);
+                }
+            }
+            cluster_worker w;
+            memset(&w, 0, sizeof(w));
+            w.rank = i;
+            w.numWorkers = numWorkers;
+            w.coordinator = child;
+            w.peers = malloc(numWorkers * sizeof(int));
+            w.boxes = calloc(numWorkers, sizeof(w.boxes[0]));
+            if (!w.peers || !w.boxes) {
+                _exit(1);
+            }
+            for (int a = 0; a < numWorkers; a++) {
+                w.peers[a] = (a < i) ? pending[i * numWorkers + a] : (a > i) ? mine[a] : -1;
+            }
+            cluster_worker_main(&w);
+        }
+        if (pid < 0) {
+            perror("Error starting cluster worker");
+            if (connected) {
+                close(c->fds[i]);
+                close(child);
+            }
+            for (int j = i + 1; j < numWorkers; j++) {
+                if (pending[j * numWorkers + i] >= 0) {
+                    close(mine[j]);
+                }
+            }
+            break;
+        }
+        c->pids[i] = pid;
+        started++;
+        close(child);
+        for (int j = i + 1; j < numWorkers; j++) {
+            close(mine[j]);
+        }
+        for (int a = 0; a < i; a++) {
+            close(pending[i * numWorkers + a]);
+            pending[i * numWorkers + a] = -1;
+        }
+    }
+    // Ends still waiting for a worker that never started
+    for (int k = 0; k < numWorkers * numWorkers; k++) {
+        if (pending[k] >= 0 && k / numWorkers >= started) {
+            close(pending[k]);
+        }
+    }
+    free(pending);
+    free(mine);
+    c->numWorkers = started;
+    if (started < numWorkers) {
+        cluster_stop(c);
+        return NULL;
+    }
+    printf("cluster: %d worker processes, rebalancing every %d steps\n", numWorkers, c->rebalanceEvery);
+    return c;
+}
+
+void cluster_stop(cluster *c) {
+    if (!c) {
+        return;
+    }
+    cluster_message m;
+    memset(&m, 0, sizeof(m));
+    m.type = CLUSTER_QUIT;
+    for (int w = 0; w < c->numWorkers; w++) {
+        cluster_send(c->fds[w], &m, sizeof(m));
+        close(c->fds[w]);
+    }
+    for (int w = 0; w < c->numWorkers; w++) {
+        waitpid(c->pids[w], NULL, 0);
+    }
+
+    if (c->steps > 0) {
+        double total = 0, slowest = 0;
+        for (int w = 0; w < c->numWorkers; w++) {
+            total += c->busyTotal[w];
+            slowest = fmax(slowest, c->busyTotal[w]);
+        }
+        printf("cluster: %ld steps in %d epochs, load imbalance %.2f, %.0f point masses exchanged per step\n",
+               c->steps, c->epochs, (total > 0) ? slowest * c->numWorkers / total : 1, c->exportedTotal / c->steps);
+        for (int w = 0; w < c->numWorkers; w++) {
+            printf("  worker %d: %d bodies, %.3f s computing\n", w, c->count[w], c->busyTotal[w]);
+        }
+    }
+    free(c->pids);
+    free(c->fds);
+    free(c->sentIds);
+    free(c->partOf);
+    free(c->items);
+    free(c->keys);
+    free(c->slotWeight);
+    free(c->weight);
+    free(c->buffer);
+    free(c->boxes);
+    free(c->count);
+    free(c->epochBusy);
+    free(c->busyTotal);
+    free(c);
+}
@@ -0,0 +1,57 @@
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include "sim.h"
+
+#define CLUSTER_MAX_WORKERS 32
+#define CLUSTER_DEFAULT_REBALANCE 20  //steps between gathers in headless runs
+#define CLUSTER_MAX_IMBALANCE 1.25    //slowest worker over the mean that ends an epoch early
+
+// Runs the steps of a simulation on local worker processes, one spatial
+// domain each. Every epoch the coordinator (the process that started the
+// cluster) merges overlapping bodies, splits the living ones by orthogonal
+// recursive bisection on x/y, weighted by what each body cost last epoch,
+// and hands every worker its domain over a Unix socket. Workers then step
+// in lockstep:
+//   - merges between bodies of the same domain happen every step, pairs that
+//     straddle a boundary merge when the coordinator gets them back
+//   - for gravity each worker sends every other one the cells of its own
+//     quadtree that are far enough from that worker's bodies to be taken
+//     whole (Barnes-Hut with the simulation's theta, measured from the
+//     receiver's bounding box), as point masses
+//   - boxes go through the coordinator, the point masses directly from
+//     worker to worker in the rounds of a round-robin tournament
+// After rebalanceEvery steps, or earlier when one worker falls behind, the
+// bodies are gathered back into sim->bodies and the next epoch starts.
+// Workers always use Barnes-Hut whatever sim->mode says.
+// A cluster run is not a replay of the single-process one, not even with
+// theta 0: pairs that straddle a boundary stay two bodies until the next
+// gather, pulling on each other and running into others meanwhile, so body
+// counts and the final state drift apart from the first such contact.
+typedef struct cluster cluster;
+typedef struct cluster_worker cluster_worker;
+
+// Fork numWorkers workers. Only the calling thread is copied into them, so
+// start the cluster before the thread pool or any other thread exists.
+cluster *cluster_start(int numWorkers, int rebalanceEvery);
+// Stop the workers and print how the load was spread. Bodies still out on
+// the workers are lost, call cluster_gather first to keep them.
+void cluster_stop(cluster *c);
+int cluster_size(const cluster *c);
+
+// One step of sim->dt on the workers, handing the bodies out first if no
+// epoch is running. sim->bodies is only current right after a gather.
+int cluster_step(cluster *c, simulation *sim);
+// End the running epoch: bring sim->bodies up to date with the workers.
+// On failure sim->bodies is left as the epoch handed it out.
+int cluster_gather(cluster *c, simulation *sim);
+// Step sim->bodies is current at when the simulation is at `steps`: the
+// step the running epoch started at, or `steps` between epochs. After a
+// failure that is where the simulation carries on from.
+long cluster_synced_step(const cluster *c, long steps);
+
+// simulation_gravity in a worker process: exchange with the other workers
+// and fill ax/ay of the local bodies
+void cluster_worker_gravity(cluster_worker *w, simulation *sim);
+
+#endif
@@ -0,0 +1,291 @@
+#include "density.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DENSITY_CHUNK 16384       //bodies per splat task
+#define DENSITY_ROWS_PER_TASK 16  //rows per resolve task
+
+typedef struct {
+    float at;       //position along the ramp, 0 to 1
+    uint8_t r, g, b;
+} density_stop;
+
+// Black through deep blue, magenta and orange to near white
+static const density_stop RAMP_STOPS[] = {
+    {0.00f, 0, 0, 0},
+    {0.20f, 30, 20, 110},
+    {0.45f, 170, 40, 130},
+    {0.70f, 250, 130, 40},
+    {1.00f, 255, 250, 220},
+};
+
+void density_init(density_map *map, bool byMass) {
+    memset(map, 0, sizeof(*map));
+    map->byMass = byMass;
+    int stops = sizeof(RAMP_STOPS) / sizeof(RAMP_STOPS[0]);
+    for (int i = 0; i < DENSITY_RAMP; i++) {
+        float t = (float)i / (DENSITY_RAMP - 1);
+        int k = 1;
+        while (k < stops - 1 && RAMP_STOPS[k].at < t) {
+            k++;
+        }
+        const density_stop *a = &RAMP_STOPS[k - 1];
+        const density_stop *b = &RAMP_STOPS[k];
+        float f = (t - a->at) / (b->at - a->at);
+        uint32_t r = (uint32_t)(a->r + f * (b->r - a->r) + 0.5f);
+        uint32_t g = (uint32_t)(a->g + f * (b->g - a->g) + 0.5f);
+        uint32_t bl = (uint32_t)(a->b + f * (b->b - a->b) + 0.5f);
+        map->ramp[i] = 0xff000000u | (r << 16) | (g << 8) | bl;
+    }
+}
+
+void density_free(density_map *map) {
+    free(map->planes);
+    free(map->weights);
+    free(map->bandPeak);
+    density_init(map, map->byMass);
+}
+
+static int density_reserve(density_map *map, int width, int height, int threads) {
+    int bands = (height + DENSITY_ROWS_PER_TASK - 1) / DENSITY_ROWS_PER_TASK;
+    if (map->planes && map->width == width && map->height == height && map->numPlanes == threads) {
+        if (map->dirty) {
+            memset(map->planes, 0, (size_t)width * height * threads * sizeof(float));
+        }
+        return 0;
+    }
+    free(map->planes);
+    free(map->weights);
+    free(map->bandPeak);
+    map->planes = calloc((size_t)width * height * threads, sizeof(float));
+    map->weights = calloc(threads, sizeof(double));
+    map->bandPeak = calloc(bands, sizeof(float));
+    if (!map->planes || !map->weights || !map->bandPeak) {
+        perror("Error allocating memory");
+        free(map->planes);
+        free(map->weights);
+        free(map->bandPeak);
+        map->planes = NULL;
+        map->weights = NULL;
+        map->bandPeak = NULL;
+        map->numPlanes = 0;
+        return -1;
+    }
+    map->width = width;
+    map->height = height;
+    map->numPlanes = threads;
+    map->numBands = bands;
+    return 0;
+}
+
+typedef struct {
+    density_map *map;
+    const camera *cam;
+    const double *x, *y, *prevX, *prevY, *mass;
+    double alpha;
+    int count;
+} density_job;
+
+static void density_splat_task(void *context, int task, int thread) {
+    density_job *job = context;
+    density_map *map = job->map;
+    int width = map->width;
+    int height = map->height;
+    float *plane = map->planes + (size_t)thread * width * height;
+    const camera *cam = job->cam;
+    // Screen position relative to pixel centres, so a body on a centre lands in that pixel only
+    double offsetX = width / 2.0 - 0.5 - cam->x * cam->zoom;
+    double offsetY = height / 2.0 - 0.5 - cam->y * cam->zoom;
+    int end = (task + 1) * DENSITY_CHUNK;
+    if (end > job->count) {
+        end = job->count;
+    }
+    double total = 0;
+
+    for (int i = task * DENSITY_CHUNK; i < end; i++) {
+        double wx = job->x[i];
+        double wy = job->y[i];
+        if (job->prevX) {
+            wx = job->prevX[i] + job->alpha * (wx - job->prevX[i]);
+            wy = job->prevY[i] + job->alpha * (wy - job->prevY[i]);
+        }
+        float weight = job->mass ? (float)job->mass[i] : 1.0f;
+        total += weight;
+        double sx = wx * cam->zoom + offsetX;
+        double sy = wy * cam->zoom + offsetY;
+        if (!(sx > -1 && sy > -1 && sx < width && sy < height)) {
+            continue; //off screen, NaN included
+        }
+        int ix = (int)floor(sx);
+        int iy = (int)floor(sy);
+        float fx = (float)(sx - ix);
+        float fy = (float)(sy - iy);
+        float w00 = weight * (1 - fx) * (1 - fy);
+        float w10 = weight * fx * (1 - fy);
+        float w01 = weight * (1 - fx) * fy;
+        float w11 = weight * fx * fy;
+        float *p = plane + (size_t)iy * width + ix;
+        if (ix >= 0 && iy >= 0 && ix + 1 < width && iy + 1 < height) {
+            p[0] += w00;
+            p[1] += w10;
+            p[width] += w01;
+            p[width + 1] += w11;
+            continue;
+        }
+        // Along the border only the corners on screen get their share
+        bool left = ix >= 0, right = ix + 1 < width, top = iy >= 0, bottom = iy + 1 < height;
+        if (left && top) p[0] += w00;
+        if (right && top) p[1] += w10;
+        if (left && bottom) p[width] += w01;
+        if (right && bottom) p[width + 1] += w11;
+    }
+    map->weights[thread] += total;
+}
+
+int density_splat(density_map *map, const camera *cam, const double *x, const double *y,
+                  const double *prevX, const double *prevY, double alpha, const double *mass, int count,
+                  thread_pool *pool) {
+    if (density_reserve(map, cam->width, cam->height, thread_pool_size(pool)) != 0) {
+        return -1;
+    }
+    memset(map->weights, 0, map->numPlanes * sizeof(double));
+    density_job job = {map, cam, x, y, prevX, prevY, map->byMass ? mass : NULL, alpha, count};
+    thread_pool_run(pool, (count + DENSITY_CHUNK - 1) / DENSITY_CHUNK, density_splat_task, &job);
+
+    double total = 0;
+    for (int t = 0; t < map->numPlanes; t++) {
+        total += map->weights[t];
+    }
+    map->unit = (count > 0 && total > 0) ? total / count : 1;
+    map->dirty = true;
+    return 0;
+}
+
+// log2 from the float's exponent and a quadratic in its mantissa, within
+// 0.01 and far cheaper than log1pf, plenty for picking one of 256 colours
+static float density_log2(float v) {
+    union {
+        float f;
+        uint32_t u;
+    } bits = {v};
+    float exponent = (float)((int)(bits.u >> 23 & 0xff) - 127);
+    bits.u = (bits.u & 0x007fffffu) | 0x3f800000u; //mantissa in [1, 2)
+    float m = bits.f - 1;
+    return exponent + m * (1.3465553f - 0.34655534f * m);
+}
+
+typedef struct {
+    density_map *map;
+    uint32_t *pixels;
+    int pitch;
+    float invUnit;
+    float scale;    //ramp entries per doubling of density
+} density_resolve_job;
+
+// Fold every plane into the first and note the band's densest pixel
+static void density_sum_task(void *context, int task, int thread) {
+    density_resolve_job *job = context;
+    density_map *map = job->map;
+    size_t planeSize = (size_t)map->width * map->height;
+    int y0 = task * DENSITY_ROWS_PER_TASK;
+    int y1 = (y0 + DENSITY_ROWS_PER_TASK < map->height) ? y0 + DENSITY_ROWS_PER_TASK : map->height;
+    size_t begin = (size_t)y0 * map->width;
+    size_t end = (size_t)y1 * map->width;
+    (void)thread;
+
+    float *sum = map->planes;
+    for (int t = 1; t < map->numPlanes; t++) {
+        float *plane = map->planes + t * planeSize;
+        for (size_t i = begin; i < end; i++) {
+            sum[i] += plane[i];
+            plane[i] = 0;
+        }
+    }
+    float peak = 0;
+    for (size_t i = begin; i < end; i++) {
+        peak = (sum[i] > peak) ? sum[i] : peak;
+    }
+    map->bandPeak[task] = peak;
+}
+
+static void density_tone_task(void *context, int task, int thread) {
+    density_resolve_job *job = context;
+    density_map *map = job->map;
+    int y0 = task * DENSITY_ROWS_PER_TASK;
+    int y1 = (y0 + DENSITY_ROWS_PER_TASK < map->height) ? y0 + DENSITY_ROWS_PER_TASK : map->height;
+    uint32_t empty = map->ramp[0];
+    (void)thread;
+
+    for (int y = y0; y < y1; y++) {
+        float *sum = map->planes + (size_t)y * map->width;
+        uint32_t *out = (uint32_t *)((char *)job->pixels + (size_t)y * job->pitch);
+        for (int x = 0; x < map->width; x++) {
+            float d = sum[x];
+            if (d <= 0) {
+                out[x] = empty;
+                continue;
+            }
+            // Anything splatted at all stays off the background colour
+            int k = 1 + (int)(density_log2(1 + d * job->invUnit) * job->scale);
+            out[x] = map->ramp[(k < DENSITY_RAMP) ? k : DENSITY_RAMP - 1];
+            sum[x] = 0;
+        }
+    }
+}
+
+void density_resolve(density_map *map, uint32_t *pixels, int pitch, thread_pool *pool) {
+    if (!map->planes) {
+        return;
+    }
+    density_resolve_job job = {map, pixels, pitch, (float)(1 / map->unit), 0};
+    thread_pool_run(pool, map->numBands, density_sum_task, &job);
+    float peak = 0;
+    for (int b = 0; b < map->numBands; b++) {
+        peak = (map->bandPeak[b] > peak) ? map->bandPeak[b] : peak;
+    }
+    // The densest pixel reaches the end of the ramp
+    float range = density_log2(1 + peak * job.invUnit);
+    job.scale = (range > 0) ? (DENSITY_RAMP - 2) / range : 0;
+    thread_pool_run(pool, map->numBands, density_tone_task, &job);
+    map->dirty = false;
+}
+
+bool density_wanted(render_mode mode, const double *radius, int count, double zoom) {
+    if (mode != RENDER_AUTO || count > DENSITY_AUTO_BODIES) {
+        return mode != RENDER_CIRCLES;
+    }
+    if (count == 0) {
+        return false;
+    }
+    double sum = 0;
+    for (int i = 0; i < count; i++) {
+        sum += radius[i];
+    }
+    return sum / count * zoom < DENSITY_AUTO_PIXELS;
+}
+
+const char *render_mode_name(render_mode mode) {
+    switch (mode) {
+        case RENDER_AUTO:
+            return "auto";
+        case RENDER_CIRCLES:
+            return "circles";
+        case RENDER_DENSITY:
+            return "density";
+        case RENDER_MODE_COUNT:
+            break;
+    }
+    return "unknown";
+}
+
+int render_mode_parse(const char *name, render_mode *mode) {
+    for (int m = 0; m < RENDER_MODE_COUNT; m++) {
+        if (strcmp(name, render_mode_name(m)) == 0) {
+            *mode = m;
+            return 0;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,57 @@
+#ifndef DENSITY_H
+#define DENSITY_H
+
+#include "render.h"
+#include "thread_pool.h"
+
+#define DENSITY_AUTO_BODIES 200000 //render_mode auto splats above this many bodies
+#define DENSITY_AUTO_PIXELS 0.75   //or when the mean body radius is below this many screen pixels
+#define DENSITY_RAMP 256           //colour ramp entries
+
+typedef enum {
+    RENDER_AUTO,     //circles for few or large bodies, density otherwise
+    RENDER_CIRCLES,
+    RENDER_DENSITY,
+    RENDER_MODE_COUNT
+} render_mode;
+
+// Density view for views where most bodies are smaller than a pixel. Each
+// body adds its mass (or 1) to the pixels around it with cloud-in-cell
+// weights, the same deposit the particle mesh uses, so the cost is a few
+// adds per body whatever its radius. Threads splat into planes of their own
+// that are summed, tone mapped on a log scale and coloured through a ramp
+// in a second parallel pass over the rows.
+typedef struct {
+    int width, height;
+    float *planes;         //one width * height accumulation plane per thread
+    int numPlanes;
+    bool dirty;            //planes hold a splat that was not resolved
+    double *weights;       //total weight each thread splatted
+    float *bandPeak;       //densest pixel of each band of rows
+    int numBands;
+    double unit;           //weight of a typical body, the bottom of the log scale
+    bool byMass;           //weigh bodies by mass rather than counting them
+    uint32_t ramp[DENSITY_RAMP]; //ARGB8888, from empty to densest
+} density_map;
+
+void density_init(density_map *map, bool byMass);
+void density_free(density_map *map);
+
+// Splat `count` bodies through the camera. With prevX/prevY the bodies sit
+// `alpha` of the way from there to x/y, as in the window. mass may be NULL
+// when counting. Replaces whatever was splatted before.
+int density_splat(density_map *map, const camera *cam, const double *x, const double *y,
+                  const double *prevX, const double *prevY, double alpha, const double *mass, int count,
+                  thread_pool *pool);
+// Tone map the last splat into ARGB8888 pixels, `pitch` bytes per row
+void density_resolve(density_map *map, uint32_t *pixels, int pitch, thread_pool *pool);
+
+// Whether a view of `count` bodies is drawn as a density map in `mode`:
+// always in density, never in circles, and in auto above
+// DENSITY_AUTO_BODIES or when the mean radius at `zoom` is under DENSITY_AUTO_PIXELS
+bool density_wanted(render_mode mode, const double *radius, int count, double zoom);
+
+const char *render_mode_name(render_mode mode);
+int render_mode_parse(const char *name, render_mode *mode);
+
+#endif
@@ -0,0 +1,81 @@
+#include "fft.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int fft_plan_init(fft_plan *plan, int n) {
+    memset(plan, 0, sizeof(*plan));
+    if (n < 2 || (n & (n - 1)) != 0) {
+        printf("FFT size %d is not a power of two\n", n);
+        return -1;
+    }
+    plan->cosTable = malloc(n / 2 * sizeof(double));
+    plan->sinTable = malloc(n / 2 * sizeof(double));
+    plan->reverse = malloc(n * sizeof(int));
+    if (!plan->cosTable || !plan->sinTable || !plan->reverse) {
+        perror("Error allocating memory");
+        fft_plan_free(plan);
+        return -1;
+    }
+    plan->n = n;
+
+    int bits = 0;
+    while ((1 << bits) < n) {
+        bits++;
+    }
+    for (int i = 0; i < n; i++) {
+        int r = 0;
+        for (int b = 0; b < bits; b++) {
+            r |= ((i >> b) & 1) << (bits - 1 - b);
+        }
+        plan->reverse[i] = r;
+    }
+    for (int k = 0; k < n / 2; k++) {
+        double angle = 2 * M_PI * k / n;
+        plan->cosTable[k] = cos(angle);
+        plan->sinTable[k] = -sin(angle);
+    }
+    return 0;
+}
+
+void fft_plan_free(fft_plan *plan) {
+    free(plan->cosTable);
+    free(plan->sinTable);
+    free(plan->reverse);
+    memset(plan, 0, sizeof(*plan));
+}
+
+void fft_transform(const fft_plan *plan, double *re, double *im, bool inverse) {
+    int n = plan->n;
+    for (int i = 0; i < n; i++) {
+        int j = plan->reverse[i];
+        if (j > i) {
+            double t = re[i];
+            re[i] = re[j];
+            re[j] = t;
+            t = im[i];
+            im[i] = im[j];
+            im[j] = t;
+        }
+    }
+
+    double sign = inverse ? -1 : 1;
+    for (int size = 2; size <= n; size *= 2) {
+        int half = size / 2;
+        int step = n / size; //stride through the twiddle tables
+        for (int k = 0; k < half; k++) {
+            double wr = plan->cosTable[k * step];
+            double wi = sign * plan->sinTable[k * step];
+            for (int a = k; a < n; a += size) {
+                int b = a + half;
+                double tr = wr * re[b] - wi * im[b];
+                double ti = wr * im[b] + wi * re[b];
+                re[b] = re[a] - tr;
+                im[b] = im[a] - ti;
+                re[a] += tr;
+                im[a] += ti;
+            }
+        }
+    }
+}
@@ -0,0 +1,23 @@
+#ifndef FFT_H
+#define FFT_H
+
+#include <stdbool.h>
+
+// Iterative radix-2 complex FFT with the twiddles and the bit-reversal
+// permutation computed once per size
+typedef struct {
+    int n;              //points per transform, a power of two
+    double *cosTable;   //cos(2 pi k / n) for k < n / 2
+    double *sinTable;   //-sin(2 pi k / n), the forward twiddles
+    int *reverse;       //bit-reversed index of each point
+} fft_plan;
+
+// Returns -1 if n is not a power of two or memory runs out
+int fft_plan_init(fft_plan *plan, int n);
+void fft_plan_free(fft_plan *plan);
+
+// In-place transform of plan->n points held as separate real and imaginary
+// arrays. The inverse is not scaled, applying both multiplies by n.
+void fft_transform(const fft_plan *plan, double *re, double *im, bool inverse);
+
+#endif
@@ -0,0 +1,467 @@
+#define _POSIX_C_SOURCE 199309L //clock_gettime
+#include "frame_export.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#ifdef GRAVITY_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#define FRAME_PNG_LEVEL 1        //zlib level, mostly black frames compress well even at the fastest
+#define FRAME_STORED_BLOCK 65535 //largest uncompressed deflate block, used without zlib
+
+// One queued frame: the visible bodies in world space
+typedef struct {
+    long step;
+    int count;
+    int capacity;
+    double *x, *y;
+    double *radius;
+    double *mass;
+    SDL_Color *color;
+    bool ready;   //filled and waiting for or being encoded, only changed under the lock
+} frame_slot;
+
+// Scratch owned by one encoder thread
+typedef struct {
+    struct frame_export *e;
+    pthread_t thread;
+    render_batch batch;
+    density_map density;
+    thread_pool *pool;  //just this thread, density maps are drawn one per worker
+    uint32_t *argb;     //density map pixels, allocated on first use
+    uint8_t *rgb;       //width * height * 3
+    uint8_t *filtered;  //PNG rows, each behind its filter byte
+    uint8_t *encoded;
+    size_t encodedSize;
+} frame_worker;
+
+struct frame_export {
+    char directory[4096];
+    frame_format format;
+    camera cam;
+    bool filled;
+    render_mode mode;
+    int stride;
+    frame_slot *ring;
+    int ringSize;
+    long produced;  //frames queued, slot produced % ringSize is filled next
+    long taken;     //frames handed to a worker
+    bool closing;
+    pthread_mutex_t lock;
+    pthread_cond_t queued;  //signalled when a frame is queued or on close
+    pthread_cond_t freed;   //signalled when a worker finishes a slot
+    frame_worker *workers;
+    int numWorkers;
+    long framesWritten;
+    long framesFailed;
+    double waited;          //seconds the simulation spent on a full queue
+};
+
+static double frame_clock(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static int slot_reserve(frame_slot *s, int count) {
+    if (count <= s->capacity) {
+        return 0;
+    }
+    int capacity = (s->capacity == 0) ? 1024 : s->capacity;
+    while (capacity < count) {
+        capacity *= 2;
+    }
+    double *x = realloc(s->x, capacity * sizeof(double));
+    if (x) s->x = x;
+    double *y = realloc(s->y, capacity * sizeof(double));
+    if (y) s->y = y;
+    double *radius = realloc(s->radius, capacity * sizeof(double));
+    if (radius) s->radius = radius;
+    double *mass = realloc(s->mass, capacity * sizeof(double));
+    if (mass) s->mass = mass;
+    SDL_Color *color = realloc(s->color, capacity * sizeof(SDL_Color));
+    if (color) s->color = color;
+    if (!x || !y || !radius || !mass || !color) {
+        perror("Error reallocating memory");
+        return -1;
+    }
+    s->capacity = capacity;
+    return 0;
+}
+
+static void slot_free(frame_slot *s) {
+    free(s->x);
+    free(s->y);
+    free(s->radius);
+    free(s->mass);
+    free(s->color);
+}
+
+int frame_format_parse(const char *name, frame_format *format) {
+    if (strcmp(name, "png") == 0) {
+        *format = FRAME_FORMAT_PNG;
+    } else if (strcmp(name, "ppm") == 0) {
+        *format = FRAME_FORMAT_PPM;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static uint32_t crc_table[256];
+
+static void crc_init(void) {
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        }
+        crc_table[n] = c;
+    }
+}
+
+static uint32_t crc_update(uint32_t crc, const uint8_t *data, size_t length) {
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++) {
+        crc = crc_table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static void put_u32(uint8_t *out, uint32_t n) {
+    out[0] = (uint8_t)(n >> 24);
+    out[1] = (uint8_t)(n >> 16);
+    out[2] = (uint8_t)(n >> 8);
+    out[3] = (uint8_t)n;
+}
+
+static int png_chunk(FILE *file, const char *type, const uint8_t *data, size_t length) {
+    uint8_t head[8];
+    put_u32(head, (uint32_t)length);
+    memcpy(head + 4, type, 4);
+    uint8_t tail[4];
+    put_u32(tail, crc_update(crc_update(0, head + 4, 4), data, length));
+    return (fwrite(head, 1, 8, file) == 8 && fwrite(data, 1, length, file) == length &&
+            fwrite(tail, 1, 4, file) == 4) ? 0 : -1;
+}
+
+static int worker_reserve(frame_worker *w, size_t size) {
+    if (size <= w->encodedSize) {
+        return 0;
+    }
+    uint8_t *grown = realloc(w->encoded, size);
+    if (!grown) {
+        perror("Error reallocating memory");
+        return -1;
+    }
+    w->encoded = grown;
+    w->encodedSize = size;
+    return 0;
+}
+
+// zlib stream of the filtered rows into w->encoded, returns its length or 0
+static size_t png_deflate(frame_worker *w, size_t length) {
+#ifdef GRAVITY_HAVE_ZLIB
+    uLongf size = compressBound(length);
+    if (worker_reserve(w, size) != 0 ||
+        compress2(w->encoded, &size, w->filtered, length, FRAME_PNG_LEVEL) != Z_OK) {
+        return 0;
+    }
+    return size;
+#else
+    // Stored blocks: valid deflate without a compressor, just bigger
+    size_t blocks = (length + FRAME_STORED_BLOCK - 1) / FRAME_STORED_BLOCK;
+    if (worker_reserve(w, 2 + 5 * blocks + length + 4) != 0) {
+        return 0;
+    }
+    uint8_t *out = w->encoded;
+    *out++ = 0x78;
+    *out++ = 0x01;
+    uint32_t s1 = 1, s2 = 0;
+    for (size_t offset = 0; offset < length; offset += FRAME_STORED_BLOCK) {
+        size_t n = (length - offset < FRAME_STORED_BLOCK) ? length - offset : FRAME_STORED_BLOCK;
+        *out++ = (offset + n == length) ? 1 : 0;
+        *out++ = (uint8_t)n;
+        *out++ = (uint8_t)(n >> 8);
+        *out++ = (uint8_t)~n;
+        *out++ = (uint8_t)(~n >> 8);
+        memcpy(out, w->filtered + offset, n);
+        out += n;
+        for (size_t i = 0; i < n; i++) {
+            s1 = (s1 + w->filtered[offset + i]) % 65521;
+            s2 = (s2 + s1) % 65521;
+        }
+    }
+    put_u32(out, (s2 << 16) | s1);
+    out += 4;
+    return out - w->encoded;
+#endif
+}
+
+static int write_png(frame_worker *w, FILE *file, int width, int height) {
+    // Filter type 0 on every row
+    size_t stride = (size_t)width * 3;
+    for (int y = 0; y < height; y++) {
+        uint8_t *row = w->filtered + y * (stride + 1);
+        row[0] = 0;
+        memcpy(row + 1, w->rgb + y * stride, stride);
+    }
+    size_t length = png_deflate(w, height * (stride + 1));
+    if (length == 0) {
+        return -1;
+    }
+    static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    uint8_t ihdr[13];
+    put_u32(ihdr, width);
+    put_u32(ihdr + 4, height);
+    ihdr[8] = 8;   //bits per channel
+    ihdr[9] = 2;   //RGB
+    ihdr[10] = 0;  //deflate
+    ihdr[11] = 0;  //adaptive filtering
+    ihdr[12] = 0;  //not interlaced
+    if (fwrite(signature, 1, 8, file) != 8 || png_chunk(file, "IHDR", ihdr, sizeof(ihdr)) != 0 ||
+        png_chunk(file, "IDAT", w->encoded, length) != 0 || png_chunk(file, "IEND", NULL, 0) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+static int write_ppm(frame_worker *w, FILE *file, int width, int height) {
+    size_t size = (size_t)width * height * 3;
+    if (fprintf(file, "P6\n%d %d\n255\n", width, height) < 0 || fwrite(w->rgb, 1, size, file) != size) {
+        return -1;
+    }
+    return 0;
+}
+
+static int frame_encode(frame_worker *w, const frame_slot *s) {
+    frame_export *e = w->e;
+    int width = e->cam.width;
+    int height = e->cam.height;
+    size_t pixels = (size_t)width * height;
+    // Decided over every body, off screen too, as the window decides it
+    if (density_wanted(e->mode, s->radius, s->count, e->cam.zoom)) {
+        if (!w->argb && !(w->argb = malloc(pixels * sizeof(uint32_t)))) {
+            perror("Error allocating memory");
+            return -1;
+        }
+        if (density_splat(&w->density, &e->cam, s->x, s->y, NULL, NULL, 0, s->mass, s->count, w->pool) != 0) {
+            return -1;
+        }
+        density_resolve(&w->density, w->argb, width * sizeof(uint32_t), w->pool);
+        for (size_t i = 0; i < pixels; i++) {
+            w->rgb[3 * i] = (uint8_t)(w->argb[i] >> 16);
+            w->rgb[3 * i + 1] = (uint8_t)(w->argb[i] >> 8);
+            w->rgb[3 * i + 2] = (uint8_t)w->argb[i];
+        }
+    } else {
+        render_batch_begin(&w->batch);
+        for (int i = 0; i < s->count; i++) {
+            if (!camera_visible(&e->cam, s->x[i], s->y[i], s->radius[i])) {
+                continue;
+            }
+            double sx, sy;
+            camera_to_screen(&e->cam, s->x[i], s->y[i], &sx, &sy);
+            if (render_circle(&w->batch, sx, sy, s->radius[i] * e->cam.zoom, s->color[i], e->filled) != 0) {
+                return -1;
+            }
+        }
+        memset(w->rgb, 0, pixels * 3); //black background, as in the window
+        render_batch_rasterize(&w->batch, w->rgb, width, height);
+    }
+
+    char path[sizeof(e->directory) + 64];
+    snprintf(path, sizeof(path), "%s/frame_%08ld.%s", e->directory, s->step,
+             (e->format == FRAME_FORMAT_PNG) ? "png" : "ppm");
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        perror("Error opening frame");
+        return -1;
+    }
+    int result = (e->format == FRAME_FORMAT_PNG) ? write_png(w, file, width, height) : write_ppm(w, file, width, height);
+    if (fclose(file) != 0 || result != 0) {
+        printf("Error writing %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+static void *frame_worker_main(void *arg) {
+    frame_worker *w = arg;
+    frame_export *e = w->e;
+    pthread_mutex_lock(&e->lock);
+    while (true) {
+        while (e->taken == e->produced && !e->closing) {
+            pthread_cond_wait(&e->queued, &e->lock);
+        }
+        if (e->taken == e->produced) {
+            break; //closing and drained
+        }
+        frame_slot *s = &e->ring[e->taken % e->ringSize];
+        e->taken++;
+        pthread_mutex_unlock(&e->lock);
+
+        int result = frame_encode(w, s);
+
+        pthread_mutex_lock(&e->lock);
+        if (result == 0) {
+            e->framesWritten++;
+        } else {
+            e->framesFailed++;
+        }
+        s->ready = false;
+        pthread_cond_signal(&e->freed);
+    }
+    pthread_mutex_unlock(&e->lock);
+    return NULL;
+}
+
+static void frame_worker_free(frame_worker *w) {
+    render_batch_free(&w->batch);
+    density_free(&w->density);
+    thread_pool_destroy(w->pool);
+    free(w->argb);
+    free(w->rgb);
+    free(w->filtered);
+    free(w->encoded);
+}
+
+frame_export *frame_export_open(const char *directory, frame_format format, const camera *cam, bool filled,
+                                render_mode mode, bool densityByMass, int stride, int workers, int queueFrames) {
+    if (mkdir(directory, 0755) != 0 && errno != EEXIST) {
+        perror("Error creating frame directory");
+        return NULL;
+    }
+    frame_export *e = calloc(1, sizeof(frame_export));
+    if (!e) {
+        perror("Error allocating memory");
+        return NULL;
+    }
+    snprintf(e->directory, sizeof(e->directory), "%s", directory);
+    e->format = format;
+    e->cam = *cam;
+    e->filled = filled;
+    e->mode = mode;
+    e->stride = (stride < 1) ? 1 : stride;
+    e->ringSize = (queueFrames < 1) ? 1 : queueFrames;
+    e->numWorkers = (workers < 1) ? 1 : workers;
+    e->ring = calloc(e->ringSize, sizeof(frame_slot));
+    e->workers = calloc(e->numWorkers, sizeof(frame_worker));
+    if (!e->ring || !e->workers) {
+        perror("Error allocating memory");
+        free(e->ring);
+        free(e->workers);
+        free(e);
+        return NULL;
+    }
+    crc_init();
+    pthread_mutex_init(&e->lock, NULL);
+    pthread_cond_init(&e->queued, NULL);
+    pthread_cond_init(&e->freed, NULL);
+
+    size_t pixels = (size_t)cam->width * cam->height;
+    int started = 0;
+    for (; started < e->numWorkers; started++) {
+        frame_worker *w = &e->workers[started];
+        w->e = e;
+        render_batch_init(&w->batch);
+        density_init(&w->density, densityByMass);
+        w->pool = thread_pool_create(1);
+        w->rgb = malloc(pixels * 3);
+        w->filtered = (format == FRAME_FORMAT_PNG) ? malloc(pixels * 3 + cam->height) : NULL;
+        if (!w->pool || !w->rgb || (format == FRAME_FORMAT_PNG && !w->filtered)) {
+            perror("Error allocating memory");
+            frame_worker_free(w);
+            break;
+        }
+        if (pthread_create(&w->thread, NULL, frame_worker_main, w) != 0) {
+            printf("Error creating frame encoder thread\n");
+            frame_worker_free(w);
+            break;
+        }
+    }
+    if (started < e->numWorkers) {
+        e->numWorkers = started;
+        frame_export_close(e);
+        return NULL;
+    }
+    printf("exporting every %d steps to %s/frame_*.%s with %d encoders\n", e->stride, e->directory,
+           (format == FRAME_FORMAT_PNG) ? "png" : "ppm", e->numWorkers);
+    return e;
+}
+
+void frame_export_submit(frame_export *e, const body_store *store, const body_store *cold, long step) {
+    if (step % e->stride != 0) {
+        return;
+    }
+    frame_slot *s = &e->ring[e->produced % e->ringSize];
+    pthread_mutex_lock(&e->lock);
+    if (s->ready) {
+        // Queue full: the only place the simulation waits on the encoders
+        double start = frame_clock();
+        while (s->ready) {
+            pthread_cond_wait(&e->freed, &e->lock);
+        }
+        e->waited += frame_clock() - start;
+    }
+    pthread_mutex_unlock(&e->lock);
+
+    // The slot is ours until it is marked ready
+    int n = 0;
+    if (slot_reserve(s, store->count + (cold ? cold->count : 0)) != 0) {
+        return;
+    }
+    for (const body_store *from = store; from; from = (from == store) ? cold : NULL) {
+        for (int i = 0; i < from->count; i++) {
+            if (!from->isAlive[i]) {
+                continue;
+            }
+            s->x[n] = from->x[i];
+            s->y[n] = from->y[i];
+            s->radius[n] = from->radius[i];
+            s->mass[n] = from->mass[i];
+            s->color[n] = from->color[i];
+            n++;
+        }
+    }
+    s->count = n;
+    s->step = step;
+
+    pthread_mutex_lock(&e->lock);
+    s->ready = true;
+    e->produced++;
+    pthread_cond_signal(&e->queued);
+    pthread_mutex_unlock(&e->lock);
+}
+
+void frame_export_close(frame_export *e) {
+    if (!e) {
+        return;
+    }
+    pthread_mutex_lock(&e->lock);
+    e->closing = true;
+    pthread_cond_broadcast(&e->queued);
+    pthread_mutex_unlock(&e->lock);
+    for (int i = 0; i < e->numWorkers; i++) {
+        pthread_join(e->workers[i].thread, NULL);
+        frame_worker_free(&e->workers[i]);
+    }
+    if (e->produced > 0) {
+        printf("frames: %ld written to %s, %ld failed, simulation waited %.2f s on the encoders\n",
+               e->framesWritten, e->directory, e->framesFailed, e->waited);
+    }
+    pthread_cond_destroy(&e->queued);
+    pthread_cond_destroy(&e->freed);
+    pthread_mutex_destroy(&e->lock);
+    for (int i = 0; i < e->ringSize; i++) {
+        slot_free(&e->ring[i]);
+    }
+    free(e->ring);
+    free(e->workers);
+    free(e);
+}
@@ -0,0 +1,35 @@
+#ifndef FRAME_EXPORT_H
+#define FRAME_EXPORT_H
+
+#include "body.h"
+#include "density.h"
+#include "render.h"
+
+#define FRAME_EXPORT_DEFAULT_QUEUE 16 //frames the simulation can run ahead of the encoders
+
+typedef enum {
+    FRAME_FORMAT_PNG,
+    FRAME_FORMAT_PPM,
+} frame_format;
+
+// Offscreen frame export for making videos of long runs. The simulation
+// thread copies the living bodies into a bounded queue, all of them so the
+// auto mode is decided over the same bodies as in the window; a pool of
+// encoder threads each draws a frame the way the window would in `mode`
+// (render_circle through render_batch_rasterize, or a density map) and writes it as
+// <directory>/frame_<step>.png or .ppm. Frames finish out of order but are
+// named by step. frame_export_submit only waits when the queue is full, so
+// export runs at the speed of the slower of simulation and encoders.
+typedef struct frame_export frame_export;
+
+frame_export *frame_export_open(const char *directory, frame_format format, const camera *cam, bool filled,
+                                render_mode mode, bool densityByMass, int stride, int workers, int queueFrames);
+// Queue the store and `cold` (the far-field tier, may be NULL) if `step`
+// falls on the stride, called after each step
+void frame_export_submit(frame_export *e, const body_store *store, const body_store *cold, long step);
+// Encode everything still queued, stop the workers and report
+void frame_export_close(frame_export *e);
+
+int frame_format_parse(const char *name, frame_format *format);
+
+#endif
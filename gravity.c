@@ -0,0 +1,664 @@
+#include "gravity.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#if defined(__AVX__)
+#include <immintrin.h>
+#define KERNEL_LANES 4
+#define KERNEL_FLOAT_LANES 8
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define KERNEL_LANES 2
+#define KERNEL_FLOAT_LANES 4
+#else
+#define KERNEL_LANES 1
+#define KERNEL_FLOAT_LANES 1
+#endif
+
+// The direct sum runs on tiles of float copies in float and mixed builds,
+// on the store itself otherwise
+#if defined(GRAVITY_PRECISION_FLOAT) || defined(GRAVITY_PRECISION_MIXED)
+#define GRAVITY_FLOAT_TILES
+typedef float tile_real;
+#else
+typedef double tile_real;
+#endif
+
+// Store arrays as double vectors, widening and narrowing when real is float
+#if defined(__AVX__)
+static inline __m256d load_reals(const real *p) {
+#if defined(GRAVITY_PRECISION_FLOAT)
+    return _mm256_cvtps_pd(_mm_loadu_ps(p));
+#else
+    return _mm256_loadu_pd(p);
+#endif
+}
+
+static inline void store_reals(real *p, __m256d v) {
+#if defined(GRAVITY_PRECISION_FLOAT)
+    _mm_storeu_ps(p, _mm256_cvtpd_ps(v));
+#else
+    _mm256_storeu_pd(p, v);
+#endif
+}
+#elif defined(__SSE2__)
+static inline __m128d load_reals(const real *p) {
+#if defined(GRAVITY_PRECISION_FLOAT)
+    return _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64((const __m128i *)p)));
+#else
+    return _mm_loadu_pd(p);
+#endif
+}
+
+static inline void store_reals(real *p, __m128d v) {
+#if defined(GRAVITY_PRECISION_FLOAT)
+    _mm_storel_epi64((__m128i *)p, _mm_castps_si128(_mm_cvtpd_ps(v)));
+#else
+    _mm_storeu_pd(p, v);
+#endif
+}
+#endif
+
+const char *gravity_mode_name(gravity_mode mode) {
+    switch (mode) {
+        case GRAVITY_DIRECT:
+            return "direct";
+        case GRAVITY_BARNES_HUT:
+            return "barnes-hut";
+        case GRAVITY_PARTICLE_MESH:
+            return "particle-mesh";
+        case GRAVITY_P3M:
+            return "p3m";
+        case GRAVITY_MODE_COUNT:
+            break;
+    }
+    return "unknown";
+}
+
+// One target against every source, same operation order as the SIMD lanes
+static void kernel_scalar(body_store *store, int i) {
+    const real *x = store->x;
+    const real *y = store->y;
+    const real *mass = store->mass;
+    double xi = x[i];
+    double yi = y[i];
+    double sum_x = 0, sum_y = 0;
+
+    for (int j = 0; j < store->count; j++) {
+        double dx = x[j] - xi;
+        double dy = y[j] - yi;
+        double d2 = dx * dx + dy * dy;
+        double inv_d = (d2 > 0) ? 1 / sqrt(d2) : 0;
+        double w = mass[j] * inv_d * inv_d * inv_d;
+        sum_x += w * dx;
+        sum_y += w * dy;
+    }
+
+    store->ax[i] = GRAVITATIONAL_CONSTANT * sum_x;
+    store->ay[i] = GRAVITATIONAL_CONSTANT * sum_y;
+}
+
+void gravity_kernel(body_store *store, int begin, int end) {
+    const real *x = store->x;
+    const real *y = store->y;
+    const real *mass = store->mass;
+    int n = store->count;
+    int i = begin;
+
+#if defined(__AVX__)
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m256d g = _mm256_set1_pd(GRAVITATIONAL_CONSTANT);
+    for (; i + KERNEL_LANES <= end; i += KERNEL_LANES) {
+        __m256d xi = load_reals(&x[i]);
+        __m256d yi = load_reals(&y[i]);
+        __m256d sum_x = zero, sum_y = zero;
+        for (int j = 0; j < n; j++) {
+            __m256d dx = _mm256_sub_pd(_mm256_set1_pd(x[j]), xi);
+            __m256d dy = _mm256_sub_pd(_mm256_set1_pd(y[j]), yi);
+            __m256d d2 = _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy));
+            __m256d inv_d = _mm256_div_pd(one, _mm256_sqrt_pd(d2));
+            inv_d = _mm256_and_pd(inv_d, _mm256_cmp_pd(d2, zero, _CMP_GT_OQ));
+            __m256d w = _mm256_mul_pd(_mm256_mul_pd(_mm256_mul_pd(_mm256_set1_pd(mass[j]), inv_d), inv_d), inv_d);
+            sum_x = _mm256_add_pd(sum_x, _mm256_mul_pd(w, dx));
+            sum_y = _mm256_add_pd(sum_y, _mm256_mul_pd(w, dy));
+        }
+        store_reals(&store->ax[i], _mm256_mul_pd(g, sum_x));
+        store_reals(&store->ay[i], _mm256_mul_pd(g, sum_y));
+    }
+#elif defined(__SSE2__)
+    const __m128d zero = _mm_setzero_pd();
+    const __m128d one = _mm_set1_pd(1.0);
+    const __m128d g = _mm_set1_pd(GRAVITATIONAL_CONSTANT);
+    for (; i + KERNEL_LANES <= end; i += KERNEL_LANES) {
+        __m128d xi = load_reals(&x[i]);
+        __m128d yi = load_reals(&y[i]);
+        __m128d sum_x = zero, sum_y = zero;
+        for (int j = 0; j < n; j++) {
+            __m128d dx = _mm_sub_pd(_mm_set1_pd(x[j]), xi);
+            __m128d dy = _mm_sub_pd(_mm_set1_pd(y[j]), yi);
+            __m128d d2 = _mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy));
+            __m128d inv_d = _mm_div_pd(one, _mm_sqrt_pd(d2));
+            inv_d = _mm_and_pd(inv_d, _mm_cmpgt_pd(d2, zero));
+            __m128d w = _mm_mul_pd(_mm_mul_pd(_mm_mul_pd(_mm_set1_pd(mass[j]), inv_d), inv_d), inv_d);
+            sum_x = _mm_add_pd(sum_x, _mm_mul_pd(w, dx));
+            sum_y = _mm_add_pd(sum_y, _mm_mul_pd(w, dy));
+        }
+        store_reals(&store->ax[i], _mm_mul_pd(g, sum_x));
+        store_reals(&store->ay[i], _mm_mul_pd(g, sum_y));
+    }
+#else
+    (void)x; (void)y; (void)mass; (void)n;
+#endif
+
+    // Leftover targets that do not fill a whole vector
+    for (; i < end; i++) {
+        kernel_scalar(store, i);
+    }
+}
+
+typedef struct {
+    body_store *store;
+    int numTiles;
+    int slots;   //numTiles rounded up to an even count, the extra slot is a bye
+    int round;   //-1 for the pass over the diagonal tiles
+    // What the pair loop reads: the store itself, or in float and mixed
+    // builds float copies relative to the centre of their tile
+    const tile_real *x, *y, *mass;
+    double *centreX, *centreY; //centre of each tile, NULL when x/y are the store's
+} tile_job;
+
+#if defined(GRAVITY_FLOAT_TILES)
+// Body i against bodies [j_begin, j_end) in float, computing each pair once.
+// (xi, yi) is body i relative to the centre of j's tile. Both sides go into
+// tile scratch: acc_i for body i, acc_j[j - j_base] for j. Weights are
+// 1/|d|^3, masses and G are applied when the pair is split.
+static void pair_row(const tile_job *job, int i, float xi, float yi, int j_begin, int j_end, int j_base,
+                     float *acc_ix, float *acc_iy, float *acc_jx, float *acc_jy) {
+    const float *x = job->x;
+    const float *y = job->y;
+    const float *mass = job->mass;
+    float mi = mass[i];
+    float sum_x = 0, sum_y = 0;
+    int j = j_begin;
+
+#if defined(__AVX__)
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+    __m256 lanes_x = zero, lanes_y = zero;
+    for (; j + KERNEL_FLOAT_LANES <= j_end; j += KERNEL_FLOAT_LANES) {
+        __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(&x[j]), _mm256_set1_ps(xi));
+        __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(&y[j]), _mm256_set1_ps(yi));
+        __m256 d2 = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+        __m256 inv_d = _mm256_div_ps(one, _mm256_sqrt_ps(d2));
+        inv_d = _mm256_and_ps(inv_d, _mm256_cmp_ps(d2, zero, _CMP_GT_OQ));
+        __m256 w = _mm256_mul_ps(_mm256_mul_ps(inv_d, inv_d), inv_d);
+        __m256 wi = _mm256_mul_ps(w, _mm256_loadu_ps(&mass[j]));
+        __m256 wj = _mm256_mul_ps(w, _mm256_set1_ps(mi));
+        lanes_x = _mm256_add_ps(lanes_x, _mm256_mul_ps(wi, dx));
+        lanes_y = _mm256_add_ps(lanes_y, _mm256_mul_ps(wi, dy));
+        float *jx = &acc_jx[j - j_base];
+        float *jy = &acc_jy[j - j_base];
+        _mm256_storeu_ps(jx, _mm256_sub_ps(_mm256_loadu_ps(jx), _mm256_mul_ps(wj, dx)));
+        _mm256_storeu_ps(jy, _mm256_sub_ps(_mm256_loadu_ps(jy), _mm256_mul_ps(wj, dy)));
+    }
+    float lx[KERNEL_FLOAT_LANES], ly[KERNEL_FLOAT_LANES];
+    _mm256_storeu_ps(lx, lanes_x);
+    _mm256_storeu_ps(ly, lanes_y);
+    for (int k = 0; k < KERNEL_FLOAT_LANES; k++) {
+        sum_x += lx[k];
+        sum_y += ly[k];
+    }
+#elif defined(__SSE2__)
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    __m128 lanes_x = zero, lanes_y = zero;
+    for (; j + KERNEL_FLOAT_LANES <= j_end; j += KERNEL_FLOAT_LANES) {
+        __m128 dx = _mm_sub_ps(_mm_loadu_ps(&x[j]), _mm_set1_ps(xi));
+        __m128 dy = _mm_sub_ps(_mm_loadu_ps(&y[j]), _mm_set1_ps(yi));
+        __m128 d2 = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+        __m128 inv_d = _mm_div_ps(one, _mm_sqrt_ps(d2));
+        inv_d = _mm_and_ps(inv_d, _mm_cmpgt_ps(d2, zero));
+        __m128 w = _mm_mul_ps(_mm_mul_ps(inv_d, inv_d), inv_d);
+        __m128 wi = _mm_mul_ps(w, _mm_loadu_ps(&mass[j]));
+        __m128 wj = _mm_mul_ps(w, _mm_set1_ps(mi));
+        lanes_x = _mm_add_ps(lanes_x, _mm_mul_ps(wi, dx));
+        lanes_y = _mm_add_ps(lanes_y, _mm_mul_ps(wi, dy));
+        float *jx = &acc_jx[j - j_base];
+        float *jy = &acc_jy[j - j_base];
+        _mm_storeu_ps(jx, _mm_sub_ps(_mm_loadu_ps(jx), _mm_mul_ps(wj, dx)));
+        _mm_storeu_ps(jy, _mm_sub_ps(_mm_loadu_ps(jy), _mm_mul_ps(wj, dy)));
+    }
+    float lx[KERNEL_FLOAT_LANES], ly[KERNEL_FLOAT_LANES];
+    _mm_storeu_ps(lx, lanes_x);
+    _mm_storeu_ps(ly, lanes_y);
+    for (int k = 0; k < KERNEL_FLOAT_LANES; k++) {
+        sum_x += lx[k];
+        sum_y += ly[k];
+    }
+#endif
+
+    for (; j < j_end; j++) {
+        float dx = x[j] - xi;
+        float dy = y[j] - yi;
+        float d2 = dx * dx + dy * dy;
+        float inv_d = (d2 > 0) ? 1 / sqrtf(d2) : 0;
+        float w = inv_d * inv_d * inv_d;
+        sum_x += w * mass[j] * dx;
+        sum_y += w * mass[j] * dy;
+        acc_jx[j - j_base] -= w * mi * dx;
+        acc_jy[j - j_base] -= w * mi * dy;
+    }
+
+    *acc_ix += sum_x;
+    *acc_iy += sum_y;
+}
+#else
+// Body i against bodies [j_begin, j_end), computing each pair once. Both
+// sides go into tile scratch: acc_i for body i, acc_j[j - j_base] for j.
+// Weights are 1/|d|^3, masses and G are applied when the pair is split.
+static void pair_row(const tile_job *job, int i, double xi, double yi, int j_begin, int j_end, int j_base,
+                     double *acc_ix, double *acc_iy, double *acc_jx, double *acc_jy) {
+    const double *x = job->x;
+    const double *y = job->y;
+    const double *mass = job->mass;
+    double mi = mass[i];
+    double sum_x = 0, sum_y = 0;
+    int j = j_begin;
+
+#if defined(__AVX__)
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d one = _mm256_set1_pd(1.0);
+    __m256d lanes_x = zero, lanes_y = zero;
+    for (; j + KERNEL_LANES <= j_end; j += KERNEL_LANES) {
+        __m256d dx = _mm256_sub_pd(_mm256_loadu_pd(&x[j]), _mm256_set1_pd(xi));
+        __m256d dy = _mm256_sub_pd(_mm256_loadu_pd(&y[j]), _mm256_set1_pd(yi));
+        __m256d d2 = _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy));
+        __m256d inv_d = _mm256_div_pd(one, _mm256_sqrt_pd(d2));
+        inv_d = _mm256_and_pd(inv_d, _mm256_cmp_pd(d2, zero, _CMP_GT_OQ));
+        __m256d w = _mm256_mul_pd(_mm256_mul_pd(inv_d, inv_d), inv_d);
+        __m256d wi = _mm256_mul_pd(w, _mm256_loadu_pd(&mass[j]));
+        __m256d wj = _mm256_mul_pd(w, _mm256_set1_pd(mi));
+        lanes_x = _mm256_add_pd(lanes_x, _mm256_mul_pd(wi, dx));
+        lanes_y = _mm256_add_pd(lanes_y, _mm256_mul_pd(wi, dy));
+        double *jx = &acc_jx[j - j_base];
+        double *jy = &acc_jy[j - j_base];
+        _mm256_storeu_pd(jx, _mm256_sub_pd(_mm256_loadu_pd(jx), _mm256_mul_pd(wj, dx)));
+        _mm256_storeu_pd(jy, _mm256_sub_pd(_mm256_loadu_pd(jy), _mm256_mul_pd(wj, dy)));
+    }
+    double lx[KERNEL_LANES], ly[KERNEL_LANES];
+    _mm256_storeu_pd(lx, lanes_x);
+    _mm256_storeu_pd(ly, lanes_y);
+    for (int k = 0; k < KERNEL_LANES; k++) {
+        sum_x += lx[k];
+        sum_y += ly[k];
+    }
+#elif defined(__SSE2__)
+    const __m128d zero = _mm_setzero_pd();
+    const __m128d one = _mm_set1_pd(1.0);
+    __m128d lanes_x = zero, lanes_y = zero;
+    for (; j + KERNEL_LANES <= j_end; j += KERNEL_LANES) {
+        __m128d dx = _mm_sub_pd(_mm_loadu_pd(&x[j]), _mm_set1_pd(xi));
+        __m128d dy = _mm_sub_pd(_mm_loadu_pd(&y[j]), _mm_set1_pd(yi));
+        __m128d d2 = _mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy));
+        __m128d inv_d = _mm_div_pd(one, _mm_sqrt_pd(d2));
+        inv_d = _mm_and_pd(inv_d, _mm_cmpgt_pd(d2, zero));
+        __m128d w = _mm_mul_pd(_mm_mul_pd(inv_d, inv_d), inv_d);
+        __m128d wi = _mm_mul_pd(w, _mm_loadu_pd(&mass[j]));
+        __m128d wj = _mm_mul_pd(w, _mm_set1_pd(mi));
+        lanes_x = _mm_add_pd(lanes_x, _mm_mul_pd(wi, dx));
+        lanes_y = _mm_add_pd(lanes_y, _mm_mul_pd(wi, dy));
+        double *jx = &acc_jx[j - j_base];
+        double *jy = &acc_jy[j - j_base];
+        _mm_storeu_pd(jx, _mm_sub_pd(_mm_loadu_pd(jx), _mm_mul_pd(wj, dx)));
+        _mm_storeu_pd(jy, _mm_sub_pd(_mm_loadu_pd(jy), _mm_mul_pd(wj, dy)));
+    }
+    double lx[KERNEL_LANES], ly[KERNEL_LANES];
+    _mm_storeu_pd(lx, lanes_x);
+    _mm_storeu_pd(ly, lanes_y);
+    for (int k = 0; k < KERNEL_LANES; k++) {
+        sum_x += lx[k];
+        sum_y += ly[k];
+    }
+#endif
+
+    for (; j < j_end; j++) {
+        double dx = x[j] - xi;
+        double dy = y[j] - yi;
+        double d2 = dx * dx + dy * dy;
+        double inv_d = (d2 > 0) ? 1 / sqrt(d2) : 0;
+        double w = inv_d * inv_d * inv_d;
+        sum_x += w * mass[j] * dx;
+        sum_y += w * mass[j] * dy;
+        acc_jx[j - j_base] -= w * mi * dx;
+        acc_jy[j - j_base] -= w * mi * dy;
+    }
+
+    *acc_ix += sum_x;
+    *acc_iy += sum_y;
+}
+#endif
+
+static void tile_bounds(const body_store *store, int tile, int *begin, int *end) {
+    *begin = tile * GRAVITY_TILE;
+    *end = (*begin + GRAVITY_TILE < store->count) ? *begin + GRAVITY_TILE : store->count;
+}
+
+#if defined(GRAVITY_FLOAT_TILES)
+// Float copy of one tile, positions relative to the centre of its bounding
+// box so they keep their precision however far the tile is from the origin
+static void tile_pack_task(void *context, int task, int thread) {
+    tile_job *job = context;
+    const body_store *store = job->store;
+    float *x = (float *)job->x;
+    float *y = (float *)job->y;
+    float *mass = (float *)job->mass;
+    int begin, end;
+    (void)thread;
+
+    tile_bounds(store, task, &begin, &end);
+    double min_x = store->x[begin], max_x = min_x;
+    double min_y = store->y[begin], max_y = min_y;
+    for (int i = begin + 1; i < end; i++) {
+        min_x = fmin(min_x, store->x[i]);
+        max_x = fmax(max_x, store->x[i]);
+        min_y = fmin(min_y, store->y[i]);
+        max_y = fmax(max_y, store->y[i]);
+    }
+    double centre_x = (min_x + max_x) / 2;
+    double centre_y = (min_y + max_y) / 2;
+    job->centreX[task] = centre_x;
+    job->centreY[task] = centre_y;
+    for (int i = begin; i < end; i++) {
+        x[i] = (float)(store->x[i] - centre_x);
+        y[i] = (float)(store->y[i] - centre_y);
+        mass[i] = (float)store->mass[i];
+    }
+}
+#endif
+
+// One tile pair. Contributions are summed in thread-local scratch first and
+// then added to the shared accumulators; no other task in the same round
+// touches either tile, so that add needs no lock.
+static void tile_pair_task(void *context, int task, int thread) {
+    tile_job *job = context;
+    body_store *store = job->store;
+    int a, b;
+    (void)thread;
+
+    if (job->round < 0) {
+        a = b = task;
+    } else {
+        // Circle method: the last slot stays put while the others rotate
+        int ring = job->slots - 1;
+        if (task == 0) {
+            a = job->round;
+            b = ring;
+        } else {
+            a = (job->round + task) % ring;
+            b = (job->round - task + ring) % ring;
+        }
+        if (a >= job->numTiles || b >= job->numTiles) {
+            return; //paired with the bye slot
+        }
+    }
+
+    tile_real acc_ax[GRAVITY_TILE] = {0}, acc_ay[GRAVITY_TILE] = {0};
+    tile_real acc_bx[GRAVITY_TILE] = {0}, acc_by[GRAVITY_TILE] = {0};
+    int a_begin, a_end, b_begin, b_end;
+    tile_bounds(store, a, &a_begin, &a_end);
+    tile_bounds(store, b, &b_begin, &b_end);
+    // Bodies of tile a are moved into the frame of tile b's centre
+    tile_real shift_x = 0, shift_y = 0;
+    if (job->centreX) {
+        shift_x = (tile_real)(job->centreX[b] - job->centreX[a]);
+        shift_y = (tile_real)(job->centreY[b] - job->centreY[a]);
+    }
+
+    if (a == b) {
+        for (int i = a_begin; i < a_end; i++) {
+            pair_row(job, i, job->x[i], job->y[i], i + 1, a_end, a_begin,
+                     &acc_ax[i - a_begin], &acc_ay[i - a_begin], acc_ax, acc_ay);
+        }
+    } else {
+        for (int i = a_begin; i < a_end; i++) {
+            pair_row(job, i, job->x[i] - shift_x, job->y[i] - shift_y, b_begin, b_end, b_begin,
+                     &acc_ax[i - a_begin], &acc_ay[i - a_begin], acc_bx, acc_by);
+        }
+    }
+
+    for (int i = a_begin; i < a_end; i++) {
+        store->ax[i] += acc_ax[i - a_begin];
+        store->ay[i] += acc_ay[i - a_begin];
+    }
+    if (a != b) {
+        for (int j = b_begin; j < b_end; j++) {
+            store->ax[j] += acc_bx[j - b_begin];
+            store->ay[j] += acc_by[j - b_begin];
+        }
+    }
+}
+
+void gravity_direct_parallel(body_store *store, thread_pool *pool) {
+    tile_job job;
+    job.store = store;
+    job.numTiles = (store->count + GRAVITY_TILE - 1) / GRAVITY_TILE;
+    job.slots = job.numTiles + (job.numTiles & 1);
+
+#if defined(GRAVITY_FLOAT_TILES)
+    float *packed = malloc(3 * (size_t)store->count * sizeof(float) + 1);
+    double *centres = malloc(2 * (size_t)job.numTiles * sizeof(double) + 1);
+    if (!packed || !centres) {
+        perror("Error allocating memory");
+        free(packed);
+        free(centres);
+        gravity_kernel(store, 0, store->count);
+        return;
+    }
+    job.x = packed;
+    job.y = packed + store->count;
+    job.mass = packed + 2 * (size_t)store->count;
+    job.centreX = centres;
+    job.centreY = centres + job.numTiles;
+    thread_pool_run(pool, job.numTiles, tile_pack_task, &job);
+#else
+    job.x = store->x;
+    job.y = store->y;
+    job.mass = store->mass;
+    job.centreX = job.centreY = NULL;
+#endif
+
+    for (int i = 0; i < store->count; i++) {
+        store->ax[i] = 0;
+        store->ay[i] = 0;
+    }
+
+    // Every tile is added to once per round, always in round order, so the
+    // summation order of each body is fixed no matter how many threads run
+    job.round = -1;
+    thread_pool_run(pool, job.numTiles, tile_pair_task, &job);
+    for (job.round = 0; job.round < job.slots - 1; job.round++) {
+        thread_pool_run(pool, job.slots / 2, tile_pair_task, &job);
+    }
+
+    for (int i = 0; i < store->count; i++) {
+        store->ax[i] *= GRAVITATIONAL_CONSTANT;
+        store->ay[i] *= GRAVITATIONAL_CONSTANT;
+    }
+#if defined(GRAVITY_FLOAT_TILES)
+    free(packed);
+    free(centres);
+#endif
+}
+
+typedef struct {
+    body_store *store;
+    const quadtree *tree;
+    double theta;
+} barnes_hut_job;
+
+#define BARNES_HUT_CHUNK 1024 //bodies per task
+
+static void barnes_hut_task(void *context, int task, int thread) {
+    barnes_hut_job *job = context;
+    body_store *store = job->store;
+    int end = (task + 1) * BARNES_HUT_CHUNK;
+    if (end > store->count) {
+        end = store->count;
+    }
+    (void)thread;
+
+    for (int i = task * BARNES_HUT_CHUNK; i < end; i++) {
+        if (store->isAlive[i]) {
+            vector acceleration = quadtree_acceleration(job->tree, store->x[i], store->y[i], i, job->theta);
+            store->ax[i] = acceleration.x;
+            store->ay[i] = acceleration.y;
+        }
+    }
+}
+
+void gravity_barnes_hut(body_store *store, const quadtree *tree, double theta, thread_pool *pool) {
+    barnes_hut_job job = {store, tree, theta};
+    thread_pool_run(pool, (store->count + BARNES_HUT_CHUNK - 1) / BARNES_HUT_CHUNK, barnes_hut_task, &job);
+}
+
+typedef struct {
+    body_store *store;
+    const quadtree *tree; //NULL for the exact direct sum
+    double theta;
+    const int *targets;
+    int count;
+} targets_job;
+
+static void targets_task(void *context, int task, int thread) {
+    targets_job *job = context;
+    body_store *store = job->store;
+    int end = (task + 1) * BARNES_HUT_CHUNK;
+    if (end > job->count) {
+        end = job->count;
+    }
+    (void)thread;
+
+    for (int k = task * BARNES_HUT_CHUNK; k < end; k++) {
+        int i = job->targets[k];
+        if (!job->tree) {
+            kernel_scalar(store, i);
+        } else if (store->isAlive[i]) {
+            vector acceleration = quadtree_acceleration(job->tree, store->x[i], store->y[i], i, job->theta);
+            store->ax[i] = acceleration.x;
+            store->ay[i] = acceleration.y;
+        }
+    }
+}
+
+void gravity_targets(body_store *store, const quadtree *tree, double theta,
+                     const int *targets, int count, thread_pool *pool) {
+    targets_job job = {store, tree, theta, targets, count};
+    thread_pool_run(pool, (count + BARNES_HUT_CHUNK - 1) / BARNES_HUT_CHUNK, targets_task, &job);
+}
+
+typedef struct {
+    const body_store *store;
+    const quadtree *tree;
+    double theta;
+    double *partial;     //one sum per task
+} potential_job;
+
+static void potential_task(void *context, int task, int thread) {
+    potential_job *job = context;
+    const body_store *store = job->store;
+    int end = (task + 1) * BARNES_HUT_CHUNK;
+    if (end > store->count) {
+        end = store->count;
+    }
+    (void)thread;
+
+    double sum = 0;
+    for (int i = task * BARNES_HUT_CHUNK; i < end; i++) {
+        if (!store->isAlive[i]) {
+            continue;
+        }
+        double potential = 0;
+        if (job->tree) {
+            potential = quadtree_potential(job->tree, store->x[i], store->y[i], i, job->theta);
+        } else {
+            for (int j = 0; j < store->count; j++) {
+                double dx = store->x[j] - store->x[i];
+                double dy = store->y[j] - store->y[i];
+                double d2 = dx * dx + dy * dy;
+                if (store->isAlive[j] && d2 > 0) {
+                    potential -= GRAVITATIONAL_CONSTANT * store->mass[j] / sqrt(d2);
+                }
+            }
+        }
+        sum += store->mass[i] * potential;
+    }
+    job->partial[task] = sum;
+}
+
+double gravity_potential_energy(const body_store *store, const quadtree *tree, double theta, thread_pool *pool) {
+    int numTasks = (store->count + BARNES_HUT_CHUNK - 1) / BARNES_HUT_CHUNK;
+    potential_job job = {store, tree, theta, calloc(numTasks + 1, sizeof(double))};
+    if (!job.partial) {
+        perror("Error allocating memory");
+        return NAN;
+    }
+    thread_pool_run(pool, numTasks, potential_task, &job);
+    double energy = 0;
+    for (int task = 0; task < numTasks; task++) {
+        energy += job.partial[task];
+    }
+    free(job.partial);
+    return energy / 2; //every pair was counted from both ends
+}
+
+vector trig_acceleration(const body_store *store, int self) {
+    vector acceleration = {0, 0};
+    for (int j = 0; j < store->count; j++) {
+        if (j == self || !store->isAlive[j]) {
+            continue;
+        }
+        double distance = sqrt(pow(store->x[self] - store->x[j], 2) + pow(store->y[self] - store->y[j], 2));
+        if (distance == 0) {
+            continue; //infinite force, the kernel masks these pairs out
+        }
+        double force = 6.674 * pow(10,-11) * store->mass[self] * store->mass[j] / pow(distance,2);
+        double angle = atan2(store->y[j] - store->y[self], store->x[j] - store->x[self]);
+        acceleration.x += force * cos(angle) / store->mass[self];
+        acceleration.y += force * sin(angle) / store->mass[self];
+    }
+    return acceleration;
+}
+
+void gravity_compare(const body_store *store, const real *ax, const real *ay,
+                     const double *ref_x, const double *ref_y,
+                     double *mean_error, double *max_error) {
+    double sum = 0, rms = 0;
+    int count = 0;
+    for (int i = 0; i < store->count; i++) {
+        if (store->isAlive[i]) {
+            rms += ref_x[i] * ref_x[i] + ref_y[i] * ref_y[i];
+            count++;
+        }
+    }
+    rms = (count > 0) ? sqrt(rms / count) : 0;
+
+    count = 0;
+    *max_error = 0;
+    for (int i = 0; i < store->count; i++) {
+        if (!store->isAlive[i]) {
+            continue;
+        }
+        double magnitude = sqrt(ref_x[i] * ref_x[i] + ref_y[i] * ref_y[i]);
+        if (magnitude == 0 || magnitude < 1e-6 * rms) {
+            continue; //net force cancelled out, relative error would only measure roundoff
+        }
+        double error = sqrt(pow(ax[i] - ref_x[i], 2) + pow(ay[i] - ref_y[i], 2)) / magnitude;
+        sum += error;
+        count++;
+        if (error > *max_error) {
+            *max_error = error;
+        }
+    }
+    *mean_error = (count > 0) ? sum / count : 0;
+}
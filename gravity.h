@@ -0,0 +1,71 @@
+#ifndef GRAVITY_H
+#define GRAVITY_H
+
+#include "body.h"
+#include "quadtree.h"
+#include "thread_pool.h"
+
+typedef enum {
+    GRAVITY_DIRECT,         //reference O(N^2) pair loop
+    GRAVITY_BARNES_HUT,     //quadtree approximation, O(N log N)
+    GRAVITY_PARTICLE_MESH,  //FFT on a mesh, O(N + M^2 log M), nothing finer than a cell
+    GRAVITY_P3M,            //particle mesh plus exact short-range pairs
+    GRAVITY_MODE_COUNT
+} gravity_mode;
+
+// Relative error the SIMD kernel is allowed against trig_acceleration. The
+// kernel computes G*m*d/|d|^3 with an exact 1/sqrt instead of atan2/cos/sin,
+// so each pair agrees to a few ulp. Worst summed error seen is 1.2e-13 on 10k
+// random bodies and 2.5e-16 on bodies.txt (measured with gravity_compare).
+#define GRAVITY_KERNEL_TOLERANCE 1e-12
+
+const char *gravity_mode_name(gravity_mode mode);
+
+// Exact direct-sum acceleration for bodies [begin, end) against every body in
+// the store, written to store->ax/ay. All bodies in the store are treated as
+// sources, so dead ones must be removed first. Coincident pairs (including a
+// body with itself) are masked out rather than branched around. Uses AVX or
+// SSE2 when the compiler targets them, with a scalar fallback.
+void gravity_kernel(body_store *store, int begin, int end);
+
+#define GRAVITY_TILE 256 //bodies per tile, two tiles of x/y/mass/scratch fit in L1
+
+// Direct sum over each pair once (Newton's third law), split into tiles and
+// run on the pool. Tile pairs are scheduled as a round-robin tournament so no
+// two tasks in a round share a tile, and each body's contributions are added
+// in round order: the result is bit-identical for any thread count. Same
+// tolerance against trig_acceleration as gravity_kernel in double builds.
+// Float and mixed builds compute the pairs in float on positions relative to
+// each tile's centre, which puts the mean error near 1e-5 (7e-6 on a 10k
+// body disk, see bench_precision). pool may be NULL.
+void gravity_direct_parallel(body_store *store, thread_pool *pool);
+
+// Barnes-Hut accelerations for every living body, written to store->ax/ay.
+// Bodies are independent, the pool only splits them into chunks.
+void gravity_barnes_hut(body_store *store, const quadtree *tree, double theta, thread_pool *pool);
+
+// Accelerations of the `count` bodies listed in `targets` only, against every
+// body: from the tree when there is one, by the exact direct sum (one target
+// at a time, no pair sharing) when tree is NULL. ax/ay of everything else
+// is left alone.
+void gravity_targets(body_store *store, const quadtree *tree, double theta,
+                     const int *targets, int count, thread_pool *pool);
+
+// Total potential energy -G * sum over pairs of m_i m_j / d_ij of the living
+// bodies. Exact when tree is NULL, otherwise from quadtree_potential with
+// `theta` (the tree must be built for the current positions). Partial sums
+// are added in a fixed order, so the result does not depend on the pool size.
+double gravity_potential_energy(const body_store *store, const quadtree *tree, double theta, thread_pool *pool);
+
+// Acceleration on body `self` using the original calculate_gravity math
+// (pow, atan2, cos and sin per pair), kept as the accuracy reference
+vector trig_acceleration(const body_store *store, int self);
+
+// Relative error of (ax, ay) against (ref_x, ref_y) over the living bodies.
+// Bodies whose reference acceleration has cancelled to under 1e-6 of the RMS
+// (e.g. the centre of a symmetric system) are left out of the statistics.
+void gravity_compare(const body_store *store, const real *ax, const real *ay,
+                     const double *ref_x, const double *ref_y,
+                     double *mean_error, double *max_error);
+
+#endif
@@ -0,0 +1,138 @@
+#define _POSIX_C_SOURCE 200112L //shm_open, mmap
+#include "live.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const size_t field_size[LIVE_FIELDS] = {
+    sizeof(double), sizeof(double), sizeof(double), sizeof(double),
+    sizeof(double), sizeof(double), 4 * sizeof(uint8_t), sizeof(int32_t)
+};
+
+static uint64_t align_up(uint64_t offset) {
+    return (offset + LIVE_ALIGNMENT - 1) / LIVE_ALIGNMENT * LIVE_ALIGNMENT;
+}
+
+void live_layout(live_header *header, uint32_t capacity) {
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, LIVE_MAGIC, sizeof(header->magic));
+    header->version = LIVE_VERSION;
+    header->byteOrder = LIVE_BYTE_ORDER;
+    header->capacity = capacity;
+    header->latest = UINT64_MAX;
+
+    uint64_t offset = align_up(sizeof(live_buffer));
+    for (int f = 0; f < LIVE_FIELDS; f++) {
+        header->fields[f] = offset;
+        offset = align_up(offset + field_size[f] * capacity);
+    }
+    uint64_t bufferSize = offset;
+    header->buffers[0] = align_up(sizeof(live_header));
+    header->buffers[1] = header->buffers[0] + bufferSize;
+    header->size = header->buffers[1] + bufferSize;
+}
+
+int live_attach(live_reader *r, const char *name) {
+    memset(r, 0, sizeof(*r));
+    if (snprintf(r->name, sizeof(r->name), "%s", name) >= (int)sizeof(r->name)) {
+        printf("Live state name too long: %s\n", name);
+        return -1;
+    }
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        return -1; //not created yet, or the writer is gone
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(live_header)) {
+        close(fd);
+        return -1;
+    }
+    void *mapping = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); //the mapping keeps the segment open
+    if (mapping == MAP_FAILED) {
+        perror("Error mapping live state");
+        return -1;
+    }
+    r->mapping = mapping;
+    r->size = st.st_size;
+
+    // The layout is fixed once the writer has sized the segment
+    const live_header *h = mapping;
+    static const char unset[sizeof(h->magic)];
+    if (memcmp(h->magic, unset, sizeof(unset)) == 0) {
+        live_detach(r);
+        return -1; //created but the writer has not filled in the header yet
+    }
+    live_header expected;
+    live_layout(&expected, h->capacity);
+    if (memcmp(h->magic, LIVE_MAGIC, sizeof(h->magic)) != 0 || h->version != LIVE_VERSION ||
+        h->byteOrder != LIVE_BYTE_ORDER || h->size != expected.size || h->size > r->size ||
+        memcmp(h->buffers, expected.buffers, sizeof(h->buffers)) != 0 ||
+        memcmp(h->fields, expected.fields, sizeof(h->fields)) != 0) {
+        printf("%s is not a live state segment this reader understands\n", name);
+        live_detach(r);
+        return -1;
+    }
+    return 0;
+}
+
+void live_detach(live_reader *r) {
+    if (r->mapping) {
+        munmap(r->mapping, r->size);
+    }
+    r->mapping = NULL;
+    r->size = 0;
+}
+
+int live_begin(live_reader *r, live_frame *frame) {
+    if (!r->mapping) {
+        return -1;
+    }
+    uint32_t stale = __atomic_load_n(&((const live_header *)r->mapping)->stale, __ATOMIC_ACQUIRE);
+    if (stale != LIVE_CURRENT) {
+        // Keep the old mapping until the new segment is there
+        live_reader next;
+        if (live_attach(&next, r->name) != 0) {
+            return (stale == LIVE_REPLACED) ? 1 : -1;
+        }
+        live_detach(r);
+        *r = next;
+    }
+    const live_header *h = r->mapping;
+    uint64_t latest = __atomic_load_n(&h->latest, __ATOMIC_ACQUIRE);
+    if (latest > 1) {
+        return 1;
+    }
+    const char *base = (const char *)r->mapping + h->buffers[latest];
+    const live_buffer *b = (const live_buffer *)base;
+    uint64_t sequence = __atomic_load_n(&b->sequence, __ATOMIC_ACQUIRE);
+    if (sequence & 1) {
+        return 1; //the writer lapped the reader and is filling this one again
+    }
+    memset(frame, 0, sizeof(*frame));
+    frame->buffer = (int)latest;
+    frame->sequence = sequence;
+    frame->steps = b->steps;
+    frame->dt = b->dt;
+    frame->count = (b->count <= h->capacity) ? (int)b->count : 0;
+    frame->x = (const double *)(base + h->fields[LIVE_X]);
+    frame->y = (const double *)(base + h->fields[LIVE_Y]);
+    frame->vx = (const double *)(base + h->fields[LIVE_VX]);
+    frame->vy = (const double *)(base + h->fields[LIVE_VY]);
+    frame->mass = (const double *)(base + h->fields[LIVE_MASS]);
+    frame->radius = (const double *)(base + h->fields[LIVE_RADIUS]);
+    frame->color = (const uint8_t *)(base + h->fields[LIVE_COLOR]);
+    frame->id = (const int32_t *)(base + h->fields[LIVE_ID]);
+    return 0;
+}
+
+bool live_end(const live_reader *r, const live_frame *frame) {
+    const live_header *h = r->mapping;
+    const live_buffer *b = (const live_buffer *)((const char *)r->mapping + h->buffers[frame->buffer]);
+    // Every read of the frame happens before the sequence is checked again
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&b->sequence, __ATOMIC_RELAXED) == frame->sequence;
+}
@@ -0,0 +1,105 @@
+#ifndef LIVE_H
+#define LIVE_H
+
+// Layout of the live state segment and the reader side, which is plain C and
+// POSIX so outside tools can link it without SDL or the rest of the physics.
+//
+// The segment is a POSIX shared-memory object holding a header and two
+// buffers of body arrays. The simulation fills the buffer the header does
+// not point at, then points the header at it, so a reader always has at
+// least a whole step to look at the latest one. Each buffer carries a
+// sequence number that is odd while it is being written (a seqlock): a
+// reader notes it, reads the arrays in place and checks that it did not
+// change. Nothing ever waits for a reader.
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define LIVE_MAGIC "GRAVLIVE"
+#define LIVE_VERSION 1
+#define LIVE_BYTE_ORDER 0x01020304u
+#define LIVE_ALIGNMENT 64
+#define LIVE_DEFAULT_NAME "/gravity"
+#define LIVE_MIN_CAPACITY 4096 //bodies, the segment is replaced by a bigger one when they do not fit
+
+// Values of live_header.stale
+#define LIVE_CURRENT 0
+#define LIVE_REPLACED 1 //a bigger segment is taking this one's name
+#define LIVE_CLOSED 2   //the simulation stopped publishing
+
+// Arrays in each buffer, same types as the snapshot fields
+enum {
+    LIVE_X,       //double[count]
+    LIVE_Y,       //double[count]
+    LIVE_VX,      //double[count]
+    LIVE_VY,      //double[count]
+    LIVE_MASS,    //double[count]
+    LIVE_RADIUS,  //double[count]
+    LIVE_COLOR,   //uint8_t[4 * count], r g b a
+    LIVE_ID,      //int32_t[count], stable body ids
+    LIVE_FIELDS
+};
+
+// Start of each buffer
+typedef struct {
+    uint64_t sequence;   //odd while the writer is filling the buffer
+    uint64_t steps;      //simulation step the buffer holds
+    double dt;           //ticks per step
+    uint32_t count;      //bodies in the buffer
+    uint32_t reserved;
+} live_buffer;
+
+// Start of the segment. Only `latest`, `published` and `stale` change after
+// the writer creates it.
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t capacity;                  //bodies each buffer can hold
+    uint32_t stale;                     //LIVE_CURRENT, LIVE_REPLACED or LIVE_CLOSED
+    uint64_t latest;                    //buffer holding the newest complete step, UINT64_MAX before the first
+    uint64_t published;                 //steps published so far
+    uint64_t size;                      //bytes in the segment
+    uint64_t buffers[2];                //byte offset of each buffer from the start of the segment
+    uint64_t fields[LIVE_FIELDS];       //byte offset of each array from the start of its buffer
+} live_header;
+
+// Fill in the layout of a segment for `capacity` bodies
+void live_layout(live_header *header, uint32_t capacity);
+
+typedef struct {
+    char name[256];
+    void *mapping;
+    size_t size;
+} live_reader;
+
+// One published step, pointing straight into the segment. Only valid until
+// live_end says otherwise.
+typedef struct {
+    uint64_t steps;
+    double dt;
+    int count;
+    const double *x, *y;
+    const double *vx, *vy;
+    const double *mass;
+    const double *radius;
+    const uint8_t *color;
+    const int32_t *id;
+    int buffer;
+    uint64_t sequence;
+} live_frame;
+
+// Map the segment `name` read-only. Returns -1 if there is none (yet).
+int live_attach(live_reader *r, const char *name);
+void live_detach(live_reader *r);
+
+// Point `frame` at the newest complete step. Returns 0 on success, 1 if
+// nothing is published yet or the buffer is being rewritten (try again),
+// and -1 if the writer is gone. Follows the writer to a bigger segment by
+// itself.
+int live_begin(live_reader *r, live_frame *frame);
+// After reading: true if the writer did not touch the frame meanwhile. On
+// false everything read since live_begin may be torn and must be dropped.
+bool live_end(const live_reader *r, const live_frame *frame);
+
+#endif
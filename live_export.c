@@ -0,0 +1,138 @@
+#define _POSIX_C_SOURCE 200112L //shm_open, ftruncate
+#include "live_export.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+struct live_export {
+    char name[256];
+    live_header *header;  //start of the mapping
+    size_t size;
+};
+
+// Replace the segment with an empty one that holds `capacity` bodies
+static int live_export_create(live_export *e, uint32_t capacity) {
+    if (e->header) {
+        __atomic_store_n(&e->header->stale, LIVE_REPLACED, __ATOMIC_RELEASE);
+        munmap(e->header, e->size);
+        e->header = NULL;
+    }
+    shm_unlink(e->name);
+    int fd = shm_open(e->name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        perror("Error creating live state");
+        return -1;
+    }
+    live_header layout;
+    live_layout(&layout, capacity);
+    if (ftruncate(fd, layout.size) != 0) {
+        perror("Error sizing live state");
+        close(fd);
+        shm_unlink(e->name);
+        return -1;
+    }
+    void *mapping = mmap(NULL, layout.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        perror("Error mapping live state");
+        shm_unlink(e->name);
+        return -1;
+    }
+    // Readers take a zero magic for a segment still being set up, so it goes in last
+    char magic[sizeof(layout.magic)];
+    memcpy(magic, layout.magic, sizeof(magic));
+    memset(layout.magic, 0, sizeof(layout.magic));
+    memcpy(mapping, &layout, sizeof(layout));
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(((live_header *)mapping)->magic, magic, sizeof(magic));
+    e->header = mapping;
+    e->size = layout.size;
+    return 0;
+}
+
+live_export *live_export_open(const char *name) {
+    live_export *e = calloc(1, sizeof(live_export));
+    if (!e) {
+        perror("Error allocating memory");
+        return NULL;
+    }
+    if (snprintf(e->name, sizeof(e->name), "%s", name) >= (int)sizeof(e->name) ||
+        live_export_create(e, LIVE_MIN_CAPACITY) != 0) {
+        printf("Could not export the live state as %s\n", name);
+        free(e);
+        return NULL;
+    }
+    printf("live state exported as %s\n", name);
+    return e;
+}
+
+int live_export_publish(live_export *e, const body_store *store, const body_store *cold, long steps, double dt) {
+    int alive = 0;
+    for (const body_store *from = store; from; from = (from == store) ? cold : NULL) {
+        for (int i = 0; i < from->count; i++) {
+            alive += from->isAlive[i];
+        }
+    }
+    if ((uint32_t)alive > e->header->capacity && live_export_create(e, 2 * (uint32_t)alive) != 0) {
+        return -1;
+    }
+
+    live_header *h = e->header;
+    uint64_t latest = __atomic_load_n(&h->latest, __ATOMIC_RELAXED);
+    int target = (latest == 0) ? 1 : 0;
+    char *base = (char *)h + h->buffers[target];
+    live_buffer *b = (live_buffer *)base;
+
+    // Seqlock write: odd sequence, the data, then the next even one
+    uint64_t sequence = b->sequence;
+    __atomic_store_n(&b->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    double *x = (double *)(base + h->fields[LIVE_X]);
+    double *y = (double *)(base + h->fields[LIVE_Y]);
+    double *vx = (double *)(base + h->fields[LIVE_VX]);
+    double *vy = (double *)(base + h->fields[LIVE_VY]);
+    double *mass = (double *)(base + h->fields[LIVE_MASS]);
+    double *radius = (double *)(base + h->fields[LIVE_RADIUS]);
+    uint8_t *color = (uint8_t *)(base + h->fields[LIVE_COLOR]);
+    int32_t *id = (int32_t *)(base + h->fields[LIVE_ID]);
+    int k = 0;
+    for (const body_store *from = store; from; from = (from == store) ? cold : NULL) {
+        for (int i = 0; i < from->count; i++) {
+            if (!from->isAlive[i]) {
+                continue;
+            }
+            x[k] = from->x[i];
+            y[k] = from->y[i];
+            vx[k] = from->vx[i];
+            vy[k] = from->vy[i];
+            mass[k] = from->mass[i];
+            radius[k] = from->radius[i];
+            memcpy(&color[4 * k], &from->color[i], 4);
+            id[k] = from->id[i];
+            k++;
+        }
+    }
+    b->steps = steps;
+    b->dt = dt;
+    b->count = alive;
+    __atomic_store_n(&b->sequence, sequence + 2, __ATOMIC_RELEASE);
+
+    __atomic_store_n(&h->latest, (uint64_t)target, __ATOMIC_RELEASE);
+    __atomic_store_n(&h->published, h->published + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void live_export_close(live_export *e) {
+    if (!e) {
+        return;
+    }
+    if (e->header) {
+        __atomic_store_n(&e->header->stale, LIVE_CLOSED, __ATOMIC_RELEASE);
+        munmap(e->header, e->size);
+    }
+    shm_unlink(e->name);
+    free(e);
+}
@@ -0,0 +1,21 @@
+#ifndef LIVE_EXPORT_H
+#define LIVE_EXPORT_H
+
+#include "body.h"
+#include "live.h"
+
+// Writer side of the live state segment (see live.h). The simulation
+// publishes every completed step; readers never slow it down.
+typedef struct live_export live_export;
+
+// Create the shared-memory segment `name` (e.g. LIVE_DEFAULT_NAME), replacing
+// one a previous run left behind
+live_export *live_export_open(const char *name);
+// Copy the living bodies of the store and of `cold` (the far-field tier, may
+// be NULL) into the buffer readers are not pointed at, then point them at
+// it. Moves to a bigger segment when the bodies do not fit.
+int live_export_publish(live_export *e, const body_store *store, const body_store *cold, long steps, double dt);
+// Mark the segment stale and remove its name; mapped readers keep their view
+void live_export_close(live_export *e);
+
+#endif
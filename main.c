@@ -8,6 +8,21 @@
 #define M_PI 3.14159265358979323846
 #endif
 #include <time.h>
+#include <string.h>
+#include "body.h"
+#include "quadtree.h"
+#include "gravity.h"
+#include "sim.h"
+#include "density.h"
+#include "frame_export.h"
+#include "live_export.h"
+#include "recorder.h"
+#include "render.h"
+#include "sim_thread.h"
+#include "preview.h"
+#include "profile.h"
+#include "cluster.h"
+#include "scenario.h"
 const SDL_Color RED = {255,0,0,255};
 const SDL_Color GREEN = {0,255,0,255};
 const SDL_Color BLUE = {0,0,255,255};
@@ -22,88 +37,6 @@ const SDL_Color PINK = {255,192,203,255};
 const int WIDTH = 1920; //640
 const int HEIGHT = 1080; //
 
-// Structure to represent a 2D vector
-typedef struct  {
-    double x;
-    double y;
-} vector;
-
-
-//int *numbodies_ptr, double x, double y, int radius, double Xspeed, double Yspeed,double mass, SDL_Color color
-typedef struct { //body structure
-    bool isAlive;
-    double x,y; //position of the body
-    double radius; //radius of the body
-    double Xspeed, Yspeed; //speed of the body
-    double mass;   //mass of the body
-
-    SDL_Color color;
-
-}body;
-
-body* loadBodiesFromFile(const char *filename, int *numBodies, int *capacity) {
-    FILE *file = fopen(filename, "r");
-    if (!file) {
-        perror("Error opening file");
-        return NULL; // Return NULL on failure
-    }
-    
-    body *bodies = NULL;   // Start with no bodies, initial size is 0
-    *numBodies = 0;        // initial number of bodies in file is 0
-    char line[256];        // Buffer to hold a line from the file
-           // How many elements the array can hold currently
-    
-    
-    while (fgets(line, sizeof(line), file) != NULL) {
-        
-       
-        bool isAlive = true;
-        double radius, Xspeed, Yspeed, x, y, mass;
-        Uint8 r, g, b, a;
-        
-        // Parse each line
-        int itemsRead = sscanf(line, "%lf %lf %lf %lf %lf %lf  %hhu %hhu %hhu %hhu",
-                                    &x, &y, &radius, &Xspeed, &Yspeed, &mass, &r, &g, &b, &a);
-        printf("line read: %s\n", line);
-       if(itemsRead != 10) {
-           printf("Error parsing line: %s\n", line);
-           continue; // skip to the next line
-       }
-       
-       if(*capacity == *numBodies){
-           // Reallocate when buffer is full
-           *capacity = (*capacity == 0) ? 1 : *capacity * 2; // Grow capacity by factor of two if initial capacity is 0 or double the existing capacity
-           bodies = realloc(bodies, *capacity * sizeof(body)); // Reallocate the memory buffer
-           if(!bodies){
-               perror("Error reallocating memory");
-               fclose(file);
-               return NULL; // Return NULL if realloc fails
-           }
-       }
-
-       
-       // Create a new body
-       body newBody;
-       newBody.isAlive = isAlive;
-       newBody.radius = radius;
-       newBody.Xspeed = Xspeed;
-       newBody.Yspeed = Yspeed;
-       newBody.x = x;
-       newBody.y = y;
-       newBody.mass = mass;
-       newBody.color.r = r;
-       newBody.color.g = g;
-       newBody.color.b = b;
-       newBody.color.a = a;
-        
-        bodies[*numBodies] = newBody; // add the newly created body to the buffer
-        (*numBodies)++; // Increment the count of bodies
-    }
-    
-    fclose(file); // close the file after it is done being read
-    return bodies; // return the array of bodies
-}
-
 // Function to calculate the dot product of two vectors
 double dot_product(vector v1, vector v2) {
     return v1.x * v2.x + v1.y * v2.y;
@@ -228,131 +161,11 @@ int calculate_vector_collision(body *body1, body *body2) {
     return 0; // Indicate success
 }
 
-int absorb_body(body **bodies, int *numBodies, int *capacity, int index1, int index2) {
-    body *b1 = &(*bodies)[index1];
-    body *b2 = &(*bodies)[index2];
-
-    double new_mass = b1->mass + b2->mass;
-    SDL_Color new_color;
-    new_color.r = (b1->color.r + b2->color.r) / 2;
-    new_color.g = (b1->color.g + b2->color.g) / 2;
-    new_color.b = (b1->color.b + b2->color.b) / 2;
-    new_color.a = (b1->color.a + b2->color.a) / 2;
-    double new_radius = sqrt(pow(b1->radius, 2) + pow(b2->radius, 2));
-    double new_x = (b1->x * b1->mass + b2->x * b2->mass) / new_mass;
-    double new_y = (b1->y * b1->mass + b2->y * b2->mass) / new_mass;
-    double new_Xspeed = (b1->Xspeed * b1->mass + b2->Xspeed * b2->mass) / new_mass;
-    double new_Yspeed = (b1->Yspeed * b1->mass + b2->Yspeed * b2->mass) / new_mass;
-
-    if (b1->mass > b2->mass) {
-        b1->mass = new_mass;
-        b1->radius = new_radius;
-        b1->color = new_color;
-        b1->x = new_x;
-        b1->y = new_y;
-        b1->Xspeed = new_Xspeed;
-        b1->Yspeed = new_Yspeed;
-    } else {
-        b2->mass = new_mass;
-        b2->radius = new_radius;
-        b2->color = new_color;
-        b2->x = new_x;
-        b2->y = new_y;
-        b2->Xspeed = new_Xspeed;
-        b2->Yspeed = new_Yspeed;
-    }
-
-    // Remove the absorbed body from memory
-    int absorbedIndex = (b1->mass > b2->mass) ? index2 : index1;
-    for (int i = absorbedIndex; i < *numBodies - 1; i++) {
-        (*bodies)[i] = (*bodies)[i + 1];
-    }
-    (*numBodies)--;
-
-    // Reallocate memory to shrink the array
-    *bodies = realloc(*bodies, (*capacity) * sizeof(body));
-    if (!*bodies && *numBodies > 0) {
-        perror("Error reallocating memory");
-        return -1; // Return -1 if realloc fails
-    }
-
-    return 0;
-}
-
 void set_color(SDL_Renderer *renderer, SDL_Color color){
     SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b, color.a);
     return;
 }
 
-void draw_circle_octants(SDL_Renderer* renderer, double body_x, double body_y, double radius) {
- 
-    int x = 0;
-    int y = radius;
-    int d = 1 - radius;
-    int prev_x[8];
-    int prev_y[8];
-
-    int err = 0;
-     //Initialize prev_xy
-    for(int i=0; i<8; i++){
-          prev_x[i] = -1;
-        prev_y[i] = -1;
-    }
-
-    while (x <= y) {
-        // Draw points in all 8 octants
-           int point_x[8];
-           int point_y[8];
-        point_x[0] = body_x + x;
-        point_y[0] = body_y + y;
-        point_x[1] = body_x + y;
-        point_y[1] = body_y + x;
-        point_x[2] = body_x - y;
-        point_y[2] = body_y + x;
-        point_x[3] = body_x - x;
-        point_y[3] = body_y + y;
-        point_x[4] = body_x - x;
-        point_y[4] = body_y - y;
-        point_x[5] = body_x - y;
-        point_y[5] = body_y - x;
-        point_x[6] = body_x + y;
-        point_y[6] = body_y - x;
-        point_x[7] = body_x + x;
-        point_y[7] = body_y - y;
-
-      for(int i=0; i<8; i++){
-        if(prev_x[i] != -1){
-        SDL_RenderDrawLine(renderer, prev_x[i], prev_y[i], point_x[i], point_y[i]);
-           }
-        prev_x[i] = point_x[i];
-        prev_y[i] = point_y[i];
-
-      }
-
-        // Error term update
-            // Update d
-        if(d<0){
-            d += 4*x+6;
-        } else {
-            d += 4 * (x - y) + 10;
-            y--;
-        }
-        x++;
-
-    }
-
-}
-
-// Function to calculate collision and return overlap
-int body_collision(body *b1, body *b2) {
-    double distance = sqrt(pow(b1->x - b2->x, 2) + pow(b1->y - b2->y, 2));
-    double overlap = b1->radius + b2->radius - distance;
-    if (overlap > 0) {
-        return 1;
-    }
-    return 0;
-}
-
 void simple_resolve_collision(body *b1, body *b2){
     double tempX = b1->Xspeed;
     double tempY = b1->Yspeed;
@@ -363,60 +176,213 @@ void simple_resolve_collision(body *b1, body *b2){
     return;
 }
 
-void update_body(int self, body *b[100], int numbodies){
-   
-    b[self]->x += b[self]->Xspeed;
-    for(int i = 0; i < numbodies; i++){
-        if(i != self && b[i]->isAlive){
-            if(body_collision(b[self], b[i])){
-                b[self]->x -= b[self]->Xspeed ;
-                
+void draw_body(render_batch *batch, const camera *cam, body *b, bool filled){
+    // Only queued here, the whole frame goes to SDL in one render_batch_flush
+    double sx, sy;
+    camera_to_screen(cam, b->x, b->y, &sx, &sy);
+    render_circle(batch, sx, sy, b->radius * cam->zoom, b->color, filled);
+    return;
+}
+
+
+// Print how far Barnes-Hut, the particle mesh and the SIMD kernel are from their references
+void report_accuracy(body_store *store, quadtree *tree, double theta, particle_mesh *mesh, thread_pool *pool) {
+    int n = store->count;
+    double *ref_x = malloc(n * sizeof(double));
+    double *ref_y = malloc(n * sizeof(double));
+    double *kernel_x = malloc(n * sizeof(double));
+    double *kernel_y = malloc(n * sizeof(double));
+    if (!ref_x || !ref_y || !kernel_x || !kernel_y) {
+        perror("Error allocating memory");
+    } else {
+        double mean_error, max_error;
+        for (int i = 0; i < n; i++) {
+            vector a = trig_acceleration(store, i);
+            ref_x[i] = a.x;
+            ref_y[i] = a.y;
+        }
+        gravity_kernel(store, 0, n);
+        gravity_compare(store, store->ax, store->ay, ref_x, ref_y, &mean_error, &max_error);
+        for (int i = 0; i < n; i++) {
+            kernel_x[i] = store->ax[i];
+            kernel_y[i] = store->ay[i];
+        }
+        printf("kernel vs trig: mean error %.3e, max error %.3e (tolerance %.0e)\n",
+               mean_error, max_error, GRAVITY_KERNEL_TOLERANCE);
+        gravity_direct_parallel(store, pool);
+        gravity_compare(store, store->ax, store->ay, ref_x, ref_y, &mean_error, &max_error);
+        printf("parallel direct vs trig: mean error %.3e, max error %.3e\n", mean_error, max_error);
+        if (quadtree_build(tree, store) == 0) {
+            gravity_barnes_hut(store, tree, theta, pool);
+        }
+        gravity_compare(store, store->ax, store->ay, kernel_x, kernel_y, &mean_error, &max_error);
+        printf("barnes-hut theta %.2f vs direct: mean error %.3e, max error %.3e\n",
+               theta, mean_error, max_error);
+        for (int shortRange = 0; shortRange <= 1; shortRange++) {
+            if (particle_mesh_gravity(mesh, store, shortRange, pool) == 0) {
+                gravity_compare(store, store->ax, store->ay, kernel_x, kernel_y, &mean_error, &max_error);
+                printf("%s %d^2 vs direct: mean error %.3e, max error %.3e\n",
+                       gravity_mode_name(shortRange ? GRAVITY_P3M : GRAVITY_PARTICLE_MESH),
+                       mesh->gridSize, mean_error, max_error);
             }
         }
     }
-    b[self]->y += b[self]->Yspeed;
-    for(int i = 0; i < numbodies; i++){
-        if(i != self && b[i]->isAlive){
-            if(body_collision(b[self], b[i])){
-                b[self]->y -= b[self]->Yspeed;
+    free(ref_x);
+    free(ref_y);
+    free(kernel_x);
+    free(kernel_y);
+}
+
+// Run the simulation without a window as fast as it goes, then write the final state
+int run_headless(simulation *sim, long steps, const char *output) {
+    double start = simulation_clock();
+    for (long i = 0; i < steps; i++) {
+        if (simulation_step(sim) != 0) {
+            return -1; //a final state missing steps would look like a good one
+        }
+    }
+    if (simulation_sync(sim) != 0) {
+        return -1;
+    }
+    double seconds = simulation_clock() - start;
+    if (sim->tier.radius > 0) {
+        printf("far-field tier: %d bodies cold at the end, %ld went cold, %ld came back\n",
+               sim->tier.cold.count, sim->tier.demoted, sim->tier.promoted);
+    }
+    // .snap picks the binary snapshot, which keeps the tiers so a resume
+    // carries on exactly; the text format has no tiers, so it gets the cold
+    // bodies caught up and back in the hot store
+    size_t length = strlen(output);
+    bool binary = length >= 5 && strcmp(output + length - 5, ".snap") == 0;
+    if (!binary && tier_thaw(&sim->tier, &sim->bodies) != 0) {
+        return -1;
+    }
+
+    int alive = 0;
+    for (int i = 0; i < sim->bodies.count; i++) {
+        alive += sim->bodies.isAlive[i];
+    }
+    for (int i = 0; i < sim->tier.cold.count; i++) {
+        alive += sim->tier.cold.isAlive[i];
+    }
+    printf("headless: %ld steps, %d bodies, %.3f s, %.1f steps/s\n",
+           steps, alive, seconds, (seconds > 0) ? steps / seconds : 0);
+    if (sim->blockLevels > 0 && sim->forceEvaluations > 0) {
+        printf("block steps: %lld force evaluations, %lld with one shared step at the finest level (%.1fx)\n",
+               sim->forceEvaluations, sim->sharedEvaluations,
+               (double)sim->sharedEvaluations / sim->forceEvaluations);
+    }
+    if ((binary ? simulation_save(sim, output) : saveBodiesToFile(output, &sim->bodies)) != 0) {
+        return -1;
+    }
+    printf("final state written to %s\n", output);
+    return 0;
+}
+
+// Play a recording back frame by frame, no physics involved. Loops at the end.
+int run_replay(SDL_Renderer *renderer, render_batch *batch, const camera *cam, bool filled, const char *path) {
+    replay r;
+    if (replay_open(&r, path) != 0) {
+        return -1;
+    }
+    printf("replaying %s, every %d steps, quantum %g\n", path, r.stride, r.quantum);
 
+    int result = 0;
+    bool running = true;
+    while (running) {
+        Uint32 frameStart = SDL_GetTicks();
+        SDL_Event event;
+        while (SDL_PollEvent(&event)) {
+            if (event.type == SDL_QUIT ||
+                (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_ESCAPE)) {
+                running = false;
             }
         }
+
+        int status = replay_next(&r);
+        if (status == 0 && r.frames > 0) {
+            if (replay_rewind(&r) != 0) {
+                result = -1;
+                break;
+            }
+            status = replay_next(&r);
+        }
+        if (status != 1) {
+            result = (status == 0) ? 0 : -1; //0 here means an empty recording
+            break;
+        }
+
+        set_color(renderer, BLACK);
+        SDL_RenderClear(renderer);
+        render_batch_begin(batch);
+        for (int i = 0; i < r.frame.count; i++) {
+            if (!camera_visible(cam, r.frame.x[i], r.frame.y[i], r.frame.radius[i])) {
+                continue;
+            }
+            body b;
+            b.isAlive = true;
+            b.x = r.frame.x[i];
+            b.y = r.frame.y[i];
+            b.radius = r.frame.radius[i];
+            b.color = r.frame.color[i];
+            draw_body(batch, cam, &b, filled);
+        }
+        render_batch_flush(batch, renderer);
+        SDL_RenderPresent(renderer);
+
+        int frameTime = SDL_GetTicks() - frameStart;
+        int delayTime = 1000 / 60 - frameTime;
+        if (delayTime > 0) {
+            SDL_Delay(delayTime);
+        }
     }
-   
-    return;
+
+    replay_close(&r);
+    return result;
 }
 
-void draw_body(SDL_Renderer *renderer, body *b){
-    SDL_SetRenderDrawColor(renderer, b->color.r, b->color.g, b->color.b, b->color.a);
-    draw_circle_octants(renderer, b->x, b->y, b->radius);
-    return;
+// Commands the SDL thread hands to the simulation thread for the keyboard shortcuts
+static void toggle_gravity_mode(simulation *sim) {
+    sim->mode = (sim->mode + 1) % GRAVITY_MODE_COUNT;
+    printf("gravity: %s, theta %.2f\n", gravity_mode_name(sim->mode), sim->theta);
 }
 
-void calculate_gravity(body *b1, body *b2){
-    double distance = sqrt(pow(b1->x - b2->x, 2) + pow(b1->y - b2->y, 2));
-    double force = 6.674 * pow(10,-11)* b1->mass * b2->mass / pow(distance,2);
-    double angle = get_points_angle(b2->x, b2->y, b1->x, b1->y);
-    vector force_vector = angle_magnitude_to_vector(angle, force);
-    vector acceleration = scale_vector(force_vector, 1/b1->mass);
-    vector velocity = scale_vector(acceleration, 0.01666667);
-    b1->Xspeed += velocity.x;
-    b1->Yspeed += velocity.y;
-    return;
+static void decrease_theta(simulation *sim) {
+    sim->theta = fmax(sim->theta - 0.1, 0);
+    printf("gravity: %s, theta %.2f\n", gravity_mode_name(sim->mode), sim->theta);
 }
 
-body* create_body(body *bodies, int *numBodies, int *capacity, double x, double y, double radius, double Xspeed, double Yspeed, double mass, SDL_Color color) {
-    if (*capacity == *numBodies) {
-        // Reallocate when buffer is full
-        *capacity = (*capacity == 0) ? 1 : (*capacity * 2); // Grow capacity by factor of two if initial capacity is 0 or double the existing capacity
-        bodies = realloc(bodies, (*capacity) * sizeof(body)); // Reallocate the memory buffer
-        if (!bodies) {
-            perror("Error reallocating memory");
-            return NULL; // Return NULL if realloc fails
-        }
+static void increase_theta(simulation *sim) {
+    sim->theta = fmin(sim->theta + 0.1, 2);
+    printf("gravity: %s, theta %.2f\n", gravity_mode_name(sim->mode), sim->theta);
+}
+
+static void report_sim_accuracy(simulation *sim) {
+    // Check the engines against each other for the current state. Each one
+    // overwrites ax/ay, which the next step's opening half-kick still needs
+    // (and block timesteps keep for the bodies that are not due), so they
+    // are put back afterwards.
+    body_store *store = &sim->bodies;
+    int n = store->count;
+    real *ax = malloc(n * sizeof(real));
+    real *ay = malloc(n * sizeof(real));
+    if (!ax || !ay) {
+        perror("Error allocating memory");
+        free(ax);
+        free(ay);
+        return;
     }
+    memcpy(ax, store->ax, n * sizeof(real));
+    memcpy(ay, store->ay, n * sizeof(real));
+    report_accuracy(store, &sim->tree, sim->theta, &sim->mesh, sim->pool);
+    memcpy(store->ax, ax, n * sizeof(real));
+    memcpy(store->ay, ay, n * sizeof(real));
+    free(ax);
+    free(ay);
+}
 
-    // Create a new body
+// create_body for the windowed loop, the body is added by the simulation thread
+int spawn_body(sim_thread *physics, double x, double y, double radius, double Xspeed, double Yspeed, double mass, SDL_Color color) {
     body newBody;
     newBody.isAlive = true;
     newBody.x = x;
@@ -427,12 +393,55 @@ body* create_body(body *bodies, int *numBodies, int *capacity, double x, double
     newBody.mass = mass;
     newBody.color = color;
 
-    bodies[*numBodies] = newBody; // Add the newly created body to the buffer
-    (*numBodies)++; // Increment the count of bodies
+    return sim_thread_spawn(physics, &newBody);
+}
+
+// Velocity of the body a drag from (startX, startY) to (x, y) launches, the
+// same for the preview as for the body spawned when the button goes up
+vector launch_velocity(const camera *cam, int startX, int startY, int x, int y, int button) {
+    vector v;
+    v.x = -(x - startX)/30 / cam->zoom;
+    v.y = -(y - startY)/30 / cam->zoom;
+    if (button == SDL_BUTTON_LEFT) {
+        v.x *= 2;
+        v.y *= 2;
+    }
+    return v;
+}
 
-    return bodies;
+// Predicted path of the body being aimed, in the colour it will have
+void draw_preview(render_batch *batch, const camera *cam, preview *aim, int button) {
+    static double pathX[PREVIEW_STEPS + 1], pathY[PREVIEW_STEPS + 1];
+    int count = preview_path(aim, pathX, pathY, PREVIEW_STEPS + 1);
+    SDL_Color color = (button == SDL_BUTTON_LEFT) ? BLUE : (button == SDL_BUTTON_RIGHT) ? RED : GREEN;
+    double lastX = 0, lastY = 0;
+    for (int i = 0; i < count; i++) {
+        double sx, sy;
+        camera_to_screen(cam, pathX[i], pathY[i], &sx, &sy);
+        if (i > 0) {
+            render_line(batch, lastX, lastY, sx, sy, 1.5, color);
+        }
+        lastX = sx;
+        lastY = sy;
+    }
 }
 
+// Per-phase timings, body counts and step rate in the top left corner. The
+// rate is in steps rather than pair interactions, which only the direct sum
+// does bodies^2 of.
+void draw_hud(render_batch *batch, profiler *prof, int bodies, int cold, double stepsPerSecond) {
+    char text[1024];
+    int length = snprintf(text, sizeof(text), "bodies %d (%d cold)\nsteps/s %.3g\n\nphase         min     avg     p99 ms\n",
+                          bodies, cold, stepsPerSecond);
+    for (int i = 0; i < PROFILE_COUNT && length < (int)sizeof(text); i++) {
+        double min, avg, p99;
+        if (profiler_stats(prof, i, &min, &avg, &p99) > 0) {
+            length += snprintf(text + length, sizeof(text) - length, "%-10s %7.2f %7.2f %7.2f\n",
+                               profile_phase_name(i), min * 1e3, avg * 1e3, p99 * 1e3);
+        }
+    }
+    render_text(batch, 10, 10, 2, text, WHITE);
+}
 
 void draw_rect(SDL_Renderer *renderer, SDL_Rect *rect, SDL_Color *color) {
     SDL_SetRenderDrawColor(renderer, color->r, color->g, color->b, color->a);
@@ -445,21 +454,298 @@ void draw_rect(SDL_Renderer *renderer, SDL_Rect *rect, SDL_Color *color) {
 
 
 int main(int argc, char *argv[]) {
-    int capacity = 0;
-    int numbodies = 0;
     int running = true;
     int mouse_start_x = 0;
     int mouse_start_y = 0;
-    int camera_x = 0;
-    int camera_y = 0;
+    int dragButton = 0; //button held down since mouse_start_x/y, 0 when not aiming
     int keys[4] = {0,0,0,0};
     vector mouse_vector;
     int mouse_x, mouse_y;
+    gravity_mode mode = GRAVITY_BARNES_HUT;
+    double theta = 0.5; //Barnes-Hut opening angle
+    int meshGrid = PARTICLE_MESH_DEFAULT_GRID;
+    int workers = 0; //worker processes, 0 steps in this one
+    int rebalance = 0;
+    int threads = thread_pool_cpu_count();
+    bool headless = false;
+    long steps = 1000;
+    const char *scenario = "bodies.txt";
+    const char *generate = NULL; //built-in scenario, replaces the scenario file
+    int generateCount = SCENARIO_DEFAULT_BODIES;
+    uint64_t seed = SCENARIO_DEFAULT_SEED;
+    const char *output = "bodies_final.txt";
+    double dt = 0; //ticks per physics step, 0 keeps the default (or the resumed run's)
+    const char *resume = NULL;
+    const char *checkpoint = NULL;
+    long checkpointEvery = 1000;
+    int maxSubsteps = SIM_DEFAULT_MAX_SUBSTEPS;
+    int blockLevels = 0;
+    collision_mode collisions = COLLISION_MERGE;
+    double coldRadius = 0; //far-field tier radius, 0 for none
+    int coldEvery = TIER_DEFAULT_EVERY;
+    const char *record = NULL;
+    int recordStride = 1;
+    const char *replayPath = NULL;
+    const char *live = NULL;
+    const char *framesPath = NULL;
+    const char *frameFormatName = "png";
+    int frameStride = 1;
+    int frameWorkers = 0; //0 for one per CPU
+    const char *renderModeName = "auto";
+    bool densityByMass = true;
+    bool filled = true;
+    bool profile = false;
+    bool hud = false;
+    const char *tracePath = NULL;
     srand(time(NULL));
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--direct") == 0) {
+            mode = GRAVITY_DIRECT;
+        } else if (strcmp(argv[i], "--pm") == 0) {
+            mode = GRAVITY_PARTICLE_MESH;
+        } else if (strcmp(argv[i], "--p3m") == 0) {
+            mode = GRAVITY_P3M;
+        } else if (strcmp(argv[i], "--pm-grid") == 0 && i + 1 < argc) {
+            meshGrid = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            workers = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--rebalance") == 0 && i + 1 < argc) {
+            rebalance = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--theta") == 0 && i + 1 < argc) {
+            theta = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--scenario") == 0 && i + 1 < argc) {
+            scenario = argv[++i];
+        } else if (strcmp(argv[i], "--generate") == 0 && i + 1 < argc) {
+            generate = argv[++i];
+        } else if (strcmp(argv[i], "--bodies") == 0 && i + 1 < argc) {
+            generateCount = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--headless") == 0) {
+            headless = true;
+        } else if (strcmp(argv[i], "--steps") == 0 && i + 1 < argc) {
+            steps = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            output = argv[++i];
+        } else if (strcmp(argv[i], "--dt") == 0 && i + 1 < argc) {
+            dt = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--substeps") == 0 && i + 1 < argc) {
+            maxSubsteps = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--block-levels") == 0 && i + 1 < argc) {
+            blockLevels = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--cold-radius") == 0 && i + 1 < argc) {
+            coldRadius = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--cold-every") == 0 && i + 1 < argc) {
+            coldEvery = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--bounce") == 0) {
+            collisions = COLLISION_BOUNCE;
+        } else if (strcmp(argv[i], "--resume") == 0 && i + 1 < argc) {
+            resume = argv[++i];
+        } else if (strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc) {
+            checkpoint = argv[++i];
+        } else if (strcmp(argv[i], "--checkpoint-every") == 0 && i + 1 < argc) {
+            checkpointEvery = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            record = argv[++i];
+        } else if (strcmp(argv[i], "--record-stride") == 0 && i + 1 < argc) {
+            recordStride = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--live") == 0 && i + 1 < argc) {
+            live = argv[++i];
+        } else if (strcmp(argv[i], "--render") == 0 && i + 1 < argc) {
+            renderModeName = argv[++i];
+        } else if (strcmp(argv[i], "--density-count") == 0) {
+            densityByMass = false;
+        } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            framesPath = argv[++i];
+        } else if (strcmp(argv[i], "--frame-format") == 0 && i + 1 < argc) {
+            frameFormatName = argv[++i];
+        } else if (strcmp(argv[i], "--frame-stride") == 0 && i + 1 < argc) {
+            frameStride = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--frame-workers") == 0 && i + 1 < argc) {
+            frameWorkers = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replayPath = argv[++i];
+        } else if (strcmp(argv[i], "--outline") == 0) {
+            filled = false;
+        } else if (strcmp(argv[i], "--profile") == 0) {
+            profile = true;
+        } else if (strcmp(argv[i], "--hud") == 0) {
+            hud = true;
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            tracePath = argv[++i];
+        } else {
+            printf("Usage: %s [--direct] [--theta <opening angle>] [--threads <count>] [--scenario <file>]\n"
+                   "       [--generate <plummer|disk|pair|uniform>] [--bodies <count>] [--seed <seed>]\n"
+                   "       [--pm] [--p3m] [--pm-grid <cells per side, power of two>]\n"
+                   "       [--workers <processes>] [--rebalance <steps between gathers>]\n"
+                   "       [--dt <ticks per step>] [--substeps <max steps per frame>]\n"
+                   "       [--block-levels <0 to %d, power-of-two timestep levels below dt>] [--bounce]\n"
+                   "       [--cold-radius <pixels from the centre of mass>] [--cold-every <steps>]\n"
+                   "       [--resume <snapshot>] [--checkpoint <snapshot>] [--checkpoint-every <steps>]\n"
+                   "       [--record <file>] [--record-stride <steps>] [--replay <file>] [--outline]\n"
+                   "       [--live <shared memory name, e.g. " LIVE_DEFAULT_NAME ">]\n"
+                   "       [--render <auto|circles|density>] [--density-count]\n"
+                   "       [--frames <directory>] [--frame-format <png|ppm>] [--frame-stride <steps>]\n"
+                   "       [--frame-workers <encoder threads>]\n"
+                   "       [--profile] [--hud] [--trace <chrome trace.json>]\n"
+                   "       [--headless] [--steps <count>] [--output <file, .snap for binary>]\n", argv[0], SIM_MAX_BLOCK_LEVELS);
+            return 1;
+        }
+    }
+
+    simulation sim;
+    if (meshGrid < PARTICLE_MESH_MIN_GRID || meshGrid > PARTICLE_MESH_MAX_GRID || (meshGrid & (meshGrid - 1)) != 0) {
+        printf("--pm-grid must be a power of two from %d to %d\n", PARTICLE_MESH_MIN_GRID, PARTICLE_MESH_MAX_GRID);
+        return 1;
+    }
+    if (coldRadius < 0 || coldEvery <= 0) {
+        printf("--cold-radius must not be negative and --cold-every must be positive\n");
+        return 1;
+    }
+    if (blockLevels < 0 || blockLevels > SIM_MAX_BLOCK_LEVELS) {
+        printf("--block-levels must be from 0 to %d\n", SIM_MAX_BLOCK_LEVELS);
+        return 1;
+    }
+    scenario_kind generateKind = SCENARIO_PLUMMER;
+    if (generate && (scenario_parse(generate, &generateKind) != 0 || generateCount <= 0)) {
+        printf("--generate takes plummer, disk, pair or uniform and --bodies a positive count\n");
+        return 1;
+    }
+    render_mode renderMode;
+    if (render_mode_parse(renderModeName, &renderMode) != 0) {
+        printf("--render takes auto, circles or density\n");
+        return 1;
+    }
+    frame_format frameFormat;
+    if (frame_format_parse(frameFormatName, &frameFormat) != 0) {
+        printf("--frame-format takes png or ppm\n");
+        return 1;
+    }
+    // Workers are forked before the thread pool, only this thread goes with them.
+    // The window needs the bodies back after every step.
+    cluster *workerCluster = NULL;
+    if (workers > 0 && !replayPath) {
+        if (rebalance <= 0) {
+            rebalance = headless ? CLUSTER_DEFAULT_REBALANCE : 1;
+        }
+        if (!(workerCluster = cluster_start(workers, rebalance))) {
+            return 1;
+        }
+    }
+    if (simulation_init(&sim, mode, theta, threads) != 0) {
+        cluster_stop(workerCluster);
+        return 1;
+    }
+    sim.mesh.gridSize = meshGrid;
+    sim.cluster = workerCluster;
+    body_store *store = &sim.bodies;
+    sim.checkpointPath = checkpoint;
+    sim.checkpointEvery = checkpointEvery;
     
     
     
-    body *bodies = loadBodiesFromFile("bodies.txt", &numbodies,&capacity);
+    if (replayPath) {
+        // Nothing to simulate, the recording already holds every frame
+    } else if (resume) {
+        if (simulation_resume(&sim, resume) != 0) {
+            simulation_free(&sim);
+            return 1;
+        }
+    } else if (generate) {
+        double start = simulation_clock();
+        if (scenario_generate(store, generateKind, generateCount, seed, WIDTH / 2, HEIGHT / 2, sim.pool) != 0) {
+            simulation_free(&sim);
+            return 1;
+        }
+        printf("generated %d bodies (%s, seed %llu) in %.3f s\n", generateCount, scenario_name(generateKind),
+               (unsigned long long)seed, simulation_clock() - start);
+    } else if (loadBodiesFromFile(scenario, store) != 0 && headless) {
+        simulation_free(&sim);
+        return 1;
+    }
+    if (dt > 0) {
+        sim.dt = dt;
+    }
+    sim.maxSubsteps = (maxSubsteps > 0) ? maxSubsteps : 1;
+    sim.blockLevels = blockLevels;
+    sim.collisions = collisions;
+    sim.tier.radius = coldRadius;
+    sim.tier.every = coldEvery;
+    // A snapshot's cold bodies only stay cold while this run tiers too
+    if ((coldRadius <= 0 || workerCluster) && tier_thaw(&sim.tier, store) != 0) {
+        simulation_free(&sim);
+        return 1;
+    }
+    if (coldRadius > 0 && workerCluster) {
+        printf("--cold-radius has no effect with --workers, the workers hold the bodies\n");
+    }
+    if (blockLevels > 0 && sim.cluster) {
+        printf("block timesteps only apply in this process, the workers take shared steps\n");
+    }
+    printf("gravity: %s, theta %.2f, %d threads, dt %.3f ticks\n",
+           gravity_mode_name(sim.mode), sim.theta, thread_pool_size(sim.pool), sim.dt);
+
+    if (record && !replayPath) {
+        // Headless runs want every frame, the window must not stall on the disk
+        sim.recording = recorder_open(record, recordStride, RECORDER_DEFAULT_QUANTUM, RECORDER_DEFAULT_RING, headless);
+        if (!sim.recording) {
+            simulation_free(&sim);
+            return 1;
+        }
+        recorder_submit(sim.recording, store, &sim.tier.cold, sim.steps); //starting state
+    }
+
+    if (live && !replayPath) {
+        sim.live = live_export_open(live);
+        if (!sim.live || live_export_publish(sim.live, store, &sim.tier.cold, sim.steps, sim.dt) != 0) {
+            simulation_free(&sim);
+            return 1;
+        }
+    }
+
+    // The window and exported frames start out with the same view
+    camera cam;
+    camera_init(&cam, WIDTH, HEIGHT);
+    if (generate) {
+        // Zoom out until the generated bodies fit the window
+        double radius = scenario_radius(generateKind, generateCount);
+        camera_zoom_at(&cam, fmin(1, HEIGHT / (2.2 * radius)), WIDTH / 2, HEIGHT / 2);
+    }
+    if (framesPath && !replayPath) {
+        int encoders = (frameWorkers > 0) ? frameWorkers : thread_pool_cpu_count();
+        sim.frames = frame_export_open(framesPath, frameFormat, &cam, filled, renderMode, densityByMass,
+                                       frameStride, encoders, FRAME_EXPORT_DEFAULT_QUEUE);
+        if (!sim.frames) {
+            simulation_free(&sim);
+            return 1;
+        }
+        frame_export_submit(sim.frames, store, &sim.tier.cold, sim.steps); //starting state
+    }
+
+    // The window always profiles for its HUD, headless runs only on request
+    if ((profile || tracePath || !headless) && !replayPath) {
+        sim.profiler = profiler_create(tracePath != NULL);
+        if (!sim.profiler) {
+            simulation_free(&sim);
+            return 1;
+        }
+    }
+
+    if (headless) {
+        int result = run_headless(&sim, steps, output);
+        if (profile) {
+            profiler_report(sim.profiler);
+        }
+        if (tracePath && profiler_write_trace(sim.profiler, tracePath) != 0) {
+            result = -1;
+        }
+        simulation_free(&sim);
+        profiler_destroy(sim.profiler);
+        return result == 0 ? 0 : 1;
+    }
 
     //bodies[0] = create_body(&numbodies,300,300,20,-2,0,10e15,RED);
     //bodies[1] = create_body(&numbodies,100,300,20,0,-2,10e15,GREEN);
@@ -467,12 +753,14 @@ int main(int argc, char *argv[]) {
     //bodies[3] = create_body(&numbodies,300,300,20,0,2,10e15,WHITE);
     if (SDL_Init(SDL_INIT_VIDEO) < 0) {
         printf("SDL initialization failed: %s\n", SDL_GetError());
+        simulation_free(&sim); //stops the cluster's workers too
         return 1;
     }
 
     SDL_Window *window = SDL_CreateWindow("Gravity Simulator", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, WIDTH, HEIGHT, SDL_WINDOW_SHOWN);
     if (!window) {
         printf("Window creation failed: %s\n", SDL_GetError());
+        simulation_free(&sim);
         SDL_Quit();
         return 1;
     }
@@ -481,12 +769,24 @@ int main(int argc, char *argv[]) {
     SDL_Renderer *renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
     if (!renderer) {
         printf("Renderer creation failed: %s\n", SDL_GetError());
+        simulation_free(&sim);
         SDL_DestroyWindow(window);
         SDL_Quit();
         return 1;
     }
 
-    
+    render_batch batch;
+    render_batch_init(&batch);
+
+    if (replayPath) {
+        int result = run_replay(renderer, &batch, &cam, filled, replayPath);
+        render_batch_free(&batch);
+        simulation_free(&sim);
+        SDL_DestroyRenderer(renderer);
+        SDL_DestroyWindow(window);
+        SDL_Quit();
+        return result == 0 ? 0 : 1;
+    }
   
     /*
     bodies[1] = create_body(&numbodies,xorign+550,yorign,4,0,-5.6 ,7e13,GREEN);
@@ -494,10 +794,47 @@ int main(int argc, char *argv[]) {
     bodies[3] = create_body(&numbodies,xorign-500,yorign,15,0,4,1e14,CYAN);
     bodies[4] = create_body(&numbodies,xorign-550,yorign,4,0,5.6 ,7e13,MAGENTA);
     */
+    // Density views are splatted by a pool of their own, the simulation's is
+    // busy on its thread, and reach SDL as one streaming texture per frame
+    density_map density;
+    density_init(&density, densityByMass);
+    thread_pool *renderPool = thread_pool_create(thread_pool_cpu_count());
+    SDL_Texture *densityTexture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+                                                    SDL_TEXTUREACCESS_STREAMING, WIDTH, HEIGHT);
+    if (!renderPool || !densityTexture) {
+        printf("Density view unavailable (%s), drawing circles only\n", SDL_GetError());
+        renderMode = RENDER_CIRCLES;
+    }
+
+    // From here on the simulation belongs to its own thread, this one only
+    // polls input and draws the last frame it finished
+    double previewDt = sim.dt;
+    sim_thread *physics = sim_thread_start(&sim);
+    if (!physics) {
+        if (densityTexture) SDL_DestroyTexture(densityTexture);
+        thread_pool_destroy(renderPool);
+        density_free(&density);
+        render_batch_free(&batch);
+        simulation_free(&sim);
+        SDL_DestroyRenderer(renderer);
+        SDL_DestroyWindow(window);
+        SDL_Quit();
+        return 1;
+    }
+    // Launches are previewed against a frozen copy of the bodies on a thread
+    // of their own, without one the spawns just go unpreviewed
+    preview *aim = preview_start(physics);
+    double aimed[4] = {NAN, NAN, NAN, NAN}; //launch x, y, vx, vy last sent to the preview
+    profiler *prof = sim.profiler;
+    long rateSteps = sim.steps;
+    double rateStart = profile_clock();
+    double stepsPerSecond = 0;
     while(running) {
         Uint32 frameStart = SDL_GetTicks();
+        double frameBegin = profile_begin(prof);
 
         SDL_Event event;
+        double phaseStart = profile_begin(prof);
     while (SDL_PollEvent(&event)) {
         switch (event.type) {
             case SDL_QUIT:
@@ -506,15 +843,7 @@ int main(int argc, char *argv[]) {
             case SDL_KEYDOWN:
                 switch (event.key.keysym.sym) {
                     case SDLK_SPACE:
-                         
-                        for (int i = 0; i < numbodies; i++) {
-                            bodies[i].x -= camera_x;
-                            
-                            bodies[i].y -= camera_y;
-                            
-                        }
-                        camera_x = 0;
-                        camera_y = 0;
+                        camera_init(&cam, WIDTH, HEIGHT);
                         break;
 
                     case SDLK_ESCAPE:
@@ -532,6 +861,30 @@ int main(int argc, char *argv[]) {
                     case SDLK_d:
                         keys[3] = 1;
                         break;
+                    case SDLK_g:
+                        sim_thread_run(physics, toggle_gravity_mode);
+                        break;
+                    case SDLK_LEFTBRACKET:
+                        sim_thread_run(physics, decrease_theta);
+                        break;
+                    case SDLK_RIGHTBRACKET:
+                        sim_thread_run(physics, increase_theta);
+                        break;
+                    case SDLK_f:
+                        filled = !filled;
+                        break;
+                    case SDLK_e:
+                        sim_thread_run(physics, report_sim_accuracy);
+                        break;
+                    case SDLK_h:
+                        hud = !hud;
+                        break;
+                    case SDLK_v:
+                        if (renderPool && densityTexture) {
+                            renderMode = (renderMode + 1) % RENDER_MODE_COUNT;
+                            printf("render: %s\n", render_mode_name(renderMode));
+                        }
+                        break;
                 } 
             break;  
             case SDL_KEYUP:
@@ -555,51 +908,72 @@ int main(int argc, char *argv[]) {
 
 
 
+                break;
+            case SDL_MOUSEWHEEL:
+                SDL_GetMouseState(&mouse_x, &mouse_y);
+                camera_zoom_at(&cam, pow(1.1, event.wheel.y), mouse_x, mouse_y);
                 break;
             case SDL_MOUSEBUTTONDOWN:
                 mouse_start_x = event.button.x;
                 mouse_start_y = event.button.y;
+                dragButton = event.button.button;
+                if (aim) {
+                    preview_freeze(aim);
+                    aimed[0] = NAN; //aim again even if nothing moved since the last drag
+                }
                 break;
-            case SDL_MOUSEBUTTONUP:
-                mouse_vector.x = -(event.button.x - mouse_start_x)/30;
-                mouse_vector.y = -(event.button.y - mouse_start_y)/30;
+            case SDL_MOUSEBUTTONUP: {
+                // Drags are measured on screen, bodies are spawned in world space
+                double spawn_x, spawn_y;
+                camera_to_world(&cam, event.button.x, event.button.y, &spawn_x, &spawn_y);
+                mouse_vector = launch_velocity(&cam, mouse_start_x, mouse_start_y,
+                                               event.button.x, event.button.y, event.button.button);
+                dragButton = 0;
+                if (aim) {
+                    preview_clear(aim);
+                }
 
                 if(event.button.button == SDL_BUTTON_LEFT){
-                    bodies = create_body(bodies, &numbodies, &capacity, event.button.x, event.button.y, 5, mouse_vector.x*2, mouse_vector.y*2, 1e12, BLUE);
+                    spawn_body(physics, spawn_x, spawn_y, 5, mouse_vector.x, mouse_vector.y, 1e12, BLUE);
                 }else if(event.button.button == SDL_BUTTON_RIGHT){
-                    bodies = create_body(bodies, &numbodies, &capacity, event.button.x, event.button.y, 15, mouse_vector.x, mouse_vector.y, 1e14, RED);
+                    spawn_body(physics, spawn_x, spawn_y, 15, mouse_vector.x, mouse_vector.y, 1e14, RED);
                 }else if (event.button.button == SDL_BUTTON_MIDDLE){
                     for(int i = 0; i < 10; i++){
-                            bodies = create_body(bodies, &numbodies, &capacity,
-                             event.button.x+ rand() % (100 - -100 + 1), event.button.y + rand() % (100 - -100 + 1)
+                            spawn_body(physics,
+                             spawn_x + (rand() % (100 - -100 + 1)) / cam.zoom, spawn_y + (rand() % (100 - -100 + 1)) / cam.zoom
                              , 5, mouse_vector.x, mouse_vector.y, 1e8, GREEN);
                         }
                 }
                 break;
+            }
         }
     }       
+        profile_end(prof, PROFILE_EVENTS, phaseStart);
+        // Panning only moves the camera, the bodies never see it
         if(keys[0]){
-            for(int i = 0; i < numbodies;i++){
-                bodies[i].y += 5;
-                camera_y += 5;
-            }
+            camera_pan(&cam, 0, -5);
         }
         if(keys[1]){
-            for(int i = 0; i< numbodies;i++){
-                bodies[i].x += 5;
-                camera_x += 5;
-            }
+            camera_pan(&cam, -5, 0);
         }
         if(keys[2]){
-            for(int i = 0; i< numbodies;i++){
-                bodies[i].y += -5;
-                camera_y -= 5;
-            }
+            camera_pan(&cam, 0, 5);
         }
         if(keys[3]){
-            for(int i = 0; i< numbodies;i++){
-                bodies[i].x += -5;
-                camera_x -= 5;
+            camera_pan(&cam, 5, 0);
+        }
+        // Re-aim whenever the launch changes, whether the cursor or the camera moved
+        if (aim && dragButton) {
+            SDL_GetMouseState(&mouse_x, &mouse_y);
+            double launchX, launchY;
+            camera_to_world(&cam, mouse_x, mouse_y, &launchX, &launchY);
+            vector v = launch_velocity(&cam, mouse_start_x, mouse_start_y, mouse_x, mouse_y, dragButton);
+            if (launchX != aimed[0] || launchY != aimed[1] || v.x != aimed[2] || v.y != aimed[3]) {
+                preview_aim(aim, launchX, launchY, v.x, v.y, previewDt);
+                aimed[0] = launchX;
+                aimed[1] = launchY;
+                aimed[2] = v.x;
+                aimed[3] = v.y;
             }
         }
 
@@ -608,27 +982,62 @@ int main(int argc, char *argv[]) {
         SDL_RenderClear(renderer);
 
         
-        for(int i = 0; i < numbodies; i++){
-            for(int j = 0; j < numbodies; j++){
-                if(i != j && bodies[i].isAlive && bodies[j].isAlive){
-                    if(body_collision(&bodies[i], &bodies[j])){
-                        //calculate_vector_collision(bodies[i], bodies[j]);
-                        absorb_body(&bodies, &numbodies, &capacity, i, j);
-                    }else {
-                        calculate_gravity(&bodies[i], &bodies[j]);
-                    }
-                }
+        // The frame stays ours until released without stalling physics, SDL gets the batch afterwards
+        phaseStart = profile_begin(prof);
+        const sim_frame *frame = sim_thread_acquire(physics);
+        render_batch_begin(&batch);
+        bool splat = density_wanted(renderMode, frame->radius, frame->count, cam.zoom) &&
+                     density_splat(&density, &cam, frame->x, frame->y, frame->prevX, frame->prevY,
+                                   frame->alpha, frame->mass, frame->count, renderPool) == 0;
+        for(int i = 0; i < frame->count && !splat; i++){
+            // Draw between the last two steps so motion stays smooth
+            // when frames and steps do not line up
+            double x = frame->prevX[i] + frame->alpha * (frame->x[i] - frame->prevX[i]);
+            double y = frame->prevY[i] + frame->alpha * (frame->y[i] - frame->prevY[i]);
+            if (!camera_visible(&cam, x, y, frame->radius[i])) {
+                continue; //off screen, costs nothing past this test
             }
+            body b;
+            b.isAlive = true;
+            b.x = x;
+            b.y = y;
+            b.radius = frame->radius[i];
+            b.color = frame->color[i];
+            draw_body(&batch, &cam, &b, filled);
         }
-        for(int i = 0; i < numbodies; i++){
-            if (bodies[i].isAlive){
-                //update_body(i, bodies, numbodies);
-                bodies[i].x += bodies[i].Xspeed;
-                bodies[i].y += bodies[i].Yspeed;
-                draw_body(renderer, &bodies[i]);
+        // Steps per second of wall time, averaged over half a second so the
+        // HUD stays readable
+        double now = profile_clock();
+        int bodies = frame->hotCount;
+        int cold = frame->count - frame->hotCount;
+        if (now - rateStart >= 0.5) {
+            stepsPerSecond = (frame->steps - rateSteps) / (now - rateStart);
+            rateSteps = frame->steps;
+            rateStart = now;
+        }
+        sim_thread_release(physics, frame);
+        if (splat) {
+            void *pixels;
+            int pitch;
+            if (SDL_LockTexture(densityTexture, NULL, &pixels, &pitch) == 0) {
+                density_resolve(&density, pixels, pitch, renderPool);
+                SDL_UnlockTexture(densityTexture);
+                SDL_RenderCopy(renderer, densityTexture, NULL, NULL);
             }
         }
+        if (aim && dragButton) {
+            draw_preview(&batch, &cam, aim, dragButton);
+        }
+        if (hud) {
+            draw_hud(&batch, prof, bodies, cold, stepsPerSecond);
+        }
+        profile_end(prof, PROFILE_DRAW, phaseStart);
+
+        phaseStart = profile_begin(prof);
+        render_batch_flush(&batch, renderer);
         SDL_RenderPresent(renderer);
+        profile_end(prof, PROFILE_PRESENT, phaseStart);
+        profile_end(prof, PROFILE_FRAME, frameBegin);
 
         // Frame limiting
         int frameTime = SDL_GetTicks() - frameStart;
@@ -638,7 +1047,17 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    free(bodies);
+    preview_stop(aim);
+    sim_thread_stop(physics);
+    if (tracePath) {
+        profiler_write_trace(prof, tracePath);
+    }
+    if (densityTexture) SDL_DestroyTexture(densityTexture);
+    thread_pool_destroy(renderPool);
+    density_free(&density);
+    render_batch_free(&batch);
+    simulation_free(&sim);
+    profiler_destroy(prof);
 
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
@@ -0,0 +1,395 @@
+#include "particle_mesh.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MESH_ROWS_PER_TASK 8
+#define MESH_COLUMN_BLOCK 8  //columns gathered together, one cache line of each row
+#define MESH_CHUNK 1024      //bodies per task
+
+// Short-range half of the Gaussian split of a pair's force at distance d,
+// in split scales, as a fraction of the full 1/d^2 force
+static double short_range_factor(double d) {
+    double u = d / 2;
+    return erfc(u) + 2 * u / sqrt(M_PI) * exp(-u * u);
+}
+
+static void particle_mesh_fill_table(particle_mesh *pm) {
+    // Linear interpolation between 4096 samples is within 1e-7 of erfc and
+    // exp, far below the mesh's own error, and a lot cheaper per pair
+    for (int k = 0; k <= PARTICLE_MESH_TABLE + 1; k++) {
+        pm->shortRange[k] = short_range_factor(PARTICLE_MESH_CUTOFF * k / PARTICLE_MESH_TABLE);
+    }
+}
+
+void particle_mesh_init(particle_mesh *pm, int gridSize) {
+    memset(pm, 0, sizeof(*pm));
+    pm->gridSize = gridSize;
+    particle_mesh_fill_table(pm);
+}
+
+static void particle_mesh_release(particle_mesh *pm) {
+    fft_plan_free(&pm->plan);
+    free(pm->re);
+    free(pm->im);
+    free(pm->greenRe);
+    free(pm->greenIm);
+    free(pm->scratch);
+    pm->re = pm->im = pm->greenRe = pm->greenIm = pm->scratch = NULL;
+    pm->scratchThreads = 0;
+    pm->kernelGrid = 0;
+}
+
+void particle_mesh_free(particle_mesh *pm) {
+    particle_mesh_release(pm);
+    free(pm->cellStart);
+    free(pm->order);
+    free(pm->cellOf);
+    particle_mesh_init(pm, pm->gridSize);
+}
+
+typedef struct {
+    particle_mesh *pm;
+    double *re, *im;
+    int rows;       //row transforms only cover rows [0, rows)
+    bool inverse;
+    bool convolve;  //columns: forward, multiply by the kernel, inverse
+} mesh_fft_job;
+
+static void mesh_row_task(void *context, int task, int thread) {
+    mesh_fft_job *job = context;
+    int p = job->pm->plan.n;
+    int end = (task + 1) * MESH_ROWS_PER_TASK;
+    if (end > job->rows) {
+        end = job->rows;
+    }
+    (void)thread;
+
+    for (int row = task * MESH_ROWS_PER_TASK; row < end; row++) {
+        fft_transform(&job->pm->plan, job->re + (size_t)row * p, job->im + (size_t)row * p, job->inverse);
+    }
+}
+
+// Columns are strided by a whole row, so a block of them is copied out row
+// by row, transformed contiguously and copied back
+static void mesh_column_task(void *context, int task, int thread) {
+    mesh_fft_job *job = context;
+    particle_mesh *pm = job->pm;
+    int p = pm->plan.n;
+    int first = task * MESH_COLUMN_BLOCK;
+    double *blockRe = pm->scratch + (size_t)thread * 2 * MESH_COLUMN_BLOCK * p;
+    double *blockIm = blockRe + MESH_COLUMN_BLOCK * p;
+
+    for (int row = 0; row < p; row++) {
+        const double *re = job->re + (size_t)row * p + first;
+        const double *im = job->im + (size_t)row * p + first;
+        for (int k = 0; k < MESH_COLUMN_BLOCK; k++) {
+            blockRe[k * p + row] = re[k];
+            blockIm[k * p + row] = im[k];
+        }
+    }
+    for (int k = 0; k < MESH_COLUMN_BLOCK; k++) {
+        fft_transform(&pm->plan, blockRe + k * p, blockIm + k * p, job->inverse);
+    }
+    if (job->convolve) {
+        for (int row = 0; row < p; row++) {
+            const double *gr = pm->greenRe + (size_t)row * p + first;
+            const double *gi = pm->greenIm + (size_t)row * p + first;
+            for (int k = 0; k < MESH_COLUMN_BLOCK; k++) {
+                double a = blockRe[k * p + row];
+                double b = blockIm[k * p + row];
+                blockRe[k * p + row] = a * gr[k] - b * gi[k];
+                blockIm[k * p + row] = a * gi[k] + b * gr[k];
+            }
+        }
+        for (int k = 0; k < MESH_COLUMN_BLOCK; k++) {
+            fft_transform(&pm->plan, blockRe + k * p, blockIm + k * p, true);
+        }
+    }
+    for (int row = 0; row < p; row++) {
+        double *re = job->re + (size_t)row * p + first;
+        double *im = job->im + (size_t)row * p + first;
+        for (int k = 0; k < MESH_COLUMN_BLOCK; k++) {
+            re[k] = blockRe[k * p + row];
+            im[k] = blockIm[k * p + row];
+        }
+    }
+}
+
+// Force of a unit mass at distance (dx, dy) cells on the mesh, per G / cell^2
+static void mesh_kernel(double dx, double dy, bool shortRange, double *kx, double *ky) {
+    double r2 = dx * dx + dy * dy;
+    double f;
+    if (shortRange) {
+        // Long-range half of the split, smooth and finite at r = 0
+        double r = sqrt(r2);
+        f = (r > 0) ? (1 - short_range_factor(r / PARTICLE_MESH_SPLIT)) / (r2 * r) : 0;
+    } else {
+        // Plummer softening by one cell
+        double s2 = r2 + 1;
+        f = 1 / (s2 * sqrt(s2));
+    }
+    *kx = -dx * f;
+    *ky = -dy * f;
+}
+
+// Set up the work grids, FFT plan and scratch for gridSize and transform
+// the kernel, only redoing what changed since the last call
+static int particle_mesh_prepare(particle_mesh *pm, bool shortRange, thread_pool *pool) {
+    int m = pm->gridSize;
+    if (m < PARTICLE_MESH_MIN_GRID || m > PARTICLE_MESH_MAX_GRID || (m & (m - 1)) != 0) {
+        printf("Mesh size %d must be a power of two from %d to %d\n", m, PARTICLE_MESH_MIN_GRID, PARTICLE_MESH_MAX_GRID);
+        return -1;
+    }
+    int p = 2 * m;
+    size_t cells = (size_t)p * p;
+    if (pm->kernelGrid != m) {
+        particle_mesh_release(pm);
+        if (fft_plan_init(&pm->plan, p) != 0) {
+            return -1;
+        }
+        pm->re = malloc(cells * sizeof(double));
+        pm->im = malloc(cells * sizeof(double));
+        pm->greenRe = malloc(cells * sizeof(double));
+        pm->greenIm = malloc(cells * sizeof(double));
+        if (!pm->re || !pm->im || !pm->greenRe || !pm->greenIm) {
+            perror("Error allocating memory");
+            particle_mesh_release(pm);
+            return -1;
+        }
+        pm->kernelGrid = m;
+        pm->kernelShortRange = !shortRange; //nothing transformed yet
+    }
+    int threads = thread_pool_size(pool);
+    if (threads > pm->scratchThreads) {
+        double *scratch = realloc(pm->scratch, (size_t)threads * 2 * MESH_COLUMN_BLOCK * p * sizeof(double));
+        if (!scratch) {
+            perror("Error reallocating memory");
+            return -1;
+        }
+        pm->scratch = scratch;
+        pm->scratchThreads = threads;
+    }
+    if (pm->kernelShortRange == shortRange) {
+        return 0;
+    }
+
+    // Offsets wrap around the padded grid, offset m never occurs between two
+    // mesh nodes. The inverse transform's factor of p^2 is divided out here.
+    double scale = 1.0 / ((double)p * p);
+    for (int row = 0; row < p; row++) {
+        for (int col = 0; col < p; col++) {
+            double kx = 0, ky = 0;
+            if (row != m && col != m) {
+                mesh_kernel((col < m) ? col : col - p, (row < m) ? row : row - p, shortRange, &kx, &ky);
+            }
+            pm->greenRe[(size_t)row * p + col] = kx * scale;
+            pm->greenIm[(size_t)row * p + col] = ky * scale;
+        }
+    }
+    mesh_fft_job job = {pm, pm->greenRe, pm->greenIm, p, false, false};
+    thread_pool_run(pool, p / MESH_ROWS_PER_TASK, mesh_row_task, &job);
+    thread_pool_run(pool, p / MESH_COLUMN_BLOCK, mesh_column_task, &job);
+    pm->kernelShortRange = shortRange;
+    return 0;
+}
+
+// Lower mesh node of the cloud around (x, y) and the weight of the upper one
+static void mesh_cloud(const particle_mesh *pm, double x, double y, int *col, int *row, double *fx, double *fy) {
+    double u = (x - pm->originX) / pm->cellSize;
+    double v = (y - pm->originY) / pm->cellSize;
+    *col = (int)u;
+    *row = (int)v;
+    *fx = u - *col;
+    *fy = v - *row;
+}
+
+// Sort the living bodies into square cells as wide as the short-range cutoff
+static int particle_mesh_bin(particle_mesh *pm, const body_store *store, double cutoff) {
+    int perSide = (int)(pm->gridSize * pm->cellSize / cutoff) + 1;
+    int numCells = perSide * perSide;
+    if (numCells + 1 > pm->cellCapacity) {
+        int *cellStart = realloc(pm->cellStart, (numCells + 1) * sizeof(int));
+        if (!cellStart) {
+            perror("Error reallocating memory");
+            return -1;
+        }
+        pm->cellStart = cellStart;
+        pm->cellCapacity = numCells + 1;
+    }
+    if (store->count > pm->bodyCapacity) {
+        int *order = realloc(pm->order, store->count * sizeof(int));
+        if (order) pm->order = order;
+        int *cellOf = realloc(pm->cellOf, store->count * sizeof(int));
+        if (cellOf) pm->cellOf = cellOf;
+        if (!order || !cellOf) {
+            perror("Error reallocating memory");
+            return -1;
+        }
+        pm->bodyCapacity = store->count;
+    }
+    pm->numCells = numCells;
+    pm->cellsPerSide = perSide;
+
+    memset(pm->cellStart, 0, (numCells + 1) * sizeof(int));
+    for (int i = 0; i < store->count; i++) {
+        if (!store->isAlive[i]) {
+            continue;
+        }
+        int cx = (int)((store->x[i] - pm->originX) / cutoff);
+        int cy = (int)((store->y[i] - pm->originY) / cutoff);
+        cx = (cx < 0) ? 0 : (cx >= perSide) ? perSide - 1 : cx;
+        cy = (cy < 0) ? 0 : (cy >= perSide) ? perSide - 1 : cy;
+        pm->cellOf[i] = cy * perSide + cx;
+        pm->cellStart[pm->cellOf[i] + 1]++;
+    }
+    for (int c = 0; c < numCells; c++) {
+        pm->cellStart[c + 1] += pm->cellStart[c];
+    }
+    // Counting sort, bodies stay in index order within a cell
+    for (int i = 0; i < store->count; i++) {
+        if (store->isAlive[i]) {
+            pm->order[pm->cellStart[pm->cellOf[i]]++] = i;
+        }
+    }
+    for (int c = numCells; c > 0; c--) {
+        pm->cellStart[c] = pm->cellStart[c - 1];
+    }
+    pm->cellStart[0] = 0;
+    return 0;
+}
+
+typedef struct {
+    particle_mesh *pm;
+    body_store *store;
+    bool shortRange;
+} mesh_body_job;
+
+// Read the mesh acceleration back at each body, then add the short-range
+// pairs. Each body is summed on its own, in the same order for any pool.
+static void mesh_body_task(void *context, int task, int thread) {
+    mesh_body_job *job = context;
+    const particle_mesh *pm = job->pm;
+    body_store *store = job->store;
+    int p = pm->plan.n;
+    double meshScale = GRAVITATIONAL_CONSTANT / (pm->cellSize * pm->cellSize);
+    double split = PARTICLE_MESH_SPLIT * pm->cellSize;
+    double cutoff = PARTICLE_MESH_CUTOFF * split;
+    double perSample = PARTICLE_MESH_TABLE / cutoff;
+    int end = (task + 1) * MESH_CHUNK;
+    if (end > store->count) {
+        end = store->count;
+    }
+    (void)thread;
+
+    for (int i = task * MESH_CHUNK; i < end; i++) {
+        if (!store->isAlive[i]) {
+            continue;
+        }
+        int col, row;
+        double fx, fy;
+        mesh_cloud(pm, store->x[i], store->y[i], &col, &row, &fx, &fy);
+        size_t node = (size_t)row * p + col;
+        double w00 = (1 - fx) * (1 - fy), w10 = fx * (1 - fy), w01 = (1 - fx) * fy, w11 = fx * fy;
+        double ax = w00 * pm->re[node] + w10 * pm->re[node + 1] + w01 * pm->re[node + p] + w11 * pm->re[node + p + 1];
+        double ay = w00 * pm->im[node] + w10 * pm->im[node + 1] + w01 * pm->im[node + p] + w11 * pm->im[node + p + 1];
+        store->ax[i] = meshScale * ax;
+        store->ay[i] = meshScale * ay;
+        if (!job->shortRange) {
+            continue;
+        }
+
+        int perSide = pm->cellsPerSide;
+        int cx = pm->cellOf[i] % perSide;
+        int cy = pm->cellOf[i] / perSide;
+        double sum_x = 0, sum_y = 0;
+        for (int ny = cy - 1; ny <= cy + 1; ny++) {
+            for (int nx = cx - 1; nx <= cx + 1; nx++) {
+                if (nx < 0 || ny < 0 || nx >= perSide || ny >= perSide) {
+                    continue;
+                }
+                int cell = ny * perSide + nx;
+                for (int k = pm->cellStart[cell]; k < pm->cellStart[cell + 1]; k++) {
+                    int j = pm->order[k];
+                    double dx = store->x[j] - store->x[i];
+                    double dy = store->y[j] - store->y[i];
+                    double d2 = dx * dx + dy * dy;
+                    if (d2 == 0 || d2 >= cutoff * cutoff) {
+                        continue;
+                    }
+                    // Short-range half of the split: what the mesh left out
+                    double d = sqrt(d2);
+                    double t = d * perSample;
+                    int k = (int)t;
+                    double factor = pm->shortRange[k] + (t - k) * (pm->shortRange[k + 1] - pm->shortRange[k]);
+                    double w = store->mass[j] * factor / (d2 * d);
+                    sum_x += w * dx;
+                    sum_y += w * dy;
+                }
+            }
+        }
+        store->ax[i] += GRAVITATIONAL_CONSTANT * sum_x;
+        store->ay[i] += GRAVITATIONAL_CONSTANT * sum_y;
+    }
+}
+
+int particle_mesh_gravity(particle_mesh *pm, body_store *store, bool shortRange, thread_pool *pool) {
+    if (particle_mesh_prepare(pm, shortRange, pool) != 0) {
+        return -1;
+    }
+    int m = pm->gridSize;
+    int p = pm->plan.n;
+
+    double min_x = INFINITY, min_y = INFINITY, max_x = -INFINITY, max_y = -INFINITY;
+    for (int i = 0; i < store->count; i++) {
+        if (store->isAlive[i]) {
+            min_x = fmin(min_x, store->x[i]);
+            max_x = fmax(max_x, store->x[i]);
+            min_y = fmin(min_y, store->y[i]);
+            max_y = fmax(max_y, store->y[i]);
+        }
+    }
+    if (min_x > max_x) {
+        return 0; //no living bodies
+    }
+    // Square mesh centred on the bodies with half a cell to spare on every
+    // side, so each cloud's upper node is still on the mesh
+    double extent = fmax(max_x - min_x, max_y - min_y);
+    pm->cellSize = (extent > 0) ? extent / (m - 2) : 1;
+    pm->originX = (min_x + max_x) / 2 - pm->cellSize * (m - 1) / 2;
+    pm->originY = (min_y + max_y) / 2 - pm->cellSize * (m - 1) / 2;
+
+    size_t cells = (size_t)p * p;
+    memset(pm->re, 0, cells * sizeof(double));
+    memset(pm->im, 0, cells * sizeof(double));
+    for (int i = 0; i < store->count; i++) {
+        if (!store->isAlive[i]) {
+            continue;
+        }
+        int col, row;
+        double fx, fy;
+        mesh_cloud(pm, store->x[i], store->y[i], &col, &row, &fx, &fy);
+        size_t node = (size_t)row * p + col;
+        double mass = store->mass[i];
+        pm->re[node] += mass * (1 - fx) * (1 - fy);
+        pm->re[node + 1] += mass * fx * (1 - fy);
+        pm->re[node + p] += mass * (1 - fx) * fy;
+        pm->re[node + p + 1] += mass * fx * fy;
+    }
+
+    // Masses only fill the first m rows, the padding rows transform to zero
+    // and only the first m rows of the result are read back
+    mesh_fft_job job = {pm, pm->re, pm->im, m, false, true};
+    thread_pool_run(pool, m / MESH_ROWS_PER_TASK, mesh_row_task, &job);
+    thread_pool_run(pool, p / MESH_COLUMN_BLOCK, mesh_column_task, &job);
+    job.inverse = true;
+    thread_pool_run(pool, m / MESH_ROWS_PER_TASK, mesh_row_task, &job);
+
+    if (shortRange && particle_mesh_bin(pm, store, PARTICLE_MESH_CUTOFF * PARTICLE_MESH_SPLIT * pm->cellSize) != 0) {
+        return -1;
+    }
+    mesh_body_job bodies = {pm, store, shortRange};
+    thread_pool_run(pool, (store->count + MESH_CHUNK - 1) / MESH_CHUNK, mesh_body_task, &bodies);
+    return 0;
+}
@@ -0,0 +1,56 @@
+#ifndef PARTICLE_MESH_H
+#define PARTICLE_MESH_H
+
+#include "body.h"
+#include "fft.h"
+#include "thread_pool.h"
+
+#define PARTICLE_MESH_DEFAULT_GRID 256
+#define PARTICLE_MESH_MIN_GRID 8
+#define PARTICLE_MESH_MAX_GRID 2048  //the padded work grids are 4x this squared, 128 MB each at the cap
+#define PARTICLE_MESH_SPLIT 1.25     //P3M long/short range split scale, in mesh cells
+#define PARTICLE_MESH_CUTOFF 5.0     //short-range pairs are summed out to this many split scales
+#define PARTICLE_MESH_TABLE 4096     //samples of the short-range factor between 0 and the cutoff
+
+// Particle-mesh gravity. Masses are deposited on a gridSize^2 mesh spanning
+// the living bodies with cloud-in-cell weights and convolved with the 1/r^2
+// force kernel through FFTs. The mesh is zero-padded to twice its size, so
+// the result has isolated boundaries like the other engines rather than
+// periodic ones. Accelerations are read back with the same weights, which
+// keeps the mesh force on a pair antisymmetric and the self-force zero.
+//
+// Without the short-range part the kernel is softened by one cell and
+// nothing finer than the mesh is resolved. With it (P3M) the mesh only
+// carries the long-range half of a Gaussian split of every pair's force,
+// and pairs closer than PARTICLE_MESH_CUTOFF split scales add the exact
+// short-range half themselves.
+typedef struct {
+    int gridSize;           //mesh cells per side, a power of two, read at every call
+    int kernelGrid;         //gridSize the work grids and kernel were set up for, 0 for none
+    bool kernelShortRange;  //which kernel is transformed in greenRe/greenIm
+    fft_plan plan;          //2 * kernelGrid points
+    double *re, *im;        //padded work grid: masses in, x/y accelerations out
+    double *greenRe, *greenIm; //transformed kernel, x part real and y part imaginary
+    double *scratch;        //column blocks, one per thread
+    int scratchThreads;
+    double originX, originY; //world position of mesh node (0, 0)
+    double cellSize;         //world units per mesh cell
+    double shortRange[PARTICLE_MESH_TABLE + 2]; //share of a pair's force the mesh leaves out, by distance
+    // Neighbour cells for the short-range pairs, as wide as the cutoff
+    int *cellStart;         //first slot of each cell in order, numCells + 1 entries
+    int *order;             //living bodies sorted by cell
+    int *cellOf;            //cell of each body
+    int numCells;
+    int cellsPerSide;
+    int cellCapacity;
+    int bodyCapacity;
+} particle_mesh;
+
+void particle_mesh_init(particle_mesh *pm, int gridSize);
+void particle_mesh_free(particle_mesh *pm);
+
+// Accelerations of every living body, written to store->ax/ay. shortRange
+// selects P3M. Returns -1 if gridSize is unusable or memory runs out.
+int particle_mesh_gravity(particle_mesh *pm, body_store *store, bool shortRange, thread_pool *pool);
+
+#endif
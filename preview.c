@@ -0,0 +1,210 @@
+#include "preview.h"
+#include "quadtree.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    double x, y, vx, vy;
+    double dt;
+} preview_launch;
+
+struct preview {
+    sim_thread *physics;
+    pthread_t thread;
+    pthread_mutex_t lock;        //guards everything down to pathCount
+    pthread_cond_t wake;
+    unsigned generation;         //bumped by every aim and clear, a running prediction stops when it moves
+    unsigned taken;              //generation the thread last picked up
+    bool aiming;
+    bool freeze;
+    preview_launch launch;
+    double pathX[PREVIEW_STEPS + 1], pathY[PREVIEW_STEPS + 1];
+    int pathCount;               //points handed over, the last aim's path stays until the next one's first points
+    // Only touched by the preview thread
+    body_store field;
+    quadtree tree;
+    double workX[PREVIEW_STEPS + 1], workY[PREVIEW_STEPS + 1];
+    bool started;
+    bool stop;
+};
+
+// Copy the latest physics frame into the frozen field and rebuild its tree
+static void preview_snapshot(preview *p) {
+    const sim_frame *frame = sim_thread_acquire(p->physics);
+    int n = frame->count;
+    if (body_store_reserve(&p->field, n) == 0) {
+        for (int i = 0; i < n; i++) {
+            p->field.x[i] = frame->x[i];
+            p->field.y[i] = frame->y[i];
+            p->field.mass[i] = frame->mass[i];
+            p->field.isAlive[i] = true;
+        }
+        p->field.count = n;
+    }
+    sim_thread_release(p->physics, frame);
+    if (quadtree_build(&p->tree, &p->field) != 0) {
+        p->tree.numNodes = 0; //predict in empty space rather than in half a tree
+    }
+}
+
+static vector preview_acceleration(const preview *p, double x, double y) {
+    // The candidate is in no leaf, skip an index past the last body (-1 would skip inner cells)
+    vector a = quadtree_acceleration(&p->tree, x, y, p->field.count, PREVIEW_THETA);
+    a.x *= GRAVITY_TIMESTEP; //pixels per tick^2, as the simulation's kicks apply it
+    a.y *= GRAVITY_TIMESTEP;
+    return a;
+}
+
+// Hand the points from `from` up to `count` over, unless the aim moved on
+static bool preview_publish(preview *p, unsigned generation, int from, int count) {
+    pthread_mutex_lock(&p->lock);
+    bool current = p->generation == generation;
+    if (current) {
+        memcpy(p->pathX + from, p->workX + from, (count - from) * sizeof(double));
+        memcpy(p->pathY + from, p->workY + from, (count - from) * sizeof(double));
+        p->pathCount = count;
+    }
+    pthread_mutex_unlock(&p->lock);
+    return current;
+}
+
+// Kick-drift-kick leapfrog through the frozen field, the same scheme as
+// simulation_integrate
+static void preview_predict(preview *p, unsigned generation, preview_launch l) {
+    double x = l.x, y = l.y, vx = l.vx, vy = l.vy;
+    vector a = preview_acceleration(p, x, y);
+    p->workX[0] = x;
+    p->workY[0] = y;
+    int published = 0;
+    for (int step = 1; step <= PREVIEW_STEPS; step++) {
+        vx += a.x * l.dt / 2;
+        vy += a.y * l.dt / 2;
+        x += vx * l.dt;
+        y += vy * l.dt;
+        a = preview_acceleration(p, x, y);
+        vx += a.x * l.dt / 2;
+        vy += a.y * l.dt / 2;
+        p->workX[step] = x;
+        p->workY[step] = y;
+
+        if (step % PREVIEW_PUBLISH_STEPS == 0 || step == PREVIEW_STEPS) {
+            if (__atomic_load_n(&p->generation, __ATOMIC_RELAXED) != generation ||
+                !preview_publish(p, generation, published, step + 1)) {
+                return; //the cursor moved, start over from the new launch
+            }
+            published = step + 1;
+        }
+    }
+}
+
+static void *preview_main(void *arg) {
+    preview *p = arg;
+    pthread_mutex_lock(&p->lock);
+    for (;;) {
+        while (!p->stop && p->taken == p->generation) {
+            pthread_cond_wait(&p->wake, &p->lock);
+        }
+        if (p->stop) {
+            break;
+        }
+        unsigned generation = p->taken = p->generation;
+        bool freeze = p->freeze;
+        bool aiming = p->aiming;
+        preview_launch launch = p->launch;
+        p->freeze = false;
+        pthread_mutex_unlock(&p->lock);
+
+        if (freeze) {
+            preview_snapshot(p);
+        }
+        if (aiming) {
+            preview_predict(p, generation, launch);
+        }
+        pthread_mutex_lock(&p->lock);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+preview *preview_start(sim_thread *physics) {
+    preview *p = calloc(1, sizeof(preview));
+    if (!p) {
+        perror("Error allocating memory");
+        return NULL;
+    }
+    p->physics = physics;
+    body_store_init(&p->field);
+    quadtree_init(&p->tree);
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->wake, NULL);
+    if (pthread_create(&p->thread, NULL, preview_main, p) != 0) {
+        printf("Error creating preview thread\n");
+        preview_stop(p);
+        return NULL;
+    }
+    p->started = true;
+    return p;
+}
+
+void preview_stop(preview *p) {
+    if (!p) {
+        return;
+    }
+    if (p->started) {
+        pthread_mutex_lock(&p->lock);
+        p->stop = true;
+        __atomic_store_n(&p->generation, p->generation + 1, __ATOMIC_RELAXED); //cut a prediction short
+        pthread_cond_signal(&p->wake);
+        pthread_mutex_unlock(&p->lock);
+        pthread_join(p->thread, NULL);
+    }
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->wake);
+    body_store_free(&p->field);
+    quadtree_free(&p->tree);
+    free(p);
+}
+
+// Wake the thread for a new generation, with p->lock held
+static void preview_restart(preview *p) {
+    __atomic_store_n(&p->generation, p->generation + 1, __ATOMIC_RELAXED);
+    pthread_cond_signal(&p->wake);
+}
+
+void preview_freeze(preview *p) {
+    pthread_mutex_lock(&p->lock);
+    p->freeze = true;
+    preview_restart(p);
+    pthread_mutex_unlock(&p->lock);
+}
+
+void preview_aim(preview *p, double x, double y, double vx, double vy, double dt) {
+    pthread_mutex_lock(&p->lock);
+    p->aiming = true;
+    p->launch.x = x;
+    p->launch.y = y;
+    p->launch.vx = vx;
+    p->launch.vy = vy;
+    p->launch.dt = dt;
+    preview_restart(p);
+    pthread_mutex_unlock(&p->lock);
+}
+
+void preview_clear(preview *p) {
+    pthread_mutex_lock(&p->lock);
+    p->aiming = false;
+    p->pathCount = 0;
+    preview_restart(p);
+    pthread_mutex_unlock(&p->lock);
+}
+
+int preview_path(preview *p, double *x, double *y, int max) {
+    pthread_mutex_lock(&p->lock);
+    int count = (p->pathCount < max) ? p->pathCount : max;
+    memcpy(x, p->pathX, count * sizeof(double));
+    memcpy(y, p->pathY, count * sizeof(double));
+    pthread_mutex_unlock(&p->lock);
+    return count;
+}
@@ -0,0 +1,37 @@
+#ifndef PREVIEW_H
+#define PREVIEW_H
+
+#include "sim_thread.h"
+
+#define PREVIEW_STEPS 2048       //steps predicted ahead of the cursor
+#define PREVIEW_PUBLISH_STEPS 64 //steps integrated between updates of the drawn path
+#define PREVIEW_THETA 0.8        //opening angle of the frozen field, coarser than the simulation's
+
+// Predicted path of a body that is still being aimed, worked out on a thread
+// of its own so dragging never waits for it.
+//
+// preview_freeze copies the bodies of the latest physics frame into a
+// Barnes-Hut tree once per drag. The bodies stay where they were while the
+// candidate moves through their field, which is what makes each prediction
+// cheap enough to redo on every mouse move. preview_aim cancels whatever is
+// being predicted and starts again from the new launch; the path is handed
+// over every PREVIEW_PUBLISH_STEPS steps, so it grows over the next frames
+// instead of appearing all at once.
+typedef struct preview preview;
+
+preview *preview_start(sim_thread *physics);
+void preview_stop(preview *p);
+
+// Take a new snapshot of the bodies before the next prediction
+void preview_freeze(preview *p);
+// Predict the body launched from (x, y) at (vx, vy) pixels per tick, in
+// steps of dt ticks. The previous path is kept until the new one has points.
+void preview_aim(preview *p, double x, double y, double vx, double vy, double dt);
+// Stop predicting and drop the path
+void preview_clear(preview *p);
+
+// Copy the points predicted so far for the latest aim into x/y, returns how
+// many (at most `max`)
+int preview_path(preview *p, double *x, double *y, int max);
+
+#endif
@@ -0,0 +1,218 @@
+#define _POSIX_C_SOURCE 199309L //clock_gettime
+#include "profile.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct {
+    double samples[PROFILE_WINDOW]; //ring of the most recent durations
+    int count;
+    int next;
+} profile_window;
+
+typedef struct {
+    int phase;
+    double start;    //seconds since the profiler was created
+    double duration;
+} profile_event;
+
+struct profiler {
+    pthread_mutex_t lock;
+    double origin;
+    profile_window windows[PROFILE_COUNT];
+    bool trace;
+    profile_event *events;
+    int numEvents;
+    int eventCapacity;
+    long droppedEvents;
+};
+
+// Name and trace lane of each phase, simulation phases share one lane and
+// the SDL thread's phases another
+static const struct {
+    const char *name;
+    int lane;
+} PHASES[PROFILE_COUNT] = {
+    [PROFILE_STEP] = {"step", 1},
+    [PROFILE_MERGE] = {"merge", 1},
+    [PROFILE_GRAVITY] = {"gravity", 1},
+    [PROFILE_INTEGRATE] = {"integrate", 1},
+    [PROFILE_EVENTS] = {"events", 2},
+    [PROFILE_DRAW] = {"draw", 2},
+    [PROFILE_PRESENT] = {"present", 2},
+    [PROFILE_FRAME] = {"frame", 2},
+};
+
+double profile_clock(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+profiler *profiler_create(bool trace) {
+    profiler *p = calloc(1, sizeof(profiler));
+    if (!p) {
+        perror("Error allocating memory");
+        return NULL;
+    }
+    pthread_mutex_init(&p->lock, NULL);
+    p->origin = profile_clock();
+    p->trace = trace;
+    return p;
+}
+
+void profiler_destroy(profiler *p) {
+    if (!p) {
+        return;
+    }
+    pthread_mutex_destroy(&p->lock);
+    free(p->events);
+    free(p);
+}
+
+const char *profile_phase_name(profile_phase phase) {
+    return PHASES[phase].name;
+}
+
+double profile_begin(const profiler *p) {
+    return p ? profile_clock() : 0;
+}
+
+// Append a trace slice, called with the lock held
+static void profiler_trace(profiler *p, profile_phase phase, double start, double duration) {
+    if (!p->trace) {
+        return;
+    }
+    if (p->numEvents == p->eventCapacity) {
+        int capacity = (p->eventCapacity == 0) ? 4096 : p->eventCapacity * 2;
+        profile_event *events = (capacity <= PROFILE_MAX_EVENTS) ?
+                                realloc(p->events, capacity * sizeof(profile_event)) : NULL;
+        if (!events) {
+            p->droppedEvents++;
+            return;
+        }
+        p->events = events;
+        p->eventCapacity = capacity;
+    }
+    profile_event *e = &p->events[p->numEvents++];
+    e->phase = phase;
+    e->start = start - p->origin;
+    e->duration = duration;
+}
+
+double profile_split(profiler *p, profile_phase phase, double start) {
+    if (!p) {
+        return 0;
+    }
+    double duration = profile_clock() - start;
+    pthread_mutex_lock(&p->lock);
+    profiler_trace(p, phase, start, duration);
+    pthread_mutex_unlock(&p->lock);
+    return duration;
+}
+
+void profile_sample(profiler *p, profile_phase phase, double seconds) {
+    if (!p) {
+        return;
+    }
+    pthread_mutex_lock(&p->lock);
+    profile_window *w = &p->windows[phase];
+    w->samples[w->next] = seconds;
+    w->next = (w->next + 1) % PROFILE_WINDOW;
+    if (w->count < PROFILE_WINDOW) {
+        w->count++;
+    }
+    pthread_mutex_unlock(&p->lock);
+}
+
+void profile_end(profiler *p, profile_phase phase, double start) {
+    if (!p) {
+        return;
+    }
+    profile_sample(p, phase, profile_split(p, phase, start));
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+int profiler_stats(profiler *p, profile_phase phase, double *min, double *avg, double *p99) {
+    double sorted[PROFILE_WINDOW];
+    *min = *avg = *p99 = 0;
+    if (!p) {
+        return 0;
+    }
+    pthread_mutex_lock(&p->lock);
+    int count = p->windows[phase].count;
+    memcpy(sorted, p->windows[phase].samples, count * sizeof(double));
+    pthread_mutex_unlock(&p->lock);
+
+    if (count == 0) {
+        return 0;
+    }
+    qsort(sorted, count, sizeof(double), compare_doubles);
+    double sum = 0;
+    for (int i = 0; i < count; i++) {
+        sum += sorted[i];
+    }
+    *min = sorted[0];
+    *avg = sum / count;
+    *p99 = sorted[(count * 99 - 1) / 100]; //nearest rank
+    return count;
+}
+
+void profiler_report(profiler *p) {
+    if (!p) {
+        printf("nothing was profiled\n");
+        return;
+    }
+    printf("%-10s %10s %10s %10s %8s\n", "phase", "min ms", "avg ms", "p99 ms", "samples");
+    for (int i = 0; i < PROFILE_COUNT; i++) {
+        double min, avg, p99;
+        int count = profiler_stats(p, i, &min, &avg, &p99);
+        if (count > 0) {
+            printf("%-10s %10.3f %10.3f %10.3f %8d\n", PHASES[i].name, min * 1e3, avg * 1e3, p99 * 1e3, count);
+        }
+    }
+}
+
+int profiler_write_trace(profiler *p, const char *path) {
+    if (!p) {
+        printf("nothing was profiled, no trace written\n");
+        return -1;
+    }
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        perror("Error opening trace");
+        return -1;
+    }
+    pthread_mutex_lock(&p->lock);
+    // Complete ("X") events, timestamps and durations in microseconds
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"simulation\"}},\n");
+    fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"render\"}}");
+    for (int i = 0; i < p->numEvents; i++) {
+        const profile_event *e = &p->events[i];
+        fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                PHASES[e->phase].name, PHASES[e->phase].lane, e->start * 1e6, e->duration * 1e6);
+    }
+    fprintf(file, "\n]}\n");
+    int numEvents = p->numEvents;
+    long dropped = p->droppedEvents;
+    pthread_mutex_unlock(&p->lock);
+
+    if (fclose(file) != 0) {
+        perror("Error writing trace");
+        return -1;
+    }
+    printf("trace of %d slices written to %s", numEvents, path);
+    if (dropped > 0) {
+        printf(" (%ld more dropped, the trace is full)", dropped);
+    }
+    printf("\n");
+    return 0;
+}
@@ -0,0 +1,54 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdbool.h>
+
+#define PROFILE_WINDOW 240          //samples kept per phase for the rolling statistics
+#define PROFILE_MAX_EVENTS 1000000  //trace slices kept before tracing stops
+
+typedef enum {
+    PROFILE_STEP,       //simulation_step as a whole
+    PROFILE_MERGE,
+    PROFILE_GRAVITY,
+    PROFILE_INTEGRATE,  //kicks and drift, without the gravity in between
+    PROFILE_EVENTS,     //SDL event polling
+    PROFILE_DRAW,       //building the frame's vertex batch
+    PROFILE_PRESENT,    //SDL_RenderGeometry and SDL_RenderPresent
+    PROFILE_FRAME,      //whole rendered frame, without the frame limiter's delay
+    PROFILE_COUNT
+} profile_phase;
+
+// Rolling timings for each phase plus an optional Chrome trace. Phases may
+// be timed from different threads.
+typedef struct profiler profiler;
+
+profiler *profiler_create(bool trace);
+void profiler_destroy(profiler *p);
+
+const char *profile_phase_name(profile_phase phase);
+
+// Monotonic clock in seconds
+double profile_clock(void);
+
+// Every timing call takes a NULL profiler and then does nothing, so call
+// sites need no checks of their own
+double profile_begin(const profiler *p);
+// Record the time since `start` as one sample of `phase`
+void profile_end(profiler *p, profile_phase phase, double start);
+// Record the time since `start` in the trace only and return it, for a
+// phase timed in several pieces; profile_sample then adds up the pieces
+double profile_split(profiler *p, profile_phase phase, double start);
+void profile_sample(profiler *p, profile_phase phase, double seconds);
+
+// Minimum, mean and 99th percentile of the last PROFILE_WINDOW samples in
+// seconds. Returns the number of samples they cover, 0 if there are none
+// (or no profiler).
+int profiler_stats(profiler *p, profile_phase phase, double *min, double *avg, double *p99);
+
+// Print the statistics of every phase that has samples
+void profiler_report(profiler *p);
+// Write the trace in Chrome trace_event JSON (chrome://tracing, Perfetto).
+// Returns -1 without a profiler, as there is nothing to write.
+int profiler_write_trace(profiler *p, const char *path);
+
+#endif
@@ -0,0 +1,336 @@
+#include "quadtree.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+void quadtree_init(quadtree *tree) {
+    tree->nodes = NULL;
+    tree->numNodes = 0;
+    tree->capacity = 0;
+    tree->members = NULL;
+    tree->numMembers = 0;
+    tree->memberCapacity = 0;
+}
+
+void quadtree_free(quadtree *tree) {
+    free(tree->nodes);
+    free(tree->members);
+    quadtree_init(tree);
+}
+
+// Record body `index` at (x, y) as a member of a folded leaf, in front of
+// `next`. Returns the record's index, -1 if realloc fails.
+static int quadtree_new_member(quadtree *tree, int index, double x, double y, double mass, int next) {
+    if (tree->numMembers == tree->memberCapacity) {
+        int capacity = (tree->memberCapacity == 0) ? 16 : tree->memberCapacity * 2;
+        quadtree_member *members = realloc(tree->members, capacity * sizeof(quadtree_member));
+        if (!members) {
+            perror("Error reallocating memory");
+            return -1;
+        }
+        tree->members = members;
+        tree->memberCapacity = capacity;
+    }
+    quadtree_member *m = &tree->members[tree->numMembers];
+    m->x = x;
+    m->y = y;
+    m->mass = mass;
+    m->body = index;
+    m->next = next;
+    return tree->numMembers++;
+}
+
+// Mass and centre of mass of leaf `n` without body `self`. Returns false
+// when nothing is left of it.
+static bool quadtree_leaf_without(const quadtree *tree, const quadtree_node *n, int self,
+                                  double *mass, double *com_x, double *com_y) {
+    *mass = n->mass;
+    *com_x = n->com_x;
+    *com_y = n->com_y;
+    if (n->members == -1) {
+        return n->body != self;
+    }
+    for (int k = n->members; k != -1; k = tree->members[k].next) {
+        const quadtree_member *m = &tree->members[k];
+        if (m->body != self) {
+            continue;
+        }
+        double rest = n->mass - m->mass;
+        if (rest <= 0) {
+            return false;
+        }
+        *com_x = (n->com_x * n->mass - m->x * m->mass) / rest;
+        *com_y = (n->com_y * n->mass - m->y * m->mass) / rest;
+        *mass = rest;
+        break;
+    }
+    return true;
+}
+
+// Append an empty cell and return its index, -1 if realloc fails.
+// Any quadtree_node pointer held by the caller is invalid after this call.
+static int quadtree_new_node(quadtree *tree, double center_x, double center_y, double half_size) {
+    if (tree->numNodes == tree->capacity) {
+        int capacity = (tree->capacity == 0) ? 64 : tree->capacity * 2;
+        quadtree_node *nodes = realloc(tree->nodes, capacity * sizeof(quadtree_node));
+        if (!nodes) {
+            perror("Error reallocating memory");
+            return -1;
+        }
+        tree->nodes = nodes;
+        tree->capacity = capacity;
+    }
+
+    quadtree_node *node = &tree->nodes[tree->numNodes];
+    node->center_x = center_x;
+    node->center_y = center_y;
+    node->half_size = half_size;
+    node->mass = 0;
+    node->com_x = center_x;
+    node->com_y = center_y;
+    node->com_offset = 0;
+    for (int i = 0; i < 4; i++) {
+        node->children[i] = -1;
+    }
+    node->body = -1;
+    node->members = -1;
+
+    return tree->numNodes++;
+}
+
+static int quadrant_of(const quadtree_node *node, double x, double y) {
+    return (x >= node->center_x) | ((y >= node->center_y) << 1);
+}
+
+// Return the child of `parent` covering quadrant q, creating it if needed
+static int quadtree_child(quadtree *tree, int parent, int q) {
+    if (tree->nodes[parent].children[q] != -1) {
+        return tree->nodes[parent].children[q];
+    }
+    double half = tree->nodes[parent].half_size / 2;
+    double cx = tree->nodes[parent].center_x + ((q & 1) ? half : -half);
+    double cy = tree->nodes[parent].center_y + ((q & 2) ? half : -half);
+    int child = quadtree_new_node(tree, cx, cy, half);
+    if (child != -1) {
+        tree->nodes[parent].children[q] = child;
+    }
+    return child;
+}
+
+static int quadtree_insert(quadtree *tree, const body_store *store, int index) {
+    double x = store->x[index];
+    double y = store->y[index];
+    double mass = store->mass[index];
+    int node = 0;
+
+    for (int depth = 0; ; depth++) {
+        quadtree_node *n = &tree->nodes[node];
+        bool isLeaf = n->children[0] == -1 && n->children[1] == -1 &&
+                      n->children[2] == -1 && n->children[3] == -1;
+
+        if (isLeaf && n->body == -1 && n->mass == 0) {
+            // Empty leaf, the body lives here
+            n->body = index;
+            n->mass = mass;
+            n->com_x = x;
+            n->com_y = y;
+            return 0;
+        }
+
+        if (isLeaf && depth >= QUADTREE_MAX_DEPTH) {
+            // (Nearly) coincident bodies, fold them into one point mass and
+            // keep a record of each so they can leave themselves out
+            if (n->members == -1) {
+                int first = quadtree_new_member(tree, n->body, n->com_x, n->com_y, n->mass, -1);
+                if (first == -1) {
+                    return -1;
+                }
+                n->members = first;
+            }
+            int member = quadtree_new_member(tree, index, x, y, mass, n->members);
+            if (member == -1) {
+                return -1;
+            }
+            n->members = member;
+            double total = n->mass + mass;
+            if (total > 0) {
+                n->com_x = (n->com_x * n->mass + x * mass) / total;
+                n->com_y = (n->com_y * n->mass + y * mass) / total;
+            }
+            n->mass = total;
+            return 0;
+        }
+
+        if (isLeaf) {
+            // Occupied leaf, push its body one level down before descending
+            int old = n->body;
+            n->body = -1;
+            int child = quadtree_child(tree, node, quadrant_of(n, store->x[old], store->y[old]));
+            if (child == -1) {
+                return -1;
+            }
+            quadtree_node *c = &tree->nodes[child];
+            c->body = old;
+            c->mass = store->mass[old];
+            c->com_x = store->x[old];
+            c->com_y = store->y[old];
+        }
+
+        node = quadtree_child(tree, node, quadrant_of(&tree->nodes[node], x, y));
+        if (node == -1) {
+            return -1;
+        }
+    }
+}
+
+int quadtree_build(quadtree *tree, const body_store *store) {
+    tree->numNodes = 0;
+    tree->numMembers = 0;
+
+    double min_x = INFINITY, min_y = INFINITY;
+    double max_x = -INFINITY, max_y = -INFINITY;
+    for (int i = 0; i < store->count; i++) {
+        if (!store->isAlive[i]) {
+            continue;
+        }
+        min_x = fmin(min_x, store->x[i]);
+        min_y = fmin(min_y, store->y[i]);
+        max_x = fmax(max_x, store->x[i]);
+        max_y = fmax(max_y, store->y[i]);
+    }
+    if (min_x > max_x) {
+        // No living bodies, leave an empty root so lookups still work
+        return quadtree_new_node(tree, 0, 0, 1) == -1 ? -1 : 0;
+    }
+
+    // Square root cell, padded so bodies on the max edge fall inside it
+    double half_size = fmax(max_x - min_x, max_y - min_y) / 2 * 1.0001 + 1e-9;
+    if (quadtree_new_node(tree, (min_x + max_x) / 2, (min_y + max_y) / 2, half_size) == -1) {
+        return -1;
+    }
+
+    for (int i = 0; i < store->count; i++) {
+        if (store->isAlive[i] && quadtree_insert(tree, store, i) == -1) {
+            return -1;
+        }
+    }
+
+    // Children always come after their parent, so a reverse sweep sees
+    // every child before the cell that contains it
+    for (int i = tree->numNodes - 1; i >= 0; i--) {
+        quadtree_node *n = &tree->nodes[i];
+        double mass = 0, mx = 0, my = 0;
+        bool isLeaf = true;
+        for (int q = 0; q < 4; q++) {
+            if (n->children[q] == -1) {
+                continue;
+            }
+            const quadtree_node *c = &tree->nodes[n->children[q]];
+            mass += c->mass;
+            mx += c->com_x * c->mass;
+            my += c->com_y * c->mass;
+            isLeaf = false;
+        }
+        if (isLeaf) {
+            continue;
+        }
+        n->mass = mass;
+        if (mass > 0) {
+            n->com_x = mx / mass;
+            n->com_y = my / mass;
+        }
+        n->com_offset = sqrt(pow(n->com_x - n->center_x, 2) + pow(n->com_y - n->center_y, 2));
+    }
+
+    return 0;
+}
+
+vector quadtree_acceleration(const quadtree *tree, double x, double y, int self, double theta) {
+    vector acceleration = {0, 0};
+    if (tree->numNodes == 0) {
+        return acceleration;
+    }
+
+    int stack[4 * (QUADTREE_MAX_DEPTH + 2)];
+    int top = 0;
+    stack[top++] = 0;
+
+    while (top > 0) {
+        const quadtree_node *n = &tree->nodes[stack[--top]];
+        bool isLeaf = n->children[0] == -1 && n->children[1] == -1 &&
+                      n->children[2] == -1 && n->children[3] == -1;
+        double mass = n->mass, com_x = n->com_x, com_y = n->com_y;
+        if (mass == 0 || (isLeaf && !quadtree_leaf_without(tree, n, self, &mass, &com_x, &com_y))) {
+            continue;
+        }
+
+        double dx = com_x - x;
+        double dy = com_y - y;
+        double d2 = dx * dx + dy * dy;
+
+        // Opening distance is width / theta, pushed out by how far the centre
+        // of mass sits from the cell centre so lopsided cells are not trusted
+        // by points that are close to their far edge
+        double open = 2 * n->half_size / theta + n->com_offset;
+
+        if (isLeaf || open * open < d2) {
+            if (d2 == 0) {
+                continue; //coincident point, no defined direction
+            }
+            double inv_d = 1 / sqrt(d2);
+            double a = GRAVITATIONAL_CONSTANT * mass * inv_d * inv_d * inv_d;
+            acceleration.x += a * dx;
+            acceleration.y += a * dy;
+            continue;
+        }
+
+        for (int q = 0; q < 4; q++) {
+            if (n->children[q] != -1) {
+                stack[top++] = n->children[q];
+            }
+        }
+    }
+
+    return acceleration;
+}
+
+double quadtree_potential(const quadtree *tree, double x, double y, int self, double theta) {
+    double potential = 0;
+    if (tree->numNodes == 0) {
+        return potential;
+    }
+
+    int stack[4 * (QUADTREE_MAX_DEPTH + 2)];
+    int top = 0;
+    stack[top++] = 0;
+
+    while (top > 0) {
+        const quadtree_node *n = &tree->nodes[stack[--top]];
+        bool isLeaf = n->children[0] == -1 && n->children[1] == -1 &&
+                      n->children[2] == -1 && n->children[3] == -1;
+        double mass = n->mass, com_x = n->com_x, com_y = n->com_y;
+        if (mass == 0 || (isLeaf && !quadtree_leaf_without(tree, n, self, &mass, &com_x, &com_y))) {
+            continue;
+        }
+
+        double dx = com_x - x;
+        double dy = com_y - y;
+        double d2 = dx * dx + dy * dy;
+        double open = 2 * n->half_size / theta + n->com_offset;
+
+        if (isLeaf || open * open < d2) {
+            if (d2 > 0) {
+                potential -= GRAVITATIONAL_CONSTANT * mass / sqrt(d2);
+            }
+            continue;
+        }
+
+        for (int q = 0; q < 4; q++) {
+            if (n->children[q] != -1) {
+                stack[top++] = n->children[q];
+            }
+        }
+    }
+
+    return potential;
+}
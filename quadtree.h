@@ -0,0 +1,51 @@
+#ifndef QUADTREE_H
+#define QUADTREE_H
+
+#include "body.h"
+
+#define QUADTREE_MAX_DEPTH 48 //bodies closer than this many subdivisions share one leaf
+
+typedef struct {
+    double center_x, center_y; //centre of the square cell
+    double half_size;          //half the side length of the cell
+    double mass;               //total mass inside the cell
+    double com_x, com_y;       //centre of mass of the cell
+    double com_offset;         //distance from the cell centre to its centre of mass
+    int children[4];           //child node indices, -1 when the quadrant is empty
+    int body;                  //index of the body held by a leaf, -1 otherwise
+    int members;               //first record of a folded leaf's bodies, -1 unless several share it
+} quadtree_node;
+
+// One of the bodies folded into a leaf at QUADTREE_MAX_DEPTH, so each can
+// still leave itself out of the leaf's point mass
+typedef struct {
+    double x, y, mass;
+    int body;
+    int next;                  //next record of the same leaf, -1 for the last
+} quadtree_member;
+
+typedef struct {
+    quadtree_node *nodes; //node 0 is the root
+    int numNodes;
+    int capacity;
+    quadtree_member *members;
+    int numMembers;
+    int memberCapacity;
+} quadtree;
+
+void quadtree_init(quadtree *tree);
+void quadtree_free(quadtree *tree);
+
+// Rebuild the tree from the living bodies, returns -1 if memory runs out
+int quadtree_build(quadtree *tree, const body_store *store);
+
+// Gravitational acceleration at (x, y), leaving out body `self` (its own
+// share of a folded leaf too).
+// A cell is treated as a point mass when its width / distance < theta, so
+// theta = 0 degenerates to the exact direct sum.
+vector quadtree_acceleration(const quadtree *tree, double x, double y, int self, double theta);
+
+// Gravitational potential (-G * sum m / d) at (x, y) under the same opening rule
+double quadtree_potential(const quadtree *tree, double x, double y, int self, double theta);
+
+#endif
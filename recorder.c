@@ -0,0 +1,460 @@
+#define _POSIX_C_SOURCE 199309L //nanosleep
+#include "recorder.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define RECORDER_VERSION 1
+#define RECORD_ABSOLUTE 1 //position is absolute rather than a delta
+#define RECORD_LOOK 2     //radius and color follow
+#define RECORD_MAX_BYTES 40 //worst case encoded size of one body
+#define RECORDER_QUANTUM_LIMIT 4.5e15 //quantized positions are clamped to what a double holds exactly
+
+struct recorder {
+    FILE *file;
+    int stride;
+    double quantum;
+    recorder_frame *ring;
+    int ringSize;
+    bool waitWhenFull;
+    unsigned long head;   //next slot the simulation fills, only it writes this
+    unsigned long tail;   //next slot the writer drains, only it writes this
+    int closing;
+    pthread_t thread;
+    recorder_track track;
+    uint8_t *buffer;
+    size_t bufferSize;
+    long framesWritten;
+    long framesDropped;   //only touched by the producer
+    long bytesWritten;
+    long bodiesWritten;
+};
+
+static int frame_reserve(recorder_frame *f, int count) {
+    if (count <= f->capacity) {
+        return 0;
+    }
+    int capacity = (f->capacity == 0) ? 64 : f->capacity;
+    while (capacity < count) {
+        capacity *= 2;
+    }
+    int32_t *id = realloc(f->id, capacity * sizeof(int32_t));
+    if (id) f->id = id;
+    double *x = realloc(f->x, capacity * sizeof(double));
+    if (x) f->x = x;
+    double *y = realloc(f->y, capacity * sizeof(double));
+    if (y) f->y = y;
+    double *radius = realloc(f->radius, capacity * sizeof(double));
+    if (radius) f->radius = radius;
+    SDL_Color *color = realloc(f->color, capacity * sizeof(SDL_Color));
+    if (color) f->color = color;
+    if (!id || !x || !y || !radius || !color) {
+        perror("Error reallocating memory");
+        return -1;
+    }
+    f->capacity = capacity;
+    return 0;
+}
+
+static void frame_free(recorder_frame *f) {
+    free(f->id);
+    free(f->x);
+    free(f->y);
+    free(f->radius);
+    free(f->color);
+    memset(f, 0, sizeof(*f));
+}
+
+static int track_reserve(recorder_track *t, int id) {
+    if (id < t->capacity) {
+        return 0;
+    }
+    int capacity = (t->capacity == 0) ? 64 : t->capacity;
+    while (capacity <= id) {
+        capacity *= 2;
+    }
+    int64_t *qx = realloc(t->qx, capacity * sizeof(int64_t));
+    if (qx) t->qx = qx;
+    int64_t *qy = realloc(t->qy, capacity * sizeof(int64_t));
+    if (qy) t->qy = qy;
+    int64_t *qradius = realloc(t->qradius, capacity * sizeof(int64_t));
+    if (qradius) t->qradius = qradius;
+    SDL_Color *color = realloc(t->color, capacity * sizeof(SDL_Color));
+    if (color) t->color = color;
+    long *seen = realloc(t->seen, capacity * sizeof(long));
+    if (seen) t->seen = seen;
+    if (!qx || !qy || !qradius || !color || !seen) {
+        perror("Error reallocating memory");
+        return -1;
+    }
+    for (int i = t->capacity; i < capacity; i++) {
+        t->seen[i] = -1;
+    }
+    t->capacity = capacity;
+    return 0;
+}
+
+static void track_free(recorder_track *t) {
+    free(t->qx);
+    free(t->qy);
+    free(t->qradius);
+    free(t->color);
+    free(t->seen);
+    memset(t, 0, sizeof(*t));
+}
+
+static int64_t quantize(double value, double quantum) {
+    double q = round(value / quantum);
+    if (q > RECORDER_QUANTUM_LIMIT) q = RECORDER_QUANTUM_LIMIT;
+    if (q < -RECORDER_QUANTUM_LIMIT) q = -RECORDER_QUANTUM_LIMIT;
+    return (int64_t)q;
+}
+
+// Small magnitudes of either sign become small unsigned numbers
+static uint64_t zigzag(int64_t n) {
+    return ((uint64_t)n << 1) ^ (uint64_t)(n >> 63);
+}
+
+static int64_t unzigzag(uint64_t n) {
+    return (int64_t)(n >> 1) ^ -(int64_t)(n & 1);
+}
+
+static uint8_t *put_varint(uint8_t *out, uint64_t n) {
+    while (n >= 0x80) {
+        *out++ = (uint8_t)(n | 0x80);
+        n >>= 7;
+    }
+    *out++ = (uint8_t)n;
+    return out;
+}
+
+static const uint8_t *get_varint(const uint8_t *in, const uint8_t *end, uint64_t *n) {
+    *n = 0;
+    for (int shift = 0; in < end && shift < 64; shift += 7) {
+        uint8_t byte = *in++;
+        *n |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return in;
+        }
+    }
+    return NULL; //truncated or overlong
+}
+
+// Encode one frame as deltas against the track and write it with its length
+static int recorder_write_frame(recorder *rec, const recorder_frame *f) {
+    size_t needed = 32 + (size_t)f->count * RECORD_MAX_BYTES;
+    if (needed > rec->bufferSize) {
+        uint8_t *buffer = realloc(rec->buffer, needed);
+        if (!buffer) {
+            perror("Error reallocating memory");
+            return -1;
+        }
+        rec->buffer = buffer;
+        rec->bufferSize = needed;
+    }
+
+    bool keyframe = rec->framesWritten % RECORDER_KEYFRAME_INTERVAL == 0;
+    recorder_track *t = &rec->track;
+    uint8_t *out = rec->buffer;
+    out = put_varint(out, (uint64_t)f->step);
+    out = put_varint(out, (uint64_t)f->count);
+
+    int32_t prevId = 0;
+    for (int i = 0; i < f->count; i++) {
+        int id = f->id[i];
+        if (track_reserve(t, id) != 0) {
+            return -1;
+        }
+        int64_t qx = quantize(f->x[i], rec->quantum);
+        int64_t qy = quantize(f->y[i], rec->quantum);
+        int64_t qradius = quantize(f->radius[i], rec->quantum);
+        SDL_Color c = f->color[i];
+
+        uint8_t flags = 0;
+        if (keyframe || t->seen[id] < 0) {
+            flags = RECORD_ABSOLUTE | RECORD_LOOK;
+        } else if (t->qradius[id] != qradius || memcmp(&t->color[id], &c, sizeof(c)) != 0) {
+            flags = RECORD_LOOK;
+        }
+
+        out = put_varint(out, zigzag((int64_t)id - prevId));
+        *out++ = flags;
+        if (flags & RECORD_ABSOLUTE) {
+            out = put_varint(out, zigzag(qx));
+            out = put_varint(out, zigzag(qy));
+        } else {
+            out = put_varint(out, zigzag(qx - t->qx[id]));
+            out = put_varint(out, zigzag(qy - t->qy[id]));
+        }
+        if (flags & RECORD_LOOK) {
+            out = put_varint(out, zigzag(qradius));
+            *out++ = c.r;
+            *out++ = c.g;
+            *out++ = c.b;
+            *out++ = c.a;
+        }
+
+        t->qx[id] = qx;
+        t->qy[id] = qy;
+        t->qradius[id] = qradius;
+        t->color[id] = c;
+        t->seen[id] = rec->framesWritten;
+        prevId = id;
+    }
+
+    uint32_t size = (uint32_t)(out - rec->buffer);
+    if (fwrite(&size, sizeof(size), 1, rec->file) != 1 || fwrite(rec->buffer, 1, size, rec->file) != size) {
+        perror("Error writing recording");
+        return -1;
+    }
+    rec->framesWritten++;
+    rec->bytesWritten += sizeof(size) + size;
+    rec->bodiesWritten += f->count;
+    return 0;
+}
+
+static void *recorder_main(void *arg) {
+    recorder *rec = arg;
+    bool failed = false;
+    while (true) {
+        unsigned long head = __atomic_load_n(&rec->head, __ATOMIC_ACQUIRE);
+        if (rec->tail == head) {
+            if (__atomic_load_n(&rec->closing, __ATOMIC_ACQUIRE) &&
+                __atomic_load_n(&rec->head, __ATOMIC_ACQUIRE) == rec->tail) {
+                break;
+            }
+            struct timespec nap = {0, 100000}; //0.1 ms, the ring absorbs the wait
+            nanosleep(&nap, NULL);
+            continue;
+        }
+        // After a write error keep draining so the simulation is never held up
+        if (!failed && recorder_write_frame(rec, &rec->ring[rec->tail % rec->ringSize]) != 0) {
+            failed = true;
+        }
+        __atomic_store_n(&rec->tail, rec->tail + 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+recorder *recorder_open(const char *path, int stride, double quantum, int ringFrames, bool waitWhenFull) {
+    recorder *rec = calloc(1, sizeof(recorder));
+    if (!rec) {
+        perror("Error allocating memory");
+        return NULL;
+    }
+    rec->stride = (stride < 1) ? 1 : stride;
+    rec->quantum = (quantum > 0) ? quantum : RECORDER_DEFAULT_QUANTUM;
+    rec->ringSize = (ringFrames < 2) ? 2 : ringFrames;
+    rec->waitWhenFull = waitWhenFull;
+    rec->ring = calloc(rec->ringSize, sizeof(recorder_frame));
+    rec->file = fopen(path, "wb");
+    if (!rec->ring || !rec->file) {
+        perror("Error opening recording");
+        if (rec->file) fclose(rec->file);
+        free(rec->ring);
+        free(rec);
+        return NULL;
+    }
+
+    uint32_t version = RECORDER_VERSION;
+    uint32_t stride32 = rec->stride;
+    fwrite(RECORDER_MAGIC, 1, 8, rec->file);
+    fwrite(&version, sizeof(version), 1, rec->file);
+    fwrite(&stride32, sizeof(stride32), 1, rec->file);
+    fwrite(&rec->quantum, sizeof(rec->quantum), 1, rec->file);
+
+    if (pthread_create(&rec->thread, NULL, recorder_main, rec) != 0) {
+        printf("Error creating recorder thread\n");
+        fclose(rec->file);
+        free(rec->ring);
+        free(rec);
+        return NULL;
+    }
+    return rec;
+}
+
+void recorder_submit(recorder *rec, const body_store *store, const body_store *cold, long step) {
+    if (step % rec->stride != 0) {
+        return;
+    }
+    unsigned long head = rec->head;
+    while (head - __atomic_load_n(&rec->tail, __ATOMIC_ACQUIRE) == (unsigned long)rec->ringSize) {
+        if (!rec->waitWhenFull) {
+            rec->framesDropped++; //writer is behind, an interactive run does not stall for it
+            return;
+        }
+        struct timespec nap = {0, 100000};
+        nanosleep(&nap, NULL);
+    }
+
+    recorder_frame *f = &rec->ring[head % rec->ringSize];
+    if (frame_reserve(f, store->count + (cold ? cold->count : 0)) != 0) {
+        rec->framesDropped++;
+        return;
+    }
+    int n = 0;
+    for (const body_store *from = store; from; from = (from == store) ? cold : NULL) {
+        for (int i = 0; i < from->count; i++) {
+            if (!from->isAlive[i]) {
+                continue;
+            }
+            f->id[n] = from->id[i];
+            f->x[n] = from->x[i];
+            f->y[n] = from->y[i];
+            f->radius[n] = from->radius[i];
+            f->color[n] = from->color[i];
+            n++;
+        }
+    }
+    f->count = n;
+    f->step = step;
+    __atomic_store_n(&rec->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void recorder_close(recorder *rec) {
+    if (!rec) {
+        return;
+    }
+    __atomic_store_n(&rec->closing, 1, __ATOMIC_RELEASE);
+    pthread_join(rec->thread, NULL);
+    fclose(rec->file);
+
+    long raw = rec->bodiesWritten * (long)(sizeof(int32_t) + 3 * sizeof(double) + sizeof(SDL_Color));
+    printf("recorder: %ld frames written, %ld dropped, %ld bytes (%.1f%% of raw)\n",
+           rec->framesWritten, rec->framesDropped, rec->bytesWritten,
+           (raw > 0) ? 100.0 * rec->bytesWritten / raw : 0);
+
+    for (int i = 0; i < rec->ringSize; i++) {
+        frame_free(&rec->ring[i]);
+    }
+    free(rec->ring);
+    track_free(&rec->track);
+    free(rec->buffer);
+    free(rec);
+}
+
+int replay_open(replay *r, const char *path) {
+    memset(r, 0, sizeof(*r));
+    r->file = fopen(path, "rb");
+    if (!r->file) {
+        perror("Error opening recording");
+        return -1;
+    }
+    char magic[8];
+    uint32_t version, stride;
+    if (fread(magic, 1, 8, r->file) != 8 || memcmp(magic, RECORDER_MAGIC, 8) != 0 ||
+        fread(&version, sizeof(version), 1, r->file) != 1 || version != RECORDER_VERSION ||
+        fread(&stride, sizeof(stride), 1, r->file) != 1 ||
+        fread(&r->quantum, sizeof(r->quantum), 1, r->file) != 1) {
+        printf("%s is not a version %d recording\n", path, RECORDER_VERSION);
+        fclose(r->file);
+        r->file = NULL;
+        return -1;
+    }
+    r->stride = stride;
+    return 0;
+}
+
+int replay_next(replay *r) {
+    uint32_t size;
+    if (fread(&size, sizeof(size), 1, r->file) != 1) {
+        return 0;
+    }
+    if (size > r->bufferSize) {
+        uint8_t *buffer = realloc(r->buffer, size);
+        if (!buffer) {
+            perror("Error reallocating memory");
+            return -1;
+        }
+        r->buffer = buffer;
+        r->bufferSize = size;
+    }
+    if (fread(r->buffer, 1, size, r->file) != size) {
+        printf("Recording ends in the middle of a frame\n");
+        return -1;
+    }
+
+    const uint8_t *in = r->buffer;
+    const uint8_t *end = r->buffer + size;
+    uint64_t step, count;
+    if (!(in = get_varint(in, end, &step)) || !(in = get_varint(in, end, &count)) ||
+        count > size || frame_reserve(&r->frame, (int)count) != 0) {
+        printf("Corrupt frame header in recording\n");
+        return -1;
+    }
+
+    recorder_track *t = &r->track;
+    int64_t id = 0;
+    for (uint64_t i = 0; i < count; i++) {
+        uint64_t delta, px, py, qradius;
+        if (!(in = get_varint(in, end, &delta)) || in >= end) {
+            printf("Corrupt body record in recording\n");
+            return -1;
+        }
+        id += unzigzag(delta);
+        uint8_t flags = *in++;
+        if (id < 0 || id > INT32_MAX || track_reserve(t, (int)id) != 0 ||
+            !(in = get_varint(in, end, &px)) || !(in = get_varint(in, end, &py))) {
+            printf("Corrupt body record in recording\n");
+            return -1;
+        }
+        if (!(flags & RECORD_ABSOLUTE) && t->seen[id] < 0) {
+            printf("Recording has a delta for body %d before its first appearance\n", (int)id);
+            return -1;
+        }
+        if (flags & RECORD_ABSOLUTE) {
+            t->qx[id] = unzigzag(px);
+            t->qy[id] = unzigzag(py);
+        } else {
+            t->qx[id] += unzigzag(px);
+            t->qy[id] += unzigzag(py);
+        }
+        if (flags & RECORD_LOOK) {
+            if (!(in = get_varint(in, end, &qradius)) || end - in < 4) {
+                printf("Corrupt body record in recording\n");
+                return -1;
+            }
+            t->qradius[id] = unzigzag(qradius);
+            t->color[id].r = in[0];
+            t->color[id].g = in[1];
+            t->color[id].b = in[2];
+            t->color[id].a = in[3];
+            in += 4;
+        }
+        t->seen[id] = r->frames;
+
+        r->frame.id[i] = (int32_t)id;
+        r->frame.x[i] = t->qx[id] * r->quantum;
+        r->frame.y[i] = t->qy[id] * r->quantum;
+        r->frame.radius[i] = t->qradius[id] * r->quantum;
+        r->frame.color[i] = t->color[id];
+    }
+    r->frame.count = (int)count;
+    r->frame.step = (long)step;
+    r->frames++;
+    return 1;
+}
+
+int replay_rewind(replay *r) {
+    // Skip the file header, every body is absolute again in frame 0
+    if (fseek(r->file, 8 + 2 * sizeof(uint32_t) + sizeof(double), SEEK_SET) != 0) {
+        return -1;
+    }
+    for (int i = 0; i < r->track.capacity; i++) {
+        r->track.seen[i] = -1;
+    }
+    r->frames = 0;
+    return 0;
+}
+
+void replay_close(replay *r) {
+    if (r->file) {
+        fclose(r->file);
+    }
+    frame_free(&r->frame);
+    track_free(&r->track);
+    free(r->buffer);
+    memset(r, 0, sizeof(*r));
+}
@@ -0,0 +1,67 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include "body.h"
+#include <stdint.h>
+#include <stdio.h>
+
+#define RECORDER_MAGIC "GRAVREC1"
+#define RECORDER_DEFAULT_QUANTUM (1.0 / 16) //pixels, positions are stored as multiples of this
+#define RECORDER_DEFAULT_RING 64            //frames the simulation can run ahead of the writer
+#define RECORDER_KEYFRAME_INTERVAL 256      //every this many frames all bodies are stored absolute
+
+// One sampled step, copied out of the body store by the simulation thread
+typedef struct {
+    long step;
+    int count;
+    int capacity;
+    int32_t *id;
+    double *x, *y;
+    double *radius;
+    SDL_Color *color;
+} recorder_frame;
+
+// Last value written (or read) for each body id, the base for the next delta
+typedef struct {
+    int64_t *qx, *qy;
+    int64_t *qradius;
+    SDL_Color *color;
+    long *seen;        //frame number the id was last present in, -1 if never
+    int capacity;
+} recorder_track;
+
+// Trajectory recorder. The simulation thread is the only producer and the
+// writer thread the only consumer of a lock-free ring of frames, so
+// recorder_submit only waits on the disk when the ring is full and the
+// recorder was opened with waitWhenFull (headless runs that want every
+// frame); otherwise a frame that does not fit is dropped and counted.
+typedef struct recorder recorder;
+
+recorder *recorder_open(const char *path, int stride, double quantum, int ringFrames, bool waitWhenFull);
+// Sample the store, then `cold` (the far-field tier, may be NULL), if `step`
+// falls on the stride. Called after each step.
+void recorder_submit(recorder *rec, const body_store *store, const body_store *cold, long step);
+// Flush everything still in the ring, stop the writer and close the file
+void recorder_close(recorder *rec);
+
+// Sequential reader for recordings, decodes one frame at a time
+typedef struct {
+    FILE *file;
+    double quantum;
+    int stride;
+    long frames;         //frames decoded so far
+    recorder_frame frame;
+    recorder_track track;
+    uint8_t *buffer;
+    size_t bufferSize;
+} replay;
+
+int replay_open(replay *r, const char *path);
+// Decode the next frame into r->frame. Returns 1 on success, 0 at the end
+// of the recording and -1 on a read or format error.
+int replay_next(replay *r);
+// Start again from the first frame
+int replay_rewind(replay *r);
+void replay_close(replay *r);
+
+#endif
@@ -0,0 +1,425 @@
+#include "render.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define RENDER_MAX_TEMPLATE_RADIUS 1024 //larger circles scale this template up
+
+// 5x7 glyphs, one byte per row from the top, bit 4 is the leftmost pixel
+static const unsigned char FONT[128][7] = {
+    ['0'] = {0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E},
+    ['1'] = {0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E},
+    ['2'] = {0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F},
+    ['3'] = {0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E},
+    ['4'] = {0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02},
+    ['5'] = {0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E},
+    ['6'] = {0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E},
+    ['7'] = {0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08},
+    ['8'] = {0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E},
+    ['9'] = {0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C},
+    ['A'] = {0x0E, 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11},
+    ['B'] = {0x1E, 0x11, 0x11, 0x1E, 0x11, 0x11, 0x1E},
+    ['C'] = {0x0E, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0E},
+    ['D'] = {0x1C, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1C},
+    ['E'] = {0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x1F},
+    ['F'] = {0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x10},
+    ['G'] = {0x0E, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0F},
+    ['H'] = {0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11},
+    ['I'] = {0x0E, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E},
+    ['J'] = {0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0C},
+    ['K'] = {0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11},
+    ['L'] = {0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1F},
+    ['M'] = {0x11, 0x1B, 0x15, 0x15, 0x11, 0x11, 0x11},
+    ['N'] = {0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11},
+    ['O'] = {0x0E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E},
+    ['P'] = {0x1E, 0x11, 0x11, 0x1E, 0x10, 0x10, 0x10},
+    ['Q'] = {0x0E, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0D},
+    ['R'] = {0x1E, 0x11, 0x11, 0x1E, 0x14, 0x12, 0x11},
+    ['S'] = {0x0F, 0x10, 0x10, 0x0E, 0x01, 0x01, 0x1E},
+    ['T'] = {0x1F, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04},
+    ['U'] = {0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E},
+    ['V'] = {0x11, 0x11, 0x11, 0x11, 0x11, 0x0A, 0x04},
+    ['W'] = {0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0A},
+    ['X'] = {0x11, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x11},
+    ['Y'] = {0x11, 0x11, 0x11, 0x0A, 0x04, 0x04, 0x04},
+    ['Z'] = {0x1F, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1F},
+    ['.'] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C},
+    [','] = {0x00, 0x00, 0x00, 0x00, 0x0C, 0x04, 0x08},
+    [':'] = {0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00},
+    ['/'] = {0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00},
+    ['%'] = {0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03},
+    ['-'] = {0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00},
+    ['+'] = {0x00, 0x04, 0x04, 0x1F, 0x04, 0x04, 0x00},
+    ['='] = {0x00, 0x00, 0x1F, 0x00, 0x1F, 0x00, 0x00},
+    ['('] = {0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02},
+    [')'] = {0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08},
+};
+
+void render_batch_init(render_batch *batch) {
+    memset(batch, 0, sizeof(*batch));
+}
+
+void render_batch_free(render_batch *batch) {
+    for (int i = 0; i < batch->numTemplates; i++) {
+        free(batch->templates[i].rimX);
+        free(batch->templates[i].rimY);
+    }
+    free(batch->templates);
+    free(batch->vertices);
+    free(batch->indices);
+    render_batch_init(batch);
+}
+
+void render_batch_begin(render_batch *batch) {
+    batch->numVertices = 0;
+    batch->numIndices = 0;
+}
+
+static int render_batch_reserve(render_batch *batch, int vertices, int indices) {
+    if (batch->numVertices + vertices > batch->vertexCapacity) {
+        int capacity = (batch->vertexCapacity == 0) ? 4096 : batch->vertexCapacity;
+        while (capacity < batch->numVertices + vertices) {
+            capacity *= 2;
+        }
+        SDL_Vertex *grown = realloc(batch->vertices, capacity * sizeof(SDL_Vertex));
+        if (!grown) {
+            perror("Error reallocating memory");
+            return -1;
+        }
+        batch->vertices = grown;
+        batch->vertexCapacity = capacity;
+    }
+    if (batch->numIndices + indices > batch->indexCapacity) {
+        int capacity = (batch->indexCapacity == 0) ? 8192 : batch->indexCapacity;
+        while (capacity < batch->numIndices + indices) {
+            capacity *= 2;
+        }
+        int *grown = realloc(batch->indices, capacity * sizeof(int));
+        if (!grown) {
+            perror("Error reallocating memory");
+            return -1;
+        }
+        batch->indices = grown;
+        batch->indexCapacity = capacity;
+    }
+    return 0;
+}
+
+// Return the template for an integer radius, building it the first time it is asked for
+static circle_template *render_template(render_batch *batch, int radius) {
+    if (radius >= batch->numTemplates) {
+        int count = (batch->numTemplates == 0) ? 64 : batch->numTemplates;
+        while (count <= radius) {
+            count *= 2;
+        }
+        circle_template *grown = realloc(batch->templates, count * sizeof(circle_template));
+        if (!grown) {
+            perror("Error reallocating memory");
+            return NULL;
+        }
+        memset(grown + batch->numTemplates, 0, (count - batch->numTemplates) * sizeof(circle_template));
+        batch->templates = grown;
+        batch->numTemplates = count;
+    }
+
+    circle_template *t = &batch->templates[radius];
+    if (t->segments > 0) {
+        return t;
+    }
+    int segments = (int)ceil(2 * M_PI * radius / RENDER_SEGMENT_LENGTH);
+    if (segments < RENDER_MIN_SEGMENTS) segments = RENDER_MIN_SEGMENTS;
+    if (segments > RENDER_MAX_SEGMENTS) segments = RENDER_MAX_SEGMENTS;
+    t->rimX = malloc(segments * sizeof(float));
+    t->rimY = malloc(segments * sizeof(float));
+    if (!t->rimX || !t->rimY) {
+        perror("Error allocating memory");
+        free(t->rimX);
+        free(t->rimY);
+        memset(t, 0, sizeof(*t));
+        return NULL;
+    }
+    for (int i = 0; i < segments; i++) {
+        double angle = 2 * M_PI * i / segments;
+        t->rimX[i] = radius * cos(angle);
+        t->rimY[i] = radius * sin(angle);
+    }
+    t->segments = segments;
+    return t;
+}
+
+int render_circle(render_batch *batch, double x, double y, double radius, SDL_Color color, bool filled) {
+    // Same integer radius the midpoint circle used to draw
+    int key = RENDER_MAX_TEMPLATE_RADIUS;
+    float scale = 1;
+    if (radius > RENDER_MAX_TEMPLATE_RADIUS) {
+        scale = (float)(radius / RENDER_MAX_TEMPLATE_RADIUS);
+    } else {
+        key = (radius < 1) ? 1 : (int)radius;
+    }
+    circle_template *t = render_template(batch, key);
+    if (!t) {
+        return -1;
+    }
+    int n = t->segments;
+    if (render_batch_reserve(batch, filled ? n + 1 : 2 * n, filled ? 3 * n : 6 * n) != 0) {
+        return -1;
+    }
+
+    float cx = (float)x;
+    float cy = (float)y;
+    int base = batch->numVertices;
+    SDL_Vertex *v = batch->vertices + base;
+    int *index = batch->indices + batch->numIndices;
+
+    if (filled) {
+        // Triangle fan around the centre vertex
+        v[0].position.x = cx;
+        v[0].position.y = cy;
+        v[0].color = color;
+        for (int i = 0; i < n; i++) {
+            v[i + 1].position.x = cx + t->rimX[i] * scale;
+            v[i + 1].position.y = cy + t->rimY[i] * scale;
+            v[i + 1].color = color;
+            *index++ = base;
+            *index++ = base + 1 + i;
+            *index++ = base + 1 + (i + 1) % n;
+        }
+        batch->numVertices += n + 1;
+        batch->numIndices += 3 * n;
+    } else {
+        // Two triangles per segment between the rim and a rim one pixel further in
+        float inner = 1 - 1 / (key * scale);
+        for (int i = 0; i < n; i++) {
+            float rx = t->rimX[i] * scale;
+            float ry = t->rimY[i] * scale;
+            v[2 * i].position.x = cx + rx;
+            v[2 * i].position.y = cy + ry;
+            v[2 * i + 1].position.x = cx + rx * inner;
+            v[2 * i + 1].position.y = cy + ry * inner;
+            v[2 * i].color = color;
+            v[2 * i + 1].color = color;
+            int next = (i + 1) % n;
+            *index++ = base + 2 * i;
+            *index++ = base + 2 * i + 1;
+            *index++ = base + 2 * next;
+            *index++ = base + 2 * next;
+            *index++ = base + 2 * i + 1;
+            *index++ = base + 2 * next + 1;
+        }
+        batch->numVertices += 2 * n;
+        batch->numIndices += 6 * n;
+    }
+    return 0;
+}
+
+int render_rect(render_batch *batch, double x, double y, double w, double h, SDL_Color color) {
+    if (render_batch_reserve(batch, 4, 6) != 0) {
+        return -1;
+    }
+    int base = batch->numVertices;
+    SDL_Vertex *v = batch->vertices + base;
+    for (int i = 0; i < 4; i++) {
+        v[i].position.x = (float)((i & 1) ? x + w : x);
+        v[i].position.y = (float)((i & 2) ? y + h : y);
+        v[i].color = color;
+    }
+    int *index = batch->indices + batch->numIndices;
+    index[0] = base;
+    index[1] = base + 1;
+    index[2] = base + 2;
+    index[3] = base + 2;
+    index[4] = base + 1;
+    index[5] = base + 3;
+    batch->numVertices += 4;
+    batch->numIndices += 6;
+    return 0;
+}
+
+int render_line(render_batch *batch, double x1, double y1, double x2, double y2, double width, SDL_Color color) {
+    double length = hypot(x2 - x1, y2 - y1);
+    if (length == 0) {
+        return 0;
+    }
+    if (render_batch_reserve(batch, 4, 6) != 0) {
+        return -1;
+    }
+    // Half the width either side, across the segment
+    double nx = -(y2 - y1) / length * width / 2;
+    double ny = (x2 - x1) / length * width / 2;
+    int base = batch->numVertices;
+    SDL_Vertex *v = batch->vertices + base;
+    for (int i = 0; i < 4; i++) {
+        double side = (i & 1) ? 1 : -1;
+        v[i].position.x = (float)(((i & 2) ? x2 : x1) + side * nx);
+        v[i].position.y = (float)(((i & 2) ? y2 : y1) + side * ny);
+        v[i].color = color;
+    }
+    int *index = batch->indices + batch->numIndices;
+    index[0] = base;
+    index[1] = base + 1;
+    index[2] = base + 2;
+    index[3] = base + 2;
+    index[4] = base + 1;
+    index[5] = base + 3;
+    batch->numVertices += 4;
+    batch->numIndices += 6;
+    return 0;
+}
+
+int render_text(render_batch *batch, double x, double y, int scale, const char *text, SDL_Color color) {
+    double left = x;
+    for (const char *c = text; *c; c++) {
+        if (*c == '\n') {
+            x = left;
+            y += RENDER_GLYPH_HEIGHT * scale;
+            continue;
+        }
+        unsigned char ch = (unsigned char)*c;
+        if (ch >= 'a' && ch <= 'z') {
+            ch -= 'a' - 'A';
+        }
+        if (ch < 128) {
+            for (int row = 0; row < 7; row++) {
+                // One rectangle per run of lit pixels in the row
+                unsigned bits = FONT[ch][row];
+                for (int col = 0; col < 5; col++) {
+                    if (!(bits & (0x10 >> col))) {
+                        continue;
+                    }
+                    int run = 1;
+                    while (col + run < 5 && (bits & (0x10 >> (col + run)))) {
+                        run++;
+                    }
+                    if (render_rect(batch, x + col * scale, y + row * scale, run * scale, scale, color) != 0) {
+                        return -1;
+                    }
+                    col += run;
+                }
+            }
+        }
+        x += RENDER_GLYPH_WIDTH * scale;
+    }
+    return 0;
+}
+
+int render_batch_flush(render_batch *batch, SDL_Renderer *renderer) {
+    if (batch->numIndices == 0) {
+        return 0;
+    }
+    if (SDL_RenderGeometry(renderer, NULL, batch->vertices, batch->numVertices,
+                           batch->indices, batch->numIndices) != 0) {
+        printf("SDL_RenderGeometry failed: %s\n", SDL_GetError());
+        return -1;
+    }
+    return 0;
+}
+
+// Twice the signed area of (a, b, p), positive when p is to the right of a->b on screen
+static float render_edge(SDL_FPoint a, SDL_FPoint b, float px, float py) {
+    return (b.x - a.x) * (py - a.y) - (b.y - a.y) * (px - a.x);
+}
+
+// Whether pixel centres exactly on edge a->b belong to the triangle: only
+// on top and left edges, so triangles sharing an edge cover it once
+static bool render_top_left(SDL_FPoint a, SDL_FPoint b) {
+    return (a.y == b.y && b.x > a.x) || b.y < a.y;
+}
+
+void render_batch_rasterize(const render_batch *batch, uint8_t *rgb, int width, int height) {
+    for (int t = 0; t + 2 < batch->numIndices; t += 3) {
+        const SDL_Vertex *v0 = &batch->vertices[batch->indices[t]];
+        SDL_FPoint a = v0->position;
+        SDL_FPoint b = batch->vertices[batch->indices[t + 1]].position;
+        SDL_FPoint c = batch->vertices[batch->indices[t + 2]].position;
+        float area = render_edge(a, b, c.x, c.y);
+        if (area == 0) {
+            continue;
+        }
+        if (area < 0) {
+            // Same winding for every triangle
+            SDL_FPoint swap = b;
+            b = c;
+            c = swap;
+        }
+        int x0 = (int)floorf(fminf(a.x, fminf(b.x, c.x)));
+        int y0 = (int)floorf(fminf(a.y, fminf(b.y, c.y)));
+        int x1 = (int)ceilf(fmaxf(a.x, fmaxf(b.x, c.x)));
+        int y1 = (int)ceilf(fmaxf(a.y, fmaxf(b.y, c.y)));
+        if (x0 < 0) x0 = 0;
+        if (y0 < 0) y0 = 0;
+        if (x1 > width) x1 = width;
+        if (y1 > height) y1 = height;
+        bool topLeftAB = render_top_left(a, b);
+        bool topLeftBC = render_top_left(b, c);
+        bool topLeftCA = render_top_left(c, a);
+        SDL_Color color = v0->color;
+        unsigned alpha = color.a;
+
+        for (int y = y0; y < y1; y++) {
+            float py = y + 0.5f;
+            uint8_t *row = rgb + (size_t)y * width * 3;
+            for (int x = x0; x < x1; x++) {
+                float px = x + 0.5f;
+                float wab = render_edge(a, b, px, py);
+                float wbc = render_edge(b, c, px, py);
+                float wca = render_edge(c, a, px, py);
+                if ((wab < 0 || (wab == 0 && !topLeftAB)) || (wbc < 0 || (wbc == 0 && !topLeftBC)) ||
+                    (wca < 0 || (wca == 0 && !topLeftCA))) {
+                    continue;
+                }
+                uint8_t *p = row + 3 * x;
+                if (alpha == 255) {
+                    p[0] = color.r;
+                    p[1] = color.g;
+                    p[2] = color.b;
+                } else {
+                    p[0] = (uint8_t)((color.r * alpha + p[0] * (255 - alpha) + 127) / 255);
+                    p[1] = (uint8_t)((color.g * alpha + p[1] * (255 - alpha) + 127) / 255);
+                    p[2] = (uint8_t)((color.b * alpha + p[2] * (255 - alpha) + 127) / 255);
+                }
+            }
+        }
+    }
+}
+
+void camera_init(camera *cam, int width, int height) {
+    cam->width = width;
+    cam->height = height;
+    cam->zoom = 1;
+    cam->x = width / 2.0;
+    cam->y = height / 2.0;
+}
+
+void camera_pan(camera *cam, double dx, double dy) {
+    cam->x += dx / cam->zoom;
+    cam->y += dy / cam->zoom;
+}
+
+void camera_zoom_at(camera *cam, double factor, double sx, double sy) {
+    double wx, wy;
+    camera_to_world(cam, sx, sy, &wx, &wy);
+    cam->zoom = fmin(fmax(cam->zoom * factor, CAMERA_MIN_ZOOM), CAMERA_MAX_ZOOM);
+    // Shift the centre so (wx, wy) lands back under the cursor
+    cam->x = wx - (sx - cam->width / 2.0) / cam->zoom;
+    cam->y = wy - (sy - cam->height / 2.0) / cam->zoom;
+}
+
+void camera_to_screen(const camera *cam, double wx, double wy, double *sx, double *sy) {
+    *sx = (wx - cam->x) * cam->zoom + cam->width / 2.0;
+    *sy = (wy - cam->y) * cam->zoom + cam->height / 2.0;
+}
+
+void camera_to_world(const camera *cam, double sx, double sy, double *wx, double *wy) {
+    *wx = (sx - cam->width / 2.0) / cam->zoom + cam->x;
+    *wy = (sy - cam->height / 2.0) / cam->zoom + cam->y;
+}
+
+bool camera_visible(const camera *cam, double x, double y, double radius) {
+    double halfWidth = cam->width / 2.0 / cam->zoom + radius;
+    double halfHeight = cam->height / 2.0 / cam->zoom + radius;
+    return fabs(x - cam->x) <= halfWidth && fabs(y - cam->y) <= halfHeight;
+}
@@ -0,0 +1,77 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <SDL2/SDL.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define RENDER_MIN_SEGMENTS 8
+#define RENDER_MAX_SEGMENTS 256
+#define RENDER_SEGMENT_LENGTH 4.0 //pixels of rim per segment, bigger circles get more
+#define RENDER_GLYPH_WIDTH 6  //font pixels per character, including the gap
+#define RENDER_GLYPH_HEIGHT 8 //font pixels per line, including the gap
+#define CAMERA_MIN_ZOOM 1e-3
+#define CAMERA_MAX_ZOOM 1e3
+
+// Rim offsets for one integer radius, shared by every circle of that size
+typedef struct {
+    int segments;    //0 until the template has been built
+    float *rimX, *rimY;
+} circle_template;
+
+// One frame worth of triangles, handed to SDL in a single SDL_RenderGeometry call
+typedef struct {
+    SDL_Vertex *vertices;
+    int numVertices;
+    int vertexCapacity;
+    int *indices;
+    int numIndices;
+    int indexCapacity;
+    circle_template *templates; //indexed by rounded radius
+    int numTemplates;
+} render_batch;
+
+// View onto world space, applied only when drawing so panning and zooming
+// never touch body positions
+typedef struct {
+    double x, y;      //world point at the centre of the window
+    double zoom;      //screen pixels per world unit
+    int width, height;
+} camera;
+
+void render_batch_init(render_batch *batch);
+void render_batch_free(render_batch *batch);
+
+// Drop the previous frame's geometry, templates are kept
+void render_batch_begin(render_batch *batch);
+// Queue a circle, as a triangle fan when filled or a one pixel ring otherwise
+int render_circle(render_batch *batch, double x, double y, double radius, SDL_Color color, bool filled);
+// Queue a solid axis-aligned rectangle in screen space
+int render_rect(render_batch *batch, double x, double y, double w, double h, SDL_Color color);
+// Queue a straight segment `width` pixels wide in screen space
+int render_line(render_batch *batch, double x1, double y1, double x2, double y2, double width, SDL_Color color);
+// Queue text in the built-in 5x7 bitmap font, each font pixel `scale` screen
+// pixels wide. Letters are drawn upper case, characters without a glyph as gaps.
+int render_text(render_batch *batch, double x, double y, int scale, const char *text, SDL_Color color);
+
+// Submit everything queued since render_batch_begin
+int render_batch_flush(render_batch *batch, SDL_Renderer *renderer);
+// Draw everything queued since render_batch_begin into a width x height
+// image of packed RGB bytes, without SDL. Samples pixel centres with a
+// top-left fill rule like SDL_RenderGeometry, so frames written offscreen
+// match the window. Each triangle takes the colour of its first vertex,
+// blended over the image by its alpha.
+void render_batch_rasterize(const render_batch *batch, uint8_t *rgb, int width, int height);
+
+// Camera that shows world coordinates 1:1 with the origin in the top left corner
+void camera_init(camera *cam, int width, int height);
+// Move the view by a distance given in screen pixels
+void camera_pan(camera *cam, double dx, double dy);
+// Scale the zoom by `factor`, keeping the world point under screen (sx, sy) in place
+void camera_zoom_at(camera *cam, double factor, double sx, double sy);
+void camera_to_screen(const camera *cam, double wx, double wy, double *sx, double *sy);
+void camera_to_world(const camera *cam, double sx, double sy, double *wx, double *wy);
+// Whether a circle in world space overlaps the window at all
+bool camera_visible(const camera *cam, double x, double y, double radius);
+
+#endif
@@ -0,0 +1,253 @@
+#include "scenario.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define SCENARIO_CHUNK 16384         //bodies per task
+#define SCENARIO_BULGE_FRACTION 0.2  //of each galaxy's bodies
+#define SCENARIO_DISK_SCALE 3.0      //galaxy radius over the disk's scale length
+#define SCENARIO_BULGE_SCALE 0.2     //bulge radius over the disk's scale length
+#define SCENARIO_DISPERSION 0.1      //random speed of disk bodies over the circular speed
+#define SCENARIO_MAX_REJECTIONS 64   //draws before a rejection sampler takes what it has
+
+static const SDL_Color DISK_COLOR = {150, 180, 255, 255};
+static const SDL_Color BULGE_COLOR = {255, 220, 150, 255};
+static const SDL_Color SECOND_DISK_COLOR = {255, 170, 120, 255};
+static const SDL_Color STAR_COLOR = {255, 255, 255, 255};
+
+// Counter-based generator: the key hashes the seed with the body index and
+// each draw mixes the key with the next counter value (splitmix64), so body
+// i's numbers never depend on which thread made the bodies before it
+typedef struct {
+    uint64_t key;
+    uint64_t counter;
+} scenario_rng;
+
+static uint64_t scenario_mix(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static scenario_rng scenario_rng_for(uint64_t seed, int index) {
+    scenario_rng rng;
+    rng.key = scenario_mix(seed ^ scenario_mix((uint64_t)index + 0x9e3779b97f4a7c15ULL));
+    rng.counter = 0;
+    return rng;
+}
+
+// Uniform in the open interval (0, 1), safe to take the log of
+static double scenario_uniform(scenario_rng *rng) {
+    uint64_t bits = scenario_mix(rng->key + ++rng->counter * 0x9e3779b97f4a7c15ULL);
+    return ((bits >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+}
+
+static double scenario_gaussian(scenario_rng *rng) {
+    double u = scenario_uniform(rng);
+    return sqrt(-2 * log(u)) * cos(2 * M_PI * scenario_uniform(rng));
+}
+
+const char *scenario_name(scenario_kind kind) {
+    switch (kind) {
+        case SCENARIO_PLUMMER:
+            return "plummer";
+        case SCENARIO_DISK:
+            return "disk";
+        case SCENARIO_GALAXY_PAIR:
+            return "pair";
+        case SCENARIO_UNIFORM:
+            return "uniform";
+        case SCENARIO_COUNT:
+            break;
+    }
+    return "unknown";
+}
+
+int scenario_parse(const char *name, scenario_kind *kind) {
+    for (int k = 0; k < SCENARIO_COUNT; k++) {
+        if (strcmp(name, scenario_name(k)) == 0) {
+            *kind = k;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+double scenario_radius(scenario_kind kind, int n) {
+    double radius = SCENARIO_RADIUS * sqrt(n / 1000.0);
+    // The pair starts two galaxy radii either side of the centre
+    return (kind == SCENARIO_GALAXY_PAIR) ? 2 * radius : radius;
+}
+
+typedef struct {
+    body_store *store;
+    scenario_kind kind;
+    int first;     //slot of body 0
+    int n;
+    uint64_t seed;
+    double x, y;   //centre
+    double radius;
+    double g;      //G per tick: speeds are pixels per tick, a tick applies GRAVITY_TIMESTEP of acceleration
+} scenario_job;
+
+typedef struct {
+    double x, y, vx, vy;
+    SDL_Color color;
+} scenario_body;
+
+// Plummer sphere of scale a and total mass, sampled in 3D (Aarseth, Henon and
+// Wielen 1974) and projected onto the plane
+static scenario_body scenario_plummer(scenario_rng *rng, double a, double mass, double g) {
+    scenario_body b;
+    // Radius from the cumulative mass, the outermost 0.1% is left out
+    double m = 0.999 * scenario_uniform(rng);
+    double c = cbrt(m);
+    double r = a * c / sqrt(1 - c * c); //a / sqrt(m^(-2/3) - 1)
+    double cos_theta = 2 * scenario_uniform(rng) - 1;
+    double sin_theta = sqrt(1 - cos_theta * cos_theta);
+    double phi = 2 * M_PI * scenario_uniform(rng);
+    b.x = r * sin_theta * cos(phi);
+    b.y = r * sin_theta * sin(phi);
+
+    // Speed as a fraction q of the escape speed, by rejection from q^2 (1 - q^2)^3.5
+    double q = 0;
+    for (int k = 0; k < SCENARIO_MAX_REJECTIONS; k++) {
+        q = scenario_uniform(rng);
+        double s = 1 - q * q;
+        if (0.1 * scenario_uniform(rng) < q * q * s * s * s * sqrt(s)) {
+            break;
+        }
+    }
+    double speed = q * sqrt(2 * g * mass / sqrt(r * r + a * a));
+    cos_theta = 2 * scenario_uniform(rng) - 1;
+    sin_theta = sqrt(1 - cos_theta * cos_theta);
+    phi = 2 * M_PI * scenario_uniform(rng);
+    b.vx = speed * sin_theta * cos(phi);
+    b.vy = speed * sin_theta * sin(phi);
+    b.color = STAR_COLOR;
+    return b;
+}
+
+// Body of a galaxy of the given radius and mass: a bulge with the surface
+// density of a projected Plummer sphere inside an exponential disk. Disk
+// bodies go round at the circular speed of the mass inside them, spin is +1
+// for counterclockwise and -1 for clockwise.
+static scenario_body scenario_galaxy(scenario_rng *rng, double radius, double mass, double spin,
+                                     double g, SDL_Color diskColor) {
+    scenario_body b;
+    double scale = radius / SCENARIO_DISK_SCALE;
+    double bulge_scale = SCENARIO_BULGE_SCALE * scale;
+    double disk_mass = (1 - SCENARIO_BULGE_FRACTION) * mass;
+    double bulge_mass = SCENARIO_BULGE_FRACTION * mass;
+    bool bulge = scenario_uniform(rng) < SCENARIO_BULGE_FRACTION;
+
+    double r;
+    if (bulge) {
+        double m = 0.99 * scenario_uniform(rng);
+        r = bulge_scale * sqrt(m / (1 - m));
+    } else {
+        // Surface density e^(-r/scale) gives r / scale a gamma(2) distribution
+        r = -scale * log(scenario_uniform(rng) * scenario_uniform(rng));
+    }
+    double angle = 2 * M_PI * scenario_uniform(rng);
+    b.x = r * cos(angle);
+    b.y = r * sin(angle);
+
+    double u = r / scale;
+    double inside = disk_mass * (1 - (1 + u) * exp(-u)) + bulge_mass * r * r / (r * r + bulge_scale * bulge_scale);
+    double circular = (r > 0) ? sqrt(g * inside / r) : 0;
+    if (bulge) {
+        // Hot and not rotating
+        b.vx = circular / sqrt(2) * scenario_gaussian(rng);
+        b.vy = circular / sqrt(2) * scenario_gaussian(rng);
+        b.color = BULGE_COLOR;
+    } else {
+        b.vx = -spin * circular * sin(angle) + SCENARIO_DISPERSION * circular * scenario_gaussian(rng);
+        b.vy = spin * circular * cos(angle) + SCENARIO_DISPERSION * circular * scenario_gaussian(rng);
+        b.color = diskColor;
+    }
+    return b;
+}
+
+static scenario_body scenario_body_at(const scenario_job *job, int i) {
+    scenario_rng rng = scenario_rng_for(job->seed, i);
+    double total = SCENARIO_BODY_MASS * job->n;
+    scenario_body b;
+    switch (job->kind) {
+        case SCENARIO_PLUMMER:
+            return scenario_plummer(&rng, job->radius / 3, total, job->g);
+        case SCENARIO_DISK:
+            return scenario_galaxy(&rng, job->radius, total, 1, job->g, DISK_COLOR);
+        case SCENARIO_GALAXY_PAIR: {
+            // First half on the left moving right, second half on the right
+            // moving left and spinning the other way, offset so they do not
+            // meet head on. Together they are on a parabolic orbit.
+            int first = i < job->n / 2;
+            int count = first ? job->n / 2 : job->n - job->n / 2;
+            double side = first ? -1 : 1;
+            double separation = 2 * job->radius;
+            double speed = sqrt(2 * job->g * total / separation) / 2;
+            b = scenario_galaxy(&rng, job->radius / 2, SCENARIO_BODY_MASS * count, -side, job->g,
+                                first ? DISK_COLOR : SECOND_DISK_COLOR);
+            b.x += side * separation / 2;
+            b.y += side * separation / 8;
+            b.vx -= side * speed;
+            return b;
+        }
+        case SCENARIO_UNIFORM:
+        case SCENARIO_COUNT:
+            break;
+    }
+    b.x = job->radius * (2 * scenario_uniform(&rng) - 1);
+    b.y = job->radius * (2 * scenario_uniform(&rng) - 1);
+    b.vx = b.vy = 0;
+    b.color = STAR_COLOR;
+    return b;
+}
+
+static void scenario_task(void *context, int task, int thread) {
+    scenario_job *job = context;
+    body_store *store = job->store;
+    int end = (task + 1) * SCENARIO_CHUNK;
+    if (end > job->n) {
+        end = job->n;
+    }
+    (void)thread;
+
+    for (int i = task * SCENARIO_CHUNK; i < end; i++) {
+        scenario_body b = scenario_body_at(job, i);
+        int index = job->first + i;
+        store->x[index] = store->prevX[index] = job->x + b.x;
+        store->y[index] = store->prevY[index] = job->y + b.y;
+        store->vx[index] = b.vx;
+        store->vy[index] = b.vy;
+        store->ax[index] = store->ay[index] = 0;
+        store->mass[index] = SCENARIO_BODY_MASS;
+        store->radius[index] = SCENARIO_BODY_RADIUS;
+        store->color[index] = b.color;
+    }
+}
+
+int scenario_generate(body_store *store, scenario_kind kind, int n, uint64_t seed,
+                      double x, double y, thread_pool *pool) {
+    if (n <= 0) {
+        return 0;
+    }
+    scenario_job job;
+    job.store = store;
+    job.kind = kind;
+    job.n = n;
+    job.seed = seed;
+    job.x = x;
+    job.y = y;
+    job.radius = SCENARIO_RADIUS * sqrt(n / 1000.0);
+    job.g = GRAVITATIONAL_CONSTANT * GRAVITY_TIMESTEP;
+    if ((job.first = body_store_append(store, n)) < 0) {
+        return -1;
+    }
+    thread_pool_run(pool, (n + SCENARIO_CHUNK - 1) / SCENARIO_CHUNK, scenario_task, &job);
+    return 0;
+}
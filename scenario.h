@@ -0,0 +1,36 @@
+#ifndef SCENARIO_H
+#define SCENARIO_H
+
+#include "body.h"
+#include "thread_pool.h"
+#include <stdint.h>
+
+#define SCENARIO_DEFAULT_BODIES 10000
+#define SCENARIO_DEFAULT_SEED 1
+#define SCENARIO_BODY_MASS 1e12    //same as a left click
+#define SCENARIO_BODY_RADIUS 0.1  //small, dense cores would otherwise merge away in a few steps
+#define SCENARIO_RADIUS 300.0      //for 1000 bodies, grows with sqrt(N) to keep the density fixed
+
+typedef enum {
+    SCENARIO_PLUMMER,       //Plummer sphere seen face on
+    SCENARIO_DISK,          //exponential disk around a bulge, rotating
+    SCENARIO_GALAXY_PAIR,   //two disks on a parabolic collision course
+    SCENARIO_UNIFORM,       //cold uniform square
+    SCENARIO_COUNT
+} scenario_kind;
+
+const char *scenario_name(scenario_kind kind);
+// Kind for a name printed by scenario_name, -1 if there is none
+int scenario_parse(const char *name, scenario_kind *kind);
+
+// Radius around the centre that holds nearly all of the bodies
+double scenario_radius(scenario_kind kind, int n);
+
+// Append n generated bodies centred on (x, y). Every random number is a hash
+// of the seed, the body's index and a counter, so bodies are generated in
+// chunks on the pool in any order and the result depends only on the seed,
+// never on the thread count. pool may be NULL.
+int scenario_generate(body_store *store, scenario_kind kind, int n, uint64_t seed,
+                      double x, double y, thread_pool *pool);
+
+#endif
@@ -0,0 +1,310 @@
+#define _POSIX_C_SOURCE 199309L //clock_gettime
+#include "sim.h"
+#include "cluster.h"
+#include "frame_export.h"
+#include "live_export.h"
+#include "snapshot.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+int simulation_init(simulation *sim, gravity_mode mode, double theta, int threads) {
+    memset(sim, 0, sizeof(*sim));
+    body_store_init(&sim->bodies);
+    quadtree_init(&sim->tree);
+    broadphase_init(&sim->broadphase);
+    tier_init(&sim->tier);
+    particle_mesh_init(&sim->mesh, PARTICLE_MESH_DEFAULT_GRID);
+    sim->mode = mode;
+    sim->theta = theta;
+    sim->dt = 1;
+    sim->maxSubsteps = SIM_DEFAULT_MAX_SUBSTEPS;
+    sim->pool = thread_pool_create(threads);
+    return sim->pool ? 0 : -1;
+}
+
+void simulation_free(simulation *sim) {
+    body_store_free(&sim->bodies);
+    quadtree_free(&sim->tree);
+    broadphase_free(&sim->broadphase);
+    tier_free(&sim->tier);
+    particle_mesh_free(&sim->mesh);
+    thread_pool_destroy(sim->pool);
+    sim->pool = NULL;
+    recorder_close(sim->recording);
+    sim->recording = NULL;
+    live_export_close(sim->live);
+    sim->live = NULL;
+    frame_export_close(sim->frames);
+    sim->frames = NULL;
+    cluster_stop(sim->cluster);
+    sim->cluster = NULL;
+    free(sim->level);
+    free(sim->active);
+    sim->level = NULL;
+    sim->active = NULL;
+    sim->levelCapacity = 0;
+}
+
+void simulation_merge(simulation *sim) {
+    double start = profile_begin(sim->profiler);
+    // The broadphase only hands over touching pairs, and merges are
+    // tombstoned so no index moves until the single compaction at the end
+    if (sim->collisions == COLLISION_BOUNCE) {
+        broadphase_bounce(&sim->broadphase, &sim->bodies);
+    } else if (broadphase_merge(&sim->broadphase, &sim->bodies) > 0) {
+        body_store_compact(&sim->bodies);
+    }
+    profile_end(sim->profiler, PROFILE_MERGE, start);
+}
+
+void simulation_gravity(simulation *sim) {
+    double start = profile_begin(sim->profiler);
+    if (sim->worker) {
+        cluster_worker_gravity(sim->worker, sim);
+    } else if (sim->mode == GRAVITY_DIRECT) {
+        gravity_direct_parallel(&sim->bodies, sim->pool);
+    } else if (sim->mode == GRAVITY_PARTICLE_MESH || sim->mode == GRAVITY_P3M) {
+        particle_mesh_gravity(&sim->mesh, &sim->bodies, sim->mode == GRAVITY_P3M, sim->pool);
+    } else if (quadtree_build(&sim->tree, &sim->bodies) == 0) {
+        // Rebuilt every step, the tree is only valid for the current positions
+        gravity_barnes_hut(&sim->bodies, &sim->tree, sim->theta, sim->pool);
+    }
+    sim->forcesChanges = sim->bodies.changes;
+    profile_end(sim->profiler, PROFILE_GRAVITY, start);
+}
+
+// Half-step velocity update. Forces are per second of the original 60 FPS
+// frame (GRAVITY_TIMESTEP), speeds are per tick.
+static void simulation_kick(simulation *sim, double ticks) {
+    body_store *store = &sim->bodies;
+    double scale = ticks * GRAVITY_TIMESTEP;
+    for (int i = 0; i < store->count; i++) {
+        store->vx[i] += store->ax[i] * scale;
+        store->vy[i] += store->ay[i] * scale;
+    }
+}
+
+void simulation_integrate(simulation *sim) {
+    body_store *store = &sim->bodies;
+    double start = profile_begin(sim->profiler);
+    simulation_kick(sim, sim->dt / 2);
+    for (int i = 0; i < store->count; i++) {
+        store->prevX[i] = store->x[i];
+        store->prevY[i] = store->y[i];
+        store->x[i] += store->vx[i] * sim->dt;
+        store->y[i] += store->vy[i] * sim->dt;
+    }
+    // Gravity is a phase of its own, so integrate is timed in two pieces
+    double spent = profile_split(sim->profiler, PROFILE_INTEGRATE, start);
+    simulation_gravity(sim);
+    start = profile_begin(sim->profiler);
+    simulation_kick(sim, sim->dt / 2);
+    profile_sample(sim->profiler, PROFILE_INTEGRATE, spent + profile_split(sim->profiler, PROFILE_INTEGRATE, start));
+}
+
+// Level a body's acceleration and size ask for, its radius standing in for
+// the softening length the forces do not have
+static int simulation_level(const simulation *sim, int i) {
+    const body_store *store = &sim->bodies;
+    double acceleration = hypot(store->ax[i], store->ay[i]) * GRAVITY_TIMESTEP; //pixels per tick^2
+    if (acceleration <= 0) {
+        return 0;
+    }
+    double wanted = sqrt(2 * SIM_BLOCK_ACCURACY * store->radius[i] / acceleration);
+    int level = 0;
+    while (level < sim->blockLevels && sim->dt / (1 << level) > wanted) {
+        level++;
+    }
+    return level;
+}
+
+// Gravity for the bodies in sim->active only
+static void simulation_gravity_active(simulation *sim, int numActive) {
+    double start = profile_begin(sim->profiler);
+    body_store *store = &sim->bodies;
+    if (sim->mode == GRAVITY_PARTICLE_MESH || sim->mode == GRAVITY_P3M) {
+        // The mesh costs the same for one target as for all of them
+        particle_mesh_gravity(&sim->mesh, store, sim->mode == GRAVITY_P3M, sim->pool);
+    } else if (sim->mode == GRAVITY_DIRECT) {
+        gravity_targets(store, NULL, sim->theta, sim->active, numActive, sim->pool);
+    } else if (quadtree_build(&sim->tree, store) == 0) {
+        gravity_targets(store, &sim->tree, sim->theta, sim->active, numActive, sim->pool);
+    }
+    profile_end(sim->profiler, PROFILE_GRAVITY, start);
+}
+
+void simulation_integrate_blocks(simulation *sim) {
+    body_store *store = &sim->bodies;
+    int n = store->count;
+    if (n > sim->levelCapacity) {
+        signed char *level = realloc(sim->level, n * sizeof(signed char));
+        int *active = realloc(sim->active, n * sizeof(int));
+        if (level) {
+            sim->level = level;
+        }
+        if (active) {
+            sim->active = active;
+        }
+        if (!level || !active) {
+            perror("Error allocating memory");
+            simulation_integrate(sim);
+            return;
+        }
+        sim->levelCapacity = n;
+    }
+
+    double start = profile_begin(sim->profiler);
+    double spent = 0;
+    int substeps = 1 << sim->blockLevels;
+    double h = sim->dt / substeps; //ticks per substep
+    int finest = 0;
+    for (int i = 0; i < n; i++) {
+        sim->level[i] = simulation_level(sim, i);
+        finest = (sim->level[i] > finest) ? sim->level[i] : finest;
+        store->prevX[i] = store->x[i];
+        store->prevY[i] = store->y[i];
+    }
+
+    for (int sub = 0; sub < substeps; sub++) {
+        // Opening half kick of every body whose step starts here. A level
+        // spans substeps >> level substeps and dt / 2^level ticks.
+        for (int i = 0; i < n; i++) {
+            if (sub % (substeps >> sim->level[i]) == 0) {
+                double scale = sim->dt / (2 << sim->level[i]) * GRAVITY_TIMESTEP;
+                store->vx[i] += store->ax[i] * scale;
+                store->vy[i] += store->ay[i] * scale;
+            }
+        }
+        int numActive = 0;
+        for (int i = 0; i < n; i++) {
+            store->x[i] += store->vx[i] * h;
+            store->y[i] += store->vy[i] * h;
+            if ((sub + 1) % (substeps >> sim->level[i]) == 0) {
+                sim->active[numActive++] = i;
+            }
+        }
+        spent += profile_split(sim->profiler, PROFILE_INTEGRATE, start);
+        if (numActive == n) {
+            simulation_gravity(sim);
+        } else if (numActive > 0) {
+            simulation_gravity_active(sim, numActive);
+        }
+        start = profile_begin(sim->profiler);
+        sim->forceEvaluations += numActive;
+
+        // Closing half kick, then the level for the next step
+        for (int k = 0; k < numActive; k++) {
+            int i = sim->active[k];
+            double scale = sim->dt / (2 << sim->level[i]) * GRAVITY_TIMESTEP;
+            store->vx[i] += store->ax[i] * scale;
+            store->vy[i] += store->ay[i] * scale;
+            int level = simulation_level(sim, i);
+            while (level < sim->level[i] && (sub + 1) % (substeps >> level) != 0) {
+                level++; //coarser steps must start where one ends
+            }
+            sim->level[i] = level;
+            finest = (level > finest) ? level : finest;
+        }
+    }
+    // Every level ends on the last substep, so all forces are current
+    sim->forcesChanges = store->changes;
+    sim->sharedEvaluations += (long long)n << finest;
+    profile_sample(sim->profiler, PROFILE_INTEGRATE, spent + profile_split(sim->profiler, PROFILE_INTEGRATE, start));
+}
+
+int simulation_step(simulation *sim) {
+    double start = profile_begin(sim->profiler);
+    if (sim->cluster && cluster_step(sim->cluster, sim) != 0) {
+        // Steps since the last gather are lost with the workers, go back to
+        // where the bodies are and take nothing as done
+        sim->steps = cluster_synced_step(sim->cluster, sim->steps);
+        printf("cluster failed, back at step %ld in this process\n", sim->steps);
+        cluster_stop(sim->cluster);
+        sim->cluster = NULL;
+        profile_end(sim->profiler, PROFILE_STEP, start);
+        return -1;
+    } else if (!sim->cluster) {
+        simulation_merge(sim);
+        if (sim->steps == 0 || sim->forcesChanges != sim->bodies.changes) {
+            simulation_gravity(sim);
+        }
+        if (sim->blockLevels > 0) {
+            simulation_integrate_blocks(sim);
+        } else {
+            simulation_integrate(sim);
+        }
+        if (tier_update(&sim->tier, &sim->bodies, sim->steps + 1, sim->dt) != 0) {
+            printf("far-field tier failed, keeping every body hot\n");
+            sim->tier.radius = 0;
+            tier_thaw(&sim->tier, &sim->bodies);
+        }
+    }
+    sim->steps++;
+
+    bool checkpoint = sim->checkpointPath && sim->checkpointEvery > 0 && sim->steps % sim->checkpointEvery == 0;
+    // A cluster only hands the bodies back when an epoch ends
+    bool current = !(checkpoint || sim->recording || sim->frames || sim->live) || simulation_sync(sim) == 0;
+    if (checkpoint && current) {
+        simulation_save(sim, sim->checkpointPath);
+    }
+    if (sim->recording && current) {
+        recorder_submit(sim->recording, &sim->bodies, &sim->tier.cold, sim->steps);
+    }
+    if (sim->frames && current) {
+        frame_export_submit(sim->frames, &sim->bodies, &sim->tier.cold, sim->steps);
+    }
+    if (sim->live && current && live_export_publish(sim->live, &sim->bodies, &sim->tier.cold, sim->steps, sim->dt) != 0) {
+        printf("live export failed, no longer publishing steps\n");
+        live_export_close(sim->live);
+        sim->live = NULL;
+    }
+    profile_end(sim->profiler, PROFILE_STEP, start);
+    return 0;
+}
+
+int simulation_sync(simulation *sim) {
+    return sim->cluster ? cluster_gather(sim->cluster, sim) : 0;
+}
+
+int simulation_save(const simulation *sim, const char *path) {
+    return snapshot_write(path, &sim->bodies, &sim->tier.cold, sim->tier.lag, sim->steps, sim->dt);
+}
+
+int simulation_resume(simulation *sim, const char *path) {
+    long steps;
+    double dt;
+    if (snapshot_load(path, &sim->bodies, &sim->tier.cold, &sim->tier.lag, &steps, &dt) != 0) {
+        return -1;
+    }
+    sim->steps = steps;
+    sim->dt = dt;
+    sim->accumulator = 0;
+    printf("resumed %d bodies (%d cold) at step %ld from %s\n",
+           sim->bodies.count + sim->tier.cold.count, sim->tier.cold.count, sim->steps, path);
+    return 0;
+}
+
+int simulation_advance(simulation *sim, double seconds, double *alpha) {
+    sim->accumulator += seconds * SIM_TICKS_PER_SECOND;
+    int taken = 0;
+    while (sim->accumulator >= sim->dt && taken < sim->maxSubsteps) {
+        simulation_step(sim); //a failed cluster step goes on in this process
+        sim->accumulator -= sim->dt;
+        taken++;
+    }
+    if (sim->accumulator >= sim->dt) {
+        // Could not keep up, drop the backlog instead of chasing it next frame
+        sim->accumulator = fmod(sim->accumulator, sim->dt);
+    }
+    *alpha = sim->accumulator / sim->dt;
+    return taken;
+}
+
+double simulation_clock(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
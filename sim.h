@@ -0,0 +1,102 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include "body.h"
+#include "broadphase.h"
+#include "gravity.h"
+#include "particle_mesh.h"
+#include "profile.h"
+#include "quadtree.h"
+#include "recorder.h"
+#include "thread_pool.h"
+#include "tier.h"
+
+#define SIM_TICKS_PER_SECOND 60 //wall-clock rate of simulated time, one tick is a 60 FPS frame
+#define SIM_DEFAULT_MAX_SUBSTEPS 8
+#define SIM_MAX_BLOCK_LEVELS 16
+#define SIM_BLOCK_ACCURACY 0.025 //eta in dt = sqrt(2 eta eps / |a|), eps being the body's radius
+
+// Everything one physics step needs, shared by the SDL loop and headless runs.
+// Time is measured in ticks: body speeds are pixels per tick and the
+// original frame loop advanced exactly one tick per frame.
+typedef struct {
+    body_store bodies;
+    gravity_mode mode;
+    double theta;        //Barnes-Hut opening angle
+    collision_mode collisions; //what touching bodies do, COLLISION_MERGE by default
+    double dt;           //ticks per step
+    int maxSubsteps;     //cap on steps per rendered frame so a slow frame cannot snowball
+    double accumulator;  //ticks of wall-clock time not yet simulated
+    unsigned forcesChanges; //bodies.changes when ax/ay were last computed
+    const char *checkpointPath; //snapshot written every checkpointEvery steps, NULL for none
+    long checkpointEvery;
+    recorder *recording; //trajectory recorder fed after every step, NULL for none
+    struct live_export *live; //shared-memory segment every step is published to, NULL for none
+    struct frame_export *frames; //offscreen images of every few steps, NULL for none
+    profiler *profiler;  //times each phase of a step, NULL for none
+    struct cluster *cluster;       //worker processes that take the steps, NULL to step here
+    struct cluster_worker *worker; //set inside a worker process, gravity then spans the cluster
+    thread_pool *pool;
+    quadtree tree;
+    particle_mesh mesh;  //set mesh.gridSize to change the particle-mesh resolution
+    broadphase broadphase;
+    tier tier;           //far bodies on cheap monopole updates, set tier.radius to enable
+    long steps;          //steps taken since the simulation started
+    // Block timesteps: with blockLevels > 0 each step of dt is split into
+    // 2^blockLevels substeps and every body advances by dt / 2^level, see
+    // simulation_integrate_blocks
+    int blockLevels;
+    signed char *level;  //level of each slot during a step
+    int *active;         //slots whose step ends on the current substep
+    int levelCapacity;
+    long long forceEvaluations;  //accelerations computed by block steps
+    long long sharedEvaluations; //what one shared step at the finest level in use would have needed
+} simulation;
+
+int simulation_init(simulation *sim, gravity_mode mode, double theta, int threads);
+void simulation_free(simulation *sim);
+
+// Resolve every contact during the last drift: absorb each group of touching
+// bodies and compact the store, or bounce them, depending on sim->collisions
+void simulation_merge(simulation *sim);
+// Fill bodies.ax/ay with the selected gravity engine
+void simulation_gravity(simulation *sim);
+// One kick-drift-kick leapfrog step of sim->dt. ax/ay must hold the forces
+// at the current positions, and hold the forces at the new ones afterwards.
+void simulation_integrate(simulation *sim);
+// One step of sim->dt in power-of-two blocks. At the start every body takes
+// the largest dt / 2^level, level <= blockLevels, that keeps its step under
+// sqrt(2 SIM_BLOCK_ACCURACY radius / |a|). Then each body gets kick-drift-kick
+// steps of its own size; all bodies drift together on the finest substeps but
+// only those whose step ends on a substep get new forces. A body moves to a
+// finer level at the end of any of its steps, to a coarser one only where
+// the coarser steps line up. Same contract on ax/ay as simulation_integrate.
+void simulation_integrate_blocks(simulation *sim);
+// merge, then integrate (recomputing forces first if merges or spawns made them stale,
+// in blocks when blockLevels is set), then update the far-field tier if due,
+// then write a checkpoint if one is due, hand the step to the recorder and
+// the frame export and publish it to the live segment. These last three get
+// the cold tier too, with its bodies where its last update left them.
+// With a cluster the workers take the step instead, and there is no tiering.
+// If the cluster fails, the step is not taken: the cluster is dropped,
+// sim->steps goes back to the step the bodies are at and -1 is returned.
+// The next call steps in this process.
+int simulation_step(simulation *sim);
+// Bring bodies up to date when a cluster holds them, a no-op otherwise
+int simulation_sync(simulation *sim);
+
+// Binary snapshot of the bodies plus the step count and dt. The cold tier
+// is written as it stands, so saving never changes the run.
+int simulation_save(const simulation *sim, const char *path);
+// Continue from a snapshot written by simulation_save or a checkpoint
+int simulation_resume(simulation *sim, const char *path);
+
+// Add `seconds` of wall-clock time and run the whole steps it covers, at most
+// maxSubsteps. Returns the number of steps taken; *alpha is how far the
+// leftover time reaches into the next step, for interpolated drawing.
+int simulation_advance(simulation *sim, double seconds, double *alpha);
+
+// Monotonic wall clock in seconds, for timing runs
+double simulation_clock(void);
+
+#endif
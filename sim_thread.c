@@ -0,0 +1,257 @@
+#define _POSIX_C_SOURCE 199309L //nanosleep
+#include "sim_thread.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct {
+    bool spawn;          //create `body`, otherwise call `command`
+    body body;
+    sim_thread_command command;
+} sim_thread_message;
+
+typedef struct {
+    sim_thread_message *messages;
+    int count;
+    int capacity;
+} sim_thread_queue;
+
+struct sim_thread {
+    simulation *sim;
+    pthread_t thread;
+    pthread_mutex_t frameLock;   //guards `front` and `readers`, only ever held for a few stores
+    pthread_mutex_t queueLock;   //guards `pending`
+    sim_frame frames[SIM_THREAD_FRAMES];
+    int readers[SIM_THREAD_FRAMES]; //acquires of each frame not released yet
+    sim_frame *front;            //latest completed frame
+    sim_thread_queue pending;    //filled by the SDL thread
+    sim_thread_queue running;    //drained by the simulation thread
+    bool started;
+    bool stop;
+};
+
+static int sim_frame_reserve(sim_frame *f, int count) {
+    if (count <= f->capacity) {
+        return 0;
+    }
+    int capacity = (f->capacity == 0) ? 64 : f->capacity;
+    while (capacity < count) {
+        capacity *= 2;
+    }
+    double *x = realloc(f->x, capacity * sizeof(double));
+    if (x) f->x = x;
+    double *y = realloc(f->y, capacity * sizeof(double));
+    if (y) f->y = y;
+    double *prevX = realloc(f->prevX, capacity * sizeof(double));
+    if (prevX) f->prevX = prevX;
+    double *prevY = realloc(f->prevY, capacity * sizeof(double));
+    if (prevY) f->prevY = prevY;
+    double *radius = realloc(f->radius, capacity * sizeof(double));
+    if (radius) f->radius = radius;
+    double *mass = realloc(f->mass, capacity * sizeof(double));
+    if (mass) f->mass = mass;
+    SDL_Color *color = realloc(f->color, capacity * sizeof(SDL_Color));
+    if (color) f->color = color;
+    if (!x || !y || !prevX || !prevY || !radius || !mass || !color) {
+        perror("Error reallocating memory");
+        return -1;
+    }
+    f->capacity = capacity;
+    return 0;
+}
+
+static void sim_frame_free(sim_frame *f) {
+    free(f->x);
+    free(f->y);
+    free(f->prevX);
+    free(f->prevY);
+    free(f->radius);
+    free(f->mass);
+    free(f->color);
+    memset(f, 0, sizeof(*f));
+}
+
+// Copy what the renderer needs out of the store into a frame nobody holds,
+// the cold tier after the hot bodies, and make it the front one. Readers only
+// ever take the front frame, so the copy itself needs no lock.
+static void sim_thread_fill(sim_thread *st, double alpha) {
+    const body_store *store = &st->sim->bodies;
+    const body_store *cold = &st->sim->tier.cold;
+    sim_frame *f = NULL;
+    pthread_mutex_lock(&st->frameLock);
+    for (int k = 0; k < SIM_THREAD_FRAMES && !f; k++) {
+        if (&st->frames[k] != st->front && st->readers[k] == 0) {
+            f = &st->frames[k];
+        }
+    }
+    pthread_mutex_unlock(&st->frameLock);
+    if (!f || sim_frame_reserve(f, store->count + cold->count) != 0) {
+        return; //keep showing the previous frame
+    }
+    int n = 0;
+    for (int i = 0; i < store->count; i++) {
+        if (!store->isAlive[i]) {
+            continue;
+        }
+        f->x[n] = store->x[i];
+        f->y[n] = store->y[i];
+        f->prevX[n] = store->prevX[i];
+        f->prevY[n] = store->prevY[i];
+        f->radius[n] = store->radius[i];
+        f->mass[n] = store->mass[i];
+        f->color[n] = store->color[i];
+        n++;
+    }
+    f->hotCount = n;
+    for (int i = 0; i < cold->count; i++) {
+        if (!cold->isAlive[i]) {
+            continue;
+        }
+        f->x[n] = f->prevX[n] = cold->x[i]; //only moves every few steps, nothing to interpolate
+        f->y[n] = f->prevY[n] = cold->y[i];
+        f->radius[n] = cold->radius[i];
+        f->mass[n] = cold->mass[i];
+        f->color[n] = cold->color[i];
+        n++;
+    }
+    f->count = n;
+    f->alpha = alpha;
+    f->steps = st->sim->steps;
+
+    pthread_mutex_lock(&st->frameLock);
+    st->front = f;
+    pthread_mutex_unlock(&st->frameLock);
+}
+
+// Apply everything the SDL thread queued since the last pass
+static void sim_thread_drain(sim_thread *st) {
+    pthread_mutex_lock(&st->queueLock);
+    sim_thread_queue swap = st->running;
+    st->running = st->pending;
+    st->pending = swap;
+    st->pending.count = 0;
+    pthread_mutex_unlock(&st->queueLock);
+
+    for (int i = 0; i < st->running.count; i++) {
+        sim_thread_message *m = &st->running.messages[i];
+        if (m->spawn) {
+            body_store_push(&st->sim->bodies, &m->body);
+        } else {
+            m->command(st->sim);
+        }
+    }
+    st->running.count = 0;
+}
+
+static void *sim_thread_main(void *arg) {
+    sim_thread *st = arg;
+    double frame = 1.0 / SIM_TICKS_PER_SECOND;
+    double last = simulation_clock();
+    while (!__atomic_load_n(&st->stop, __ATOMIC_ACQUIRE)) {
+        double start = simulation_clock();
+        sim_thread_drain(st);
+        double alpha;
+        simulation_advance(st->sim, start - last, &alpha);
+        last = start;
+        sim_thread_fill(st, alpha);
+
+        // Publish at most once per tick, no point outrunning the display
+        double left = frame - (simulation_clock() - start);
+        if (left > 0) {
+            struct timespec nap = {0, (long)(left * 1e9)};
+            nanosleep(&nap, NULL);
+        }
+    }
+    return NULL;
+}
+
+sim_thread *sim_thread_start(simulation *sim) {
+    sim_thread *st = calloc(1, sizeof(sim_thread));
+    if (!st) {
+        perror("Error allocating memory");
+        return NULL;
+    }
+    st->sim = sim;
+    st->front = &st->frames[0];
+    pthread_mutex_init(&st->frameLock, NULL);
+    pthread_mutex_init(&st->queueLock, NULL);
+
+    // Publish the starting state so the first frames have something to draw
+    sim_thread_fill(st, 0);
+    if (pthread_create(&st->thread, NULL, sim_thread_main, st) != 0) {
+        printf("Error creating simulation thread\n");
+        sim_thread_stop(st);
+        return NULL;
+    }
+    st->started = true;
+    return st;
+}
+
+static void sim_thread_destroy(sim_thread *st) {
+    pthread_mutex_destroy(&st->frameLock);
+    pthread_mutex_destroy(&st->queueLock);
+    for (int k = 0; k < SIM_THREAD_FRAMES; k++) {
+        sim_frame_free(&st->frames[k]);
+    }
+    free(st->pending.messages);
+    free(st->running.messages);
+    free(st);
+}
+
+void sim_thread_stop(sim_thread *st) {
+    if (!st) {
+        return;
+    }
+    if (st->started) {
+        __atomic_store_n(&st->stop, true, __ATOMIC_RELEASE);
+        pthread_join(st->thread, NULL);
+    }
+    sim_thread_destroy(st);
+}
+
+static int sim_thread_post(sim_thread *st, const sim_thread_message *m) {
+    pthread_mutex_lock(&st->queueLock);
+    sim_thread_queue *q = &st->pending;
+    if (q->count == q->capacity) {
+        int capacity = (q->capacity == 0) ? 16 : q->capacity * 2;
+        sim_thread_message *messages = realloc(q->messages, capacity * sizeof(sim_thread_message));
+        if (!messages) {
+            pthread_mutex_unlock(&st->queueLock);
+            perror("Error reallocating memory");
+            return -1;
+        }
+        q->messages = messages;
+        q->capacity = capacity;
+    }
+    q->messages[q->count++] = *m;
+    pthread_mutex_unlock(&st->queueLock);
+    return 0;
+}
+
+int sim_thread_spawn(sim_thread *st, const body *b) {
+    sim_thread_message m = {true, *b, NULL};
+    return sim_thread_post(st, &m);
+}
+
+int sim_thread_run(sim_thread *st, sim_thread_command command) {
+    sim_thread_message m;
+    memset(&m, 0, sizeof(m));
+    m.command = command;
+    return sim_thread_post(st, &m);
+}
+
+const sim_frame *sim_thread_acquire(sim_thread *st) {
+    pthread_mutex_lock(&st->frameLock);
+    sim_frame *f = st->front;
+    st->readers[f - st->frames]++;
+    pthread_mutex_unlock(&st->frameLock);
+    return f;
+}
+
+void sim_thread_release(sim_thread *st, const sim_frame *frame) {
+    pthread_mutex_lock(&st->frameLock);
+    st->readers[frame - st->frames]--;
+    pthread_mutex_unlock(&st->frameLock);
+}
@@ -0,0 +1,49 @@
+#ifndef SIM_THREAD_H
+#define SIM_THREAD_H
+
+#include "sim.h"
+
+// What the renderer needs of one completed physics frame, alive bodies only
+typedef struct {
+    int count;
+    int hotCount;        //the first hotCount bodies are hot, the rest are the cold tier's
+    int capacity;
+    double *x, *y;
+    double *prevX, *prevY;
+    double *radius;
+    double *mass;
+    SDL_Color *color;
+    double alpha;        //how far to interpolate from prev towards x/y
+    long steps;
+} sim_frame;
+
+// Function the simulation thread runs between steps, for anything that
+// must touch the simulation while it is running
+typedef void (*sim_thread_command)(simulation *sim);
+
+#define SIM_THREAD_FRAMES 3 //the front frame, one a reader holds and one to fill
+
+// Runs simulation_advance on its own thread in real time. Each pass fills
+// a frame no reader holds and makes it the front one. Readers hold frames
+// without holding a lock, so the SDL thread only ever waits for a pointer
+// swap and never for a physics step, and the physics never waits for a
+// draw. When every other frame is held (two readers on two older frames)
+// the pass skips publishing.
+typedef struct sim_thread sim_thread;
+
+// The simulation belongs to the thread until sim_thread_stop returns
+sim_thread *sim_thread_start(simulation *sim);
+void sim_thread_stop(sim_thread *st);
+
+// Queue a body to be created before the next step
+int sim_thread_spawn(sim_thread *st, const body *b);
+// Queue a function to be run before the next step
+int sim_thread_run(sim_thread *st, sim_thread_command command);
+
+// Return the latest completed frame. It stays valid and unchanged until
+// sim_thread_release; holding it never stalls the simulation thread, but
+// newer frames are only published while a spare one is free.
+const sim_frame *sim_thread_acquire(sim_thread *st);
+void sim_thread_release(sim_thread *st, const sim_frame *frame);
+
+#endif
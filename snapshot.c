@@ -0,0 +1,301 @@
+#define _POSIX_C_SOURCE 200112L //mmap, fstat
+#include "snapshot.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const size_t field_size[SNAPSHOT_FIELDS] = {
+    sizeof(double), sizeof(double), sizeof(double), sizeof(double), sizeof(double),
+    sizeof(double), sizeof(double), sizeof(double), sizeof(SDL_Color), sizeof(int32_t)
+};
+
+#define SNAPSHOT_PARKED -2 //slotOf mark of a cold id while a load builds the free list
+
+static uint64_t align_up(uint64_t offset) {
+    return (offset + SNAPSHOT_ALIGNMENT - 1) / SNAPSHOT_ALIGNMENT * SNAPSHOT_ALIGNMENT;
+}
+
+// Source array of each field in the store
+static const void *store_field(const body_store *store, int field) {
+    switch (field) {
+        case SNAPSHOT_X: return store->x;
+        case SNAPSHOT_Y: return store->y;
+        case SNAPSHOT_PREV_X: return store->prevX;
+        case SNAPSHOT_PREV_Y: return store->prevY;
+        case SNAPSHOT_VX: return store->vx;
+        case SNAPSHOT_VY: return store->vy;
+        case SNAPSHOT_MASS: return store->mass;
+        case SNAPSHOT_RADIUS: return store->radius;
+        case SNAPSHOT_COLOR: return store->color;
+        case SNAPSHOT_ID: return store->id;
+    }
+    return NULL;
+}
+
+// Write one array of the living bodies of a store, `alive` of them. A store
+// built with float precision is widened on the way out, snapshots are always double.
+static bool write_field(FILE *file, const body_store *store, int f, int alive) {
+    const char *array = store_field(store, f);
+    size_t size = (f < SNAPSHOT_COLOR) ? sizeof(real) : field_size[f];
+    if (alive == store->count && size == field_size[f]) {
+        // Packed store, the array goes out in one write
+        return fwrite(array, field_size[f], alive, file) == (size_t)alive;
+    }
+    double widened[1024];
+    int pending = 0;
+    for (int i = 0; i < store->count; i++) {
+        if (!store->isAlive[i]) {
+            continue;
+        }
+        if (size == field_size[f]) {
+            if (fwrite(array + i * size, size, 1, file) != 1) {
+                return false;
+            }
+            continue;
+        }
+        widened[pending++] = ((const real *)array)[i];
+        if (pending == 1024) {
+            if (fwrite(widened, sizeof(double), pending, file) != (size_t)pending) {
+                return false;
+            }
+            pending = 0;
+        }
+    }
+    return fwrite(widened, sizeof(double), pending, file) == (size_t)pending;
+}
+
+static int count_alive(const body_store *store) {
+    int alive = 0;
+    for (int i = 0; store && i < store->count; i++) {
+        alive += store->isAlive[i];
+    }
+    return alive;
+}
+
+int snapshot_write(const char *path, const body_store *store, const body_store *cold, double coldLag,
+                   long steps, double dt) {
+    char tmp[4096];
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)) {
+        printf("Snapshot path too long: %s\n", path);
+        return -1;
+    }
+    FILE *file = fopen(tmp, "wb");
+    if (!file) {
+        perror("Error opening file");
+        return -1;
+    }
+
+    int hot = count_alive(store);
+    int numCold = count_alive(cold);
+    int alive = hot + numCold;
+
+    snapshot_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.byteOrder = SNAPSHOT_BYTE_ORDER;
+    header.count = alive;
+    header.cold = numCold;
+    header.steps = steps;
+    header.dt = dt;
+    header.coldLag = (numCold > 0) ? coldLag : 0;
+    uint64_t offset = align_up(sizeof(header));
+    for (int f = 0; f < SNAPSHOT_FIELDS; f++) {
+        header.offsets[f] = offset;
+        offset = align_up(offset + field_size[f] * alive);
+    }
+
+    static const char padding[SNAPSHOT_ALIGNMENT] = {0};
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    long written = sizeof(header);
+    for (int f = 0; f < SNAPSHOT_FIELDS && ok; f++) {
+        ok = fwrite(padding, 1, header.offsets[f] - written, file) == header.offsets[f] - written;
+        ok = ok && write_field(file, store, f, hot);
+        ok = ok && (!cold || write_field(file, cold, f, numCold));
+        written = header.offsets[f] + field_size[f] * alive;
+    }
+
+    if (fclose(file) != 0 || !ok) {
+        perror("Error writing snapshot");
+        remove(tmp);
+        return -1;
+    }
+    if (rename(tmp, path) != 0) {
+        perror("Error renaming snapshot");
+        remove(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+int snapshot_map(const char *path, snapshot_view *view) {
+    memset(view, 0, sizeof(*view));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("Error opening snapshot");
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(snapshot_header)) {
+        printf("Snapshot %s is too small\n", path);
+        close(fd);
+        return -1;
+    }
+    void *mapping = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); //the mapping keeps the file open
+    if (mapping == MAP_FAILED) {
+        perror("Error mapping snapshot");
+        return -1;
+    }
+    view->mapping = mapping;
+    view->size = st.st_size;
+    memcpy(&view->header, mapping, sizeof(snapshot_header));
+
+    const snapshot_header *h = &view->header;
+    if (memcmp(h->magic, SNAPSHOT_MAGIC, sizeof(h->magic)) != 0) {
+        printf("%s is not a snapshot\n", path);
+        snapshot_unmap(view);
+        return -1;
+    }
+    if (h->byteOrder != SNAPSHOT_BYTE_ORDER || h->version != SNAPSHOT_VERSION) {
+        printf("Snapshot %s has version %u, byte order %08x; expected version %d\n",
+               path, h->version, h->byteOrder, SNAPSHOT_VERSION);
+        snapshot_unmap(view);
+        return -1;
+    }
+    if (h->cold > h->count) {
+        printf("Snapshot %s is truncated or corrupt\n", path);
+        snapshot_unmap(view);
+        return -1;
+    }
+    for (int f = 0; f < SNAPSHOT_FIELDS; f++) {
+        if (h->offsets[f] % SNAPSHOT_ALIGNMENT != 0 || h->offsets[f] + field_size[f] * h->count > view->size) {
+            printf("Snapshot %s is truncated or corrupt\n", path);
+            snapshot_unmap(view);
+            return -1;
+        }
+    }
+
+    const char *base = mapping;
+    view->count = (int)h->count;
+    view->x = (const double *)(base + h->offsets[SNAPSHOT_X]);
+    view->y = (const double *)(base + h->offsets[SNAPSHOT_Y]);
+    view->prevX = (const double *)(base + h->offsets[SNAPSHOT_PREV_X]);
+    view->prevY = (const double *)(base + h->offsets[SNAPSHOT_PREV_Y]);
+    view->vx = (const double *)(base + h->offsets[SNAPSHOT_VX]);
+    view->vy = (const double *)(base + h->offsets[SNAPSHOT_VY]);
+    view->mass = (const double *)(base + h->offsets[SNAPSHOT_MASS]);
+    view->radius = (const double *)(base + h->offsets[SNAPSHOT_RADIUS]);
+    view->color = (const SDL_Color *)(base + h->offsets[SNAPSHOT_COLOR]);
+    view->id = (const int32_t *)(base + h->offsets[SNAPSHOT_ID]);
+    return 0;
+}
+
+void snapshot_unmap(snapshot_view *view) {
+    if (view->mapping) {
+        munmap(view->mapping, view->size);
+    }
+    memset(view, 0, sizeof(*view));
+}
+
+int snapshot_load(const char *path, body_store *store, body_store *cold, double *coldLag, long *steps, double *dt) {
+    snapshot_view view;
+    if (snapshot_map(path, &view) != 0) {
+        return -1;
+    }
+
+    int n = view.count;
+    int hot = cold ? n - (int)view.header.cold : n; //bodies [hot, n) go to the cold store
+    int maxId = -1;
+    for (int i = 0; i < n; i++) {
+        if (view.id[i] < 0) {
+            printf("Snapshot %s has a negative body id\n", path);
+            snapshot_unmap(&view);
+            return -1;
+        }
+        if (view.id[i] > maxId) {
+            maxId = view.id[i];
+        }
+    }
+
+    // slotOf is indexed by id, so ids set the capacity as well as the count
+    body_store_free(store);
+    if (body_store_reserve(store, (maxId + 1 > n) ? maxId + 1 : n) != 0) {
+        snapshot_unmap(&view);
+        return -1;
+    }
+    // Element by element: the store may be float
+    for (int i = 0; i < hot; i++) {
+        store->x[i] = view.x[i];
+        store->y[i] = view.y[i];
+        store->prevX[i] = view.prevX[i]; //the first merges sweep the drift before the snapshot
+        store->prevY[i] = view.prevY[i];
+        store->vx[i] = view.vx[i];
+        store->vy[i] = view.vy[i];
+        store->mass[i] = view.mass[i];
+        store->radius[i] = view.radius[i];
+        store->ax[i] = store->ay[i] = 0;
+    }
+    memcpy(store->color, view.color, hot * sizeof(SDL_Color));
+
+    // Cold ids are marked SNAPSHOT_PARKED while the free list is built, so
+    // they are neither free nor in use once it is
+    store->nextId = maxId + 1;
+    for (int id = 0; id < store->nextId; id++) {
+        store->slotOf[id] = -1;
+    }
+    for (int i = 0; i < n; i++) {
+        if (store->slotOf[view.id[i]] != -1) {
+            printf("Snapshot %s has body id %d twice\n", path, (int)view.id[i]);
+            body_store_free(store);
+            snapshot_unmap(&view);
+            return -1;
+        }
+        if (i >= hot) {
+            store->slotOf[view.id[i]] = SNAPSHOT_PARKED;
+            continue;
+        }
+        store->isAlive[i] = true;
+        store->id[i] = view.id[i];
+        store->slotOf[view.id[i]] = i;
+    }
+    for (int id = store->nextId - 1; id >= 0; id--) {
+        if (store->slotOf[id] == -1) {
+            store->freeIds[store->numFreeIds++] = id;
+        } else if (store->slotOf[id] == SNAPSHOT_PARKED) {
+            store->slotOf[id] = -1;
+        }
+    }
+    store->count = hot;
+    store->changes++;
+
+    if (cold) {
+        body_store_free(cold);
+        for (int i = hot; i < n; i++) {
+            body b;
+            b.isAlive = true;
+            b.x = view.x[i];
+            b.y = view.y[i];
+            b.Xspeed = view.vx[i];
+            b.Yspeed = view.vy[i];
+            b.mass = view.mass[i];
+            b.radius = view.radius[i];
+            b.color = view.color[i];
+            if (body_store_attach(cold, &b, view.id[i]) < 0) {
+                body_store_free(store);
+                snapshot_unmap(&view);
+                return -1;
+            }
+        }
+        *coldLag = view.header.coldLag;
+    }
+
+    *steps = (long)view.header.steps;
+    *dt = view.header.dt;
+    snapshot_unmap(&view);
+    return 0;
+}
@@ -0,0 +1,73 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "body.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#define SNAPSHOT_MAGIC "GRAVSNAP"
+#define SNAPSHOT_VERSION 3 //2 added prevX/prevY, 3 the far-field tier
+#define SNAPSHOT_BYTE_ORDER 0x01020304u //written natively, reads back differently on the other endianness
+#define SNAPSHOT_ALIGNMENT 64 //every array starts on a cache line so mapped arrays can feed the kernels
+
+// Arrays in a snapshot, in file order
+enum {
+    SNAPSHOT_X,       //double[count]
+    SNAPSHOT_Y,       //double[count]
+    SNAPSHOT_PREV_X,  //double[count], positions before the last drift, which merges sweep from
+    SNAPSHOT_PREV_Y,  //double[count]
+    SNAPSHOT_VX,      //double[count]
+    SNAPSHOT_VY,      //double[count]
+    SNAPSHOT_MASS,    //double[count]
+    SNAPSHOT_RADIUS,  //double[count]
+    SNAPSHOT_COLOR,   //SDL_Color[count], r g b a bytes
+    SNAPSHOT_ID,      //int32_t[count], stable body ids
+    SNAPSHOT_FIELDS
+};
+
+// File header, followed by the packed arrays at the given offsets
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint64_t count;                      //bodies in the file
+    uint64_t cold;                       //the last `cold` of them belong to the far-field tier
+    uint64_t steps;                      //simulation steps taken when it was written
+    double dt;                           //ticks per step of the run that wrote it
+    double coldLag;                      //ticks the cold bodies are behind the hot ones
+    uint64_t offsets[SNAPSHOT_FIELDS];   //byte offset of each array from the start of the file
+} snapshot_header;
+
+// Read-only view of a memory-mapped snapshot. The arrays point straight
+// into the mapping, nothing is copied.
+typedef struct {
+    void *mapping;
+    size_t size;
+    snapshot_header header;
+    const double *x, *y;
+    const double *prevX, *prevY;
+    const double *vx, *vy;
+    const double *mass;
+    const double *radius;
+    const SDL_Color *color;
+    const int32_t *id;
+    int count;
+} snapshot_view;
+
+// Write the living bodies of `store`, then those of `cold` (the far-field
+// tier, may be NULL) `coldLag` ticks behind them. The file is written next
+// to `path` and renamed over it, so a crash mid-write never leaves a torn
+// checkpoint behind.
+int snapshot_write(const char *path, const body_store *store, const body_store *cold, double coldLag,
+                   long steps, double dt);
+
+int snapshot_map(const char *path, snapshot_view *view);
+void snapshot_unmap(snapshot_view *view);
+
+// Replace the contents of `store` and `cold` with the snapshot's hot and
+// cold bodies, keeping body ids. The cold ids stay reserved in `store`, as
+// body_store_detach leaves them. Without `cold` every body goes to `store`
+// and *coldLag is 0.
+int snapshot_load(const char *path, body_store *store, body_store *cold, double *coldLag, long *steps, double *dt);
+
+#endif
@@ -0,0 +1,145 @@
+#define _POSIX_C_SOURCE 200112L //sysconf
+#include "thread_pool.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+typedef struct {
+    thread_pool *pool;
+    int index;
+} thread_pool_worker;
+
+struct thread_pool {
+    pthread_t *threads;
+    thread_pool_worker *workers;
+    int numThreads;           //workers plus the calling thread
+    pthread_mutex_t lock;
+    pthread_cond_t start;     //signalled when a new batch is posted
+    pthread_cond_t done;      //signalled when the last worker leaves a batch
+    thread_pool_task task;
+    void *context;
+    int numTasks;
+    int nextTask;
+    int busy;                 //workers still inside the current batch
+    unsigned generation;      //batch counter, lets workers tell batches apart
+    bool stop;
+};
+
+// Claim and run tasks until the batch is empty, called with the lock held
+static void thread_pool_drain(thread_pool *pool, int thread) {
+    while (pool->nextTask < pool->numTasks) {
+        int task = pool->nextTask++;
+        pthread_mutex_unlock(&pool->lock);
+        pool->task(pool->context, task, thread);
+        pthread_mutex_lock(&pool->lock);
+    }
+}
+
+static void *thread_pool_main(void *arg) {
+    thread_pool_worker *worker = arg;
+    thread_pool *pool = worker->pool;
+    unsigned seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    while (true) {
+        while (pool->generation == seen && !pool->stop) {
+            pthread_cond_wait(&pool->start, &pool->lock);
+        }
+        if (pool->stop) {
+            break;
+        }
+        seen = pool->generation;
+        thread_pool_drain(pool, worker->index);
+        if (--pool->busy == 0) {
+            pthread_cond_signal(&pool->done);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+thread_pool *thread_pool_create(int numThreads) {
+    thread_pool *pool = calloc(1, sizeof(thread_pool));
+    if (!pool) {
+        perror("Error allocating memory");
+        return NULL;
+    }
+    pool->numThreads = (numThreads < 1) ? 1 : numThreads;
+    pool->threads = calloc(pool->numThreads, sizeof(pthread_t));
+    pool->workers = calloc(pool->numThreads, sizeof(thread_pool_worker));
+    if (!pool->threads || !pool->workers) {
+        perror("Error allocating memory");
+        free(pool->threads);
+        free(pool->workers);
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    for (int i = 1; i < pool->numThreads; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+        if (pthread_create(&pool->threads[i], NULL, thread_pool_main, &pool->workers[i]) != 0) {
+            printf("Error creating worker thread %d, continuing with %d\n", i, i);
+            pool->numThreads = i;
+            break;
+        }
+    }
+    return pool;
+}
+
+void thread_pool_destroy(thread_pool *pool) {
+    if (!pool) {
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 1; i < pool->numThreads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+    free(pool->threads);
+    free(pool->workers);
+    free(pool);
+}
+
+int thread_pool_size(const thread_pool *pool) {
+    return pool ? pool->numThreads : 1;
+}
+
+void thread_pool_run(thread_pool *pool, int numTasks, thread_pool_task task, void *context) {
+    if (!pool || pool->numThreads == 1 || numTasks <= 1) {
+        for (int i = 0; i < numTasks; i++) {
+            task(context, i, 0);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->task = task;
+    pool->context = context;
+    pool->numTasks = numTasks;
+    pool->nextTask = 0;
+    pool->busy = pool->numThreads - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+
+    thread_pool_drain(pool, 0);
+    while (pool->busy > 0) {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+int thread_pool_cpu_count(void) {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return (count < 1) ? 1 : (int)count;
+}
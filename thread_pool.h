@@ -0,0 +1,22 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+// Work function for one task. `thread` is 0 for the calling thread and
+// 1..numThreads-1 for the pool workers, so it can index per-thread scratch.
+typedef void (*thread_pool_task)(void *context, int task, int thread);
+
+typedef struct thread_pool thread_pool;
+
+// Start numThreads - 1 workers, the thread calling thread_pool_run is the last one
+thread_pool *thread_pool_create(int numThreads);
+void thread_pool_destroy(thread_pool *pool);
+int thread_pool_size(const thread_pool *pool);
+
+// Run tasks 0..numTasks-1 across the pool and return once all have finished.
+// Tasks are handed out in order but may complete in any order.
+void thread_pool_run(thread_pool *pool, int numTasks, thread_pool_task task, void *context);
+
+// Number of CPUs available to the process, at least 1
+int thread_pool_cpu_count(void);
+
+#endif
@@ -0,0 +1,171 @@
+#include "tier.h"
+#include <math.h>
+#include <string.h>
+
+// Total mass of the living bodies of a store, their centre of mass and its velocity
+typedef struct {
+    double mass;
+    double x, y;
+    double vx, vy;
+} tier_monopole;
+
+void tier_init(tier *t) {
+    memset(t, 0, sizeof(*t));
+    t->every = TIER_DEFAULT_EVERY;
+    body_store_init(&t->cold);
+}
+
+void tier_free(tier *t) {
+    body_store_free(&t->cold);
+}
+
+static tier_monopole tier_core(const body_store *store) {
+    tier_monopole core;
+    memset(&core, 0, sizeof(core));
+    for (int i = 0; i < store->count; i++) {
+        if (!store->isAlive[i]) {
+            continue;
+        }
+        core.mass += store->mass[i];
+        core.x += store->mass[i] * store->x[i];
+        core.y += store->mass[i] * store->y[i];
+        core.vx += store->mass[i] * store->vx[i];
+        core.vy += store->mass[i] * store->vy[i];
+    }
+    if (core.mass > 0) {
+        core.x /= core.mass;
+        core.y /= core.mass;
+        core.vx /= core.mass;
+        core.vy /= core.mass;
+    }
+    return core;
+}
+
+// Whether body i belongs in the cold tier: further from the core than
+// `limit`, or past half the radius and escaping
+static bool tier_far(const tier *t, const tier_monopole *core, const body_store *store, int i, double limit) {
+    double dx = store->x[i] - core->x;
+    double dy = store->y[i] - core->y;
+    double d2 = dx * dx + dy * dy;
+    if (d2 > limit * limit) {
+        return true;
+    }
+    if (d2 <= 0.25 * t->radius * t->radius) {
+        return false;
+    }
+    double ux = store->vx[i] - core->vx;
+    double uy = store->vy[i] - core->vy;
+    // Energy per unit mass in pixels^2 per tick^2, as the kicks scale forces
+    double energy = 0.5 * (ux * ux + uy * uy) - GRAVITATIONAL_CONSTANT * GRAVITY_TIMESTEP * core->mass / sqrt(d2);
+    return energy > 0 && ux * dx + uy * dy > 0;
+}
+
+// Move body `index` of `from` into `to` under the same id, tombstoning it in `from`
+static int tier_move(body_store *from, int index, body_store *to) {
+    body b = body_store_get(from, index);
+    if (body_store_attach(to, &b, from->id[index]) < 0) {
+        return -1;
+    }
+    body_store_detach(from, index);
+    return 0;
+}
+
+// Half a kick of cold body i towards the core, adding the momentum it takes to (px, py)
+static void tier_kick(body_store *cold, int i, const tier_monopole *core, double g, double *px, double *py) {
+    double dx = core->x - cold->x[i];
+    double dy = core->y - cold->y[i];
+    double d2 = dx * dx + dy * dy;
+    if (d2 > 0) {
+        double scale = g / (d2 * sqrt(d2));
+        cold->vx[i] += scale * dx;
+        cold->vy[i] += scale * dy;
+        *px += cold->mass[i] * scale * dx;
+        *py += cold->mass[i] * scale * dy;
+    }
+}
+
+// One kick-drift-kick step of `ticks` for every cold body around the core
+// standing still, then give the core the opposite momentum. Velocities stay
+// in step with positions, as the hot integrator expects when a body returns.
+static void tier_advance(tier *t, body_store *hot, const tier_monopole *core, double ticks) {
+    body_store *cold = &t->cold;
+    double g = GRAVITATIONAL_CONSTANT * GRAVITY_TIMESTEP * core->mass * ticks / 2;
+    double px = 0, py = 0;
+    for (int i = 0; i < cold->count; i++) {
+        if (!cold->isAlive[i]) {
+            continue;
+        }
+        tier_kick(cold, i, core, g, &px, &py);
+        cold->x[i] += cold->vx[i] * ticks;
+        cold->y[i] += cold->vy[i] * ticks;
+        cold->prevX[i] = cold->x[i];
+        cold->prevY[i] = cold->y[i];
+        tier_kick(cold, i, core, g, &px, &py);
+    }
+    for (int i = 0; i < hot->count; i++) {
+        if (!hot->isAlive[i]) {
+            continue;
+        }
+        hot->vx[i] -= px / core->mass;
+        hot->vy[i] -= py / core->mass;
+    }
+}
+
+int tier_update(tier *t, body_store *hot, long steps, double dt) {
+    t->lag += dt;
+    if (t->radius <= 0 || t->every <= 0 || steps % t->every != 0) {
+        return 0;
+    }
+    // Nothing left to measure from, everything stays where it is
+    tier_monopole core = tier_core(hot);
+    if (core.mass <= 0) {
+        return 0;
+    }
+    tier_advance(t, hot, &core, t->lag);
+    t->lag = 0;
+
+    // Both ways are decided against the core as it was before anything moved
+    int hotCount = hot->count;
+    int promoted = 0, demoted = 0;
+    for (int i = 0; i < t->cold.count; i++) {
+        if (t->cold.isAlive[i] && !tier_far(t, &core, &t->cold, i, TIER_RETURN_FRACTION * t->radius)) {
+            if (tier_move(&t->cold, i, hot) != 0) {
+                return -1;
+            }
+            promoted++;
+        }
+    }
+    for (int i = 0; i < hotCount; i++) {
+        if (hot->isAlive[i] && tier_far(t, &core, hot, i, t->radius)) {
+            if (tier_move(hot, i, &t->cold) != 0) {
+                return -1;
+            }
+            demoted++;
+        }
+    }
+    if (promoted > 0) {
+        body_store_compact(&t->cold);
+    }
+    if (demoted > 0) {
+        body_store_compact(hot);
+    }
+    t->promoted += promoted;
+    t->demoted += demoted;
+    return 0;
+}
+
+int tier_thaw(tier *t, body_store *hot) {
+    // Catch the cold bodies up with the steps since the last update first
+    tier_monopole core = tier_core(hot);
+    if (t->cold.count > 0 && t->lag > 0 && core.mass > 0) {
+        tier_advance(t, hot, &core, t->lag);
+    }
+    t->lag = 0;
+    for (int i = 0; i < t->cold.count; i++) {
+        if (t->cold.isAlive[i] && tier_move(&t->cold, i, hot) != 0) {
+            return -1;
+        }
+    }
+    body_store_compact(&t->cold);
+    return 0;
+}
@@ -0,0 +1,45 @@
+#ifndef TIER_H
+#define TIER_H
+
+#include "body.h"
+
+#define TIER_DEFAULT_EVERY 16     //steps between updates of the cold tier
+#define TIER_RETURN_FRACTION 0.9  //cold bodies come back inside this fraction of the radius
+
+// Far-field tiering. Bodies flung out of the system would otherwise keep
+// paying for a tree walk, a grid cell and a collision test every step, and
+// stretch the tree and the particle-mesh grid for everyone else.
+//
+// Measured from the centre of mass of the hot bodies (the core), a body goes
+// cold beyond `radius`, or beyond half of it when it is moving away on an
+// unbound orbit. Cold bodies move to a store of their own and only
+// interact through monopoles:
+// - every `every` steps each cold body is kicked by the core as one point
+//   mass and drifts for the whole interval;
+// - the core as a whole takes the opposite kick, since far away bodies pull
+//   all of it nearly the same way;
+// - cold bodies do not feel or hit each other.
+// A cold body comes back inside TIER_RETURN_FRACTION of the radius unless it
+// is still leaving. Bodies keep their ids both ways: the cold store only
+// holds ids the hot one detached, and never hands out any of its own.
+typedef struct {
+    double radius;   //0 keeps every body hot
+    int every;
+    body_store cold;
+    double lag;      //ticks the hot bodies moved since the cold ones last did
+    long demoted;    //bodies that went cold so far
+    long promoted;   //bodies that came back so far
+} tier;
+
+void tier_init(tier *t);
+void tier_free(tier *t);
+
+// Call after every step of dt ticks, `steps` counting it. When an update is
+// due, advance the cold tier by every tick since the last one and move
+// bodies between the tiers. Returns -1 if memory runs out.
+int tier_update(tier *t, body_store *hot, long steps, double dt);
+// Advance the cold bodies to the hot ones' time and hand them all back, for
+// anything that needs them all. Returns -1 if memory runs out.
+int tier_thaw(tier *t, body_store *hot);
+
+#endif
@@ -0,0 +1,104 @@
+// Example reader of the live state a running `gravity --live <name>`
+// publishes. Maps the segment read-only and, whenever a new step is out,
+// works out a few totals straight from the shared arrays without copying
+// them. Exits when the simulation does.
+#define _POSIX_C_SOURCE 199309L //nanosleep
+#include "live.h"
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define WATCH_DEFAULT_INTERVAL 500 //milliseconds between lines
+#define WATCH_POLL 1               //milliseconds between attempts while waiting
+
+typedef struct {
+    double mass;
+    double centreX, centreY;
+    double kinetic;
+    double minX, minY, maxX, maxY;
+} watch_totals;
+
+static void watch_sleep(long ms) {
+    struct timespec t = {ms / 1000, (ms % 1000) * 1000000L};
+    nanosleep(&t, NULL);
+}
+
+static double watch_clock(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static watch_totals watch_sum(const live_frame *f) {
+    watch_totals t = {0, 0, 0, 0, DBL_MAX, DBL_MAX, -DBL_MAX, -DBL_MAX};
+    for (int i = 0; i < f->count; i++) {
+        double m = f->mass[i];
+        t.mass += m;
+        t.centreX += m * f->x[i];
+        t.centreY += m * f->y[i];
+        t.kinetic += 0.5 * m * (f->vx[i] * f->vx[i] + f->vy[i] * f->vy[i]);
+        t.minX = fmin(t.minX, f->x[i]);
+        t.minY = fmin(t.minY, f->y[i]);
+        t.maxX = fmax(t.maxX, f->x[i]);
+        t.maxY = fmax(t.maxY, f->y[i]);
+    }
+    if (t.mass > 0) {
+        t.centreX /= t.mass;
+        t.centreY /= t.mass;
+    }
+    return t;
+}
+
+int main(int argc, char *argv[]) {
+    const char *name = LIVE_DEFAULT_NAME;
+    long interval = WATCH_DEFAULT_INTERVAL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--interval") == 0 && i + 1 < argc) {
+            interval = atol(argv[++i]);
+        } else if (argv[i][0] != '-') {
+            name = argv[i];
+        } else {
+            printf("Usage: %s [shared memory name, default " LIVE_DEFAULT_NAME "] [--interval <ms>]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    live_reader reader;
+    while (live_attach(&reader, name) != 0) {
+        watch_sleep(100); //the simulation has not started yet
+    }
+    printf("attached to %s\n", name);
+
+    uint64_t last = UINT64_MAX;
+    long torn = 0;
+    double next = 0;
+    for (;;) {
+        live_frame frame;
+        int status = live_begin(&reader, &frame);
+        if (status < 0) {
+            break;
+        }
+        if (status > 0 || frame.steps == last || watch_clock() < next) {
+            watch_sleep(WATCH_POLL);
+            continue;
+        }
+        watch_totals t = watch_sum(&frame);
+        if (!live_end(&reader, &frame)) {
+            torn++; //overwritten while we summed it, try the newer step
+            continue;
+        }
+        last = frame.steps;
+        next = watch_clock() + interval / 1000.0;
+        printf("step %llu: %d bodies, mass %.4g, centre (%.2f, %.2f), kinetic %.6g, "
+               "box (%.0f, %.0f)-(%.0f, %.0f), %ld torn reads\n",
+               (unsigned long long)frame.steps, frame.count, t.mass, t.centreX, t.centreY, t.kinetic,
+               t.minX, t.minY, t.maxX, t.maxY, torn);
+        fflush(stdout);
+    }
+    printf("%s is gone, last step seen %llu\n", name, (unsigned long long)last);
+    live_detach(&reader);
+    return 0;
+}